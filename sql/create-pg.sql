@@ -41,3 +41,13 @@ CREATE TABLE pulse (
     pulses      integer,
     FOREIGN KEY (sensor)  REFERENCES sensors(ix)
 );
+
+-- Records how much of each XML file xml2pg has already imported.
+
+CREATE TABLE import_ledger (
+    path        text PRIMARY KEY,
+    size        bigint,
+    mtime       bigint,
+    byte_offset bigint,
+    last_stamp  timestamp with time zone
+);
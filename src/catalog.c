@@ -0,0 +1,285 @@
+/*
+ * catalog
+ *
+ * A small text file in the data directory with a line per day file so
+ * that history requests and the date picker can tell which days have
+ * data, and over what times, without opening the day files.  The file
+ * logger updates the entry for a day once it has moved on to the next
+ * and xml2catalog rebuilds the whole catalog.  A new catalog is written
+ * to a temporary file and renamed over the old one so readers never see
+ * it half written.
+ */
+
+#define _GNU_SOURCE
+#include "cc-common.h"
+#include "catalog.h"
+#include "linetok.h"
+#include "textfile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char catalog_file[] = "cc-catalog";
+
+static const char catalog_tmp[] = "cc-catalog.tmp";
+static const char catalog_hdr[] = "# day first last lines sensors\n";
+
+cat_catalog *cat_new(void)
+{
+    cat_catalog *cat;
+
+    if ((cat = malloc(sizeof(cat_catalog)))) {
+        cat->count = 0;
+        cat->size = 0;
+        cat->days = NULL;
+    }
+    else
+        log_syserr("unable to allocate catalog");
+    return cat;
+}
+
+void cat_free(cat_catalog *cat)
+{
+    if (cat) {
+        free(cat->days);
+        free(cat);
+    }
+}
+
+static int cat_append(cat_catalog *cat, const cat_day *ent)
+{
+    cat_day *days;
+    unsigned size;
+
+    if (cat->count == cat->size) {
+        size = cat->size ? cat->size * 2 : 64;
+        if ((days = realloc(cat->days, size * sizeof(cat_day))) == NULL) {
+            log_syserr("unable to allocate space for catalog");
+            return -1;
+        }
+        cat->days = days;
+        cat->size = size;
+    }
+    cat->days[cat->count++] = *ent;
+    return 0;
+}
+
+static int parse_entry(cat_day *ent, const char *line)
+{
+    struct tm tm;
+
+    memset(&tm, 0, sizeof tm);
+    if (sscanf(line, "%d-%d-%d %ld %ld %lu %x", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &ent->first, &ent->last, &ent->lines, &ent->sensors) == 7) {
+        tm.tm_year -= 1900;
+        tm.tm_mon--;
+        ent->day = timegm(&tm);
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Load the catalog from the current directory.  A missing catalog is not
+ * an error, it just means nothing is known about which days there are.
+ */
+
+cat_catalog *cat_load(void)
+{
+    cat_catalog *cat;
+    cat_day ent;
+    FILE *fp;
+    char line[100];
+
+    if ((fp = fopen(catalog_file, "r")) == NULL) {
+        if (errno != ENOENT)
+            log_syserr("unable to open catalog '%s'", catalog_file);
+        return NULL;
+    }
+    if ((cat = cat_new())) {
+        while (fgets(line, sizeof line, fp)) {
+            if (line[0] != '#') {
+                if (parse_entry(&ent, line) == 0) {
+                    if (cat->count > 0 && ent.day <= cat->days[cat->count - 1].day)
+                        log_msg("catalog entry '%.10s' out of order, ignored", line);
+                    else if (cat_append(cat, &ent)) {
+                        cat_free(cat);
+                        cat = NULL;
+                        break;
+                    }
+                }
+                else
+                    log_msg("bad catalog entry '%.10s'", line);
+            }
+        }
+    }
+    fclose(fp);
+    return cat;
+}
+
+int cat_save(const cat_catalog *cat)
+{
+    const cat_day *ent, *end;
+    struct tm tm;
+    FILE *fp;
+
+    if ((fp = fopen(catalog_tmp, "w"))) {
+        fputs(catalog_hdr, fp);
+        for (ent = cat->days, end = ent + cat->count; ent < end; ent++) {
+            gmtime_r(&ent->day, &tm);
+            fprintf(fp, "%04d-%02d-%02d %ld %ld %lu %x\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, ent->first, ent->last, ent->lines, ent->sensors);
+        }
+        if (fclose(fp) == 0) {
+            if (rename(catalog_tmp, catalog_file) == 0)
+                return 0;
+            log_syserr("unable to rename '%s' to '%s'", catalog_tmp, catalog_file);
+        }
+        else
+            log_syserr("unable to write catalog '%s'", catalog_tmp);
+        unlink(catalog_tmp);
+    }
+    else
+        log_syserr("unable to open '%s' for writing", catalog_tmp);
+    return -1;
+}
+
+static unsigned cat_index(const cat_catalog *cat, time_t day)
+{
+    unsigned lo = 0, hi = cat->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cat->days[mid].day < day)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+const cat_day *cat_find(const cat_catalog *cat, time_t day)
+{
+    unsigned i;
+
+    day -= day % 86400;
+    if ((i = cat_index(cat, day)) < cat->count && cat->days[i].day == day)
+        return cat->days + i;
+    return NULL;
+}
+
+int cat_set(cat_catalog *cat, const cat_day *ent)
+{
+    unsigned i;
+
+    i = cat_index(cat, ent->day);
+    if (i < cat->count && cat->days[i].day == ent->day) {
+        cat->days[i] = *ent;
+        return 0;
+    }
+    if (cat_append(cat, ent))
+        return -1;
+    memmove(cat->days + i + 1, cat->days + i, (cat->count - 1 - i) * sizeof(cat_day));
+    cat->days[i] = *ent;
+    return 0;
+}
+
+/*
+ * Whether there may be samples in the range from <= ts < to, which there
+ * may be for any part of the range after the days the catalog covers.
+ */
+
+int cat_has_data(const cat_catalog *cat, time_t from, time_t to)
+{
+    const cat_day *ent, *end;
+
+    if (!cat_covers(cat, to - 1))
+        return 1;
+    end = cat->days + cat->count;
+    for (ent = cat->days + cat_index(cat, from - from % 86400); ent < end && ent->day < to; ent++)
+        if (ent->lines > 0 && ent->first < to && ent->last >= from)
+            return 1;
+    return 0;
+}
+
+static mf_status scan_cb(void *user_data, const tf_span *spans, unsigned count)
+{
+    cat_day *ent = user_data;
+    const tf_span *end;
+    lt_line ln;
+
+    for (end = spans + count; spans < end; spans++) {
+        lt_init(&ln);
+        lt_scan(&ln, LT_BIT(LT_TSTAMP) | LT_BIT(LT_SENSOR), spans->ptr, spans->ptr + spans->len);
+        if (ln.found & LT_BIT(LT_TSTAMP)) {
+            if (ent->lines++ == 0 || ln.secs < ent->first)
+                ent->first = ln.secs;
+            if (ln.secs > ent->last)
+                ent->last = ln.secs;
+            if ((ln.found & LT_BIT(LT_SENSOR)) && (unsigned) ln.sensor < MAX_SENSOR)
+                ent->sensors |= 1U << ln.sensor;
+        }
+    }
+    return MF_SUCCESS;
+}
+
+/*
+ * Scan the file for a day to make its catalog entry.  Returns -1 with
+ * errno set to ENOENT, and without logging, if there is no file that day.
+ */
+
+int cat_scan_day(cat_day *ent, time_t day)
+{
+    struct stat stb;
+    struct tm tm;
+    char file[30];
+
+    day -= day % 86400;
+    gmtime_r(&day, &tm);
+    strftime(file, sizeof file, xml_file, &tm);
+    if (stat(file, &stb) == 0) {
+        ent->day = day;
+        ent->first = ent->last = 0;
+        ent->lines = 0;
+        ent->sensors = 0;
+        if (stb.st_size == 0 || tf_parse_spans(file, ent, tf_parse_cb_forward, scan_cb) == MF_SUCCESS)
+            return 0;
+    }
+    else if (errno != ENOENT)
+        log_syserr("unable to stat '%s'", file);
+    return -1;
+}
+
+/*
+ * Bring an existing catalog up to date with the day given and any before
+ * it that were missed, such as when the logger was not running at the
+ * change of day.  A catalog is only ever created by a rebuild as one
+ * started part way through would claim the days before were empty.
+ */
+
+int cat_update_day(time_t day)
+{
+    cat_catalog *cat;
+    cat_day ent;
+    time_t ts;
+    int status = 0;
+
+    if ((cat = cat_load()) == NULL)
+        return errno == ENOENT ? 0 : -1;
+    day -= day % 86400;
+    ts = day;
+    if (cat->count > 0 && cat->days[cat->count - 1].day < day)
+        ts = cat->days[cat->count - 1].day + 86400;
+    for (; status == 0 && ts <= day; ts += 86400) {
+        if (cat_scan_day(&ent, ts) == 0)
+            status = cat_set(cat, &ent);
+        else if (errno != ENOENT)
+            status = -1;
+    }
+    if (status == 0)
+        status = cat_save(cat);
+    cat_free(cat);
+    return status;
+}
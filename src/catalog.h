@@ -0,0 +1,43 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <time.h>
+
+/*
+ * The catalog records, for each day file in the data directory, the
+ * first and last time stamps in it, how many lines have one and which
+ * sensors were seen.  It is kept in day order and covers every day up to
+ * the last one in it, so a day before that with no entry has no file.
+ */
+
+typedef struct {
+    time_t day;                 /* midnight UTC at the start of the day */
+    time_t first;
+    time_t last;
+    unsigned long lines;
+    unsigned sensors;           /* bitmask of sensors seen */
+} cat_day;
+
+typedef struct {
+    unsigned count;
+    unsigned size;
+    cat_day *days;
+} cat_catalog;
+
+extern const char catalog_file[];
+
+extern cat_catalog *cat_new(void);
+extern cat_catalog *cat_load(void);
+extern void cat_free(cat_catalog *cat);
+extern int cat_save(const cat_catalog *cat);
+
+extern const cat_day *cat_find(const cat_catalog *cat, time_t day);
+extern int cat_set(cat_catalog *cat, const cat_day *ent);
+extern int cat_has_data(const cat_catalog *cat, time_t from, time_t to);
+extern int cat_scan_day(cat_day *ent, time_t day);
+extern int cat_update_day(time_t day);
+
+#define cat_covers(cat, ts) \
+    ((cat)->count > 0 && (ts) < (cat)->days[(cat)->count - 1].day + 86400)
+
+#endif
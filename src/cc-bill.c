@@ -0,0 +1,112 @@
+/*
+ * cc-bill
+ *
+ * Costs the day files in the current directory with a time of use tariff
+ * and prints a bill for each local calendar month from the start date up
+ * to the end date, both given as YYYY-MM-DD in local time.  The tariff is
+ * read from cc-tariff unless -f names another file, and -j sets the number
+ * of threads reading day files.
+ */
+
+#define _GNU_SOURCE
+#include "cc-common.h"
+#include "tariff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+const char prog_name[] = "cc-bill";
+
+static const char *const flow_names[TARIFF_FLOWS] = { "import", "export" };
+
+static int parse_date(const char *str, time_t *ts)
+{
+    struct tm tm;
+    const char *end;
+
+    memset(&tm, 0, sizeof tm);
+    if ((end = strptime(str, "%Y-%m-%d", &tm)) == NULL || *end) {
+        log_msg("'%s' is not a date", str);
+        return -1;
+    }
+    tm.tm_isdst = -1;
+    *ts = mktime(&tm);
+    return 0;
+}
+
+static void print_bill(const tariff *tf, const tariff_bill *bill, FILE *fp)
+{
+    const tariff_band *band;
+    struct tm tm;
+    char month[30];
+    int i, flow;
+
+    memset(&tm, 0, sizeof tm);
+    tm.tm_year = bill->year - 1900;
+    tm.tm_mon = bill->month;
+    tm.tm_mday = 1;
+    strftime(month, sizeof month, "%B %Y", &tm);
+    fprintf(fp, "%s\n", month);
+    for (flow = 0; flow < TARIFF_FLOWS; flow++) {
+        for (i = 0, band = tf->bands; i < tf->nbands; i++, band++)
+            if (band->flow == flow)
+                fprintf(fp, "  %-6s %-19s %10.3f kWh at %7.4f %10.2f\n", flow_names[flow], band->name, bill->kwh[i], band->rate,
+                        flow == TARIFF_IMPORT ? bill->kwh[i] * band->rate : -bill->kwh[i] * band->rate);
+        if (bill->unbanded[flow] > 0)
+            fprintf(fp, "  %-6s %-19s %10.3f kWh not costed\n", flow_names[flow], "(no band)", bill->unbanded[flow]);
+    }
+    fprintf(fp, "  %-26s %10d days at %7.4f %9.2f\n", "standing", bill->days, tf->standing, bill->days * tf->standing);
+    fprintf(fp, "  %-26s %36.2f\n\n", "total", tariff_total(tf, bill));
+}
+
+int main(int argc, char **argv)
+{
+    int status = 0, nbills, days, c, i;
+    const char *file = "cc-tariff";
+    tariff *tf;
+    tariff_bill *bills;
+    time_t start, end;
+    struct timespec t0, t1;
+
+    while ((c = getopt(argc, argv, "f:j:")) != EOF) {
+        switch (c) {
+            case 'f':
+                file = optarg;
+                break;
+            case 'j':
+                tariff_threads = atoi(optarg);
+                break;
+            default:
+                status = 1;
+        }
+    }
+    if (status || argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-f tariff] [-j threads] start-date end-date\n", prog_name);
+        return 1;
+    }
+    if (parse_date(argv[optind], &start) || parse_date(argv[optind + 1], &end))
+        return 1;
+    if (end <= start) {
+        log_msg("end must be after start");
+        return 1;
+    }
+    if ((tf = tariff_load(file)) == NULL)
+        return 2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (tariff_cost(tf, start, end, &bills, &nbills) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        for (i = 0; i < nbills; i++)
+            print_bill(tf, bills + i, stdout);
+        for (days = i = 0; i < nbills; i++)
+            days += bills[i].days;
+        free(bills);
+        log_msg("costed %d days in %.3fs", days, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    }
+    else
+        status = 3;
+    tariff_free(tf);
+    return status;
+}
@@ -14,15 +14,22 @@ const char date_iso[]    = DATE_ISO;
 const char log_hdr1[] = "%d/%m/%Y %H:%M:%S";
 const char log_hdr2[] = "%s.%03d %s: ";
 
+/*
+ * Worker threads log too, so each line is written with stderr locked,
+ * which the caller releases once the line is finished, and the time is
+ * converted with localtime_r.
+ */
+
 static void log_common(const char *msg, va_list ap)
 {
     struct timespec tv;
-    struct tm *tp;
+    struct tm tm;
     char stamp[24];
 
     clock_gettime(CLOCK_REALTIME, &tv);
-    tp = localtime(&tv.tv_sec);
-    strftime(stamp, sizeof stamp, log_hdr1, tp);
+    localtime_r(&tv.tv_sec, &tm);
+    strftime(stamp, sizeof stamp, log_hdr1, &tm);
+    flockfile(stderr);
     fprintf(stderr, log_hdr2, stamp, (int) (tv.tv_nsec / 1000000), prog_name);
     vfprintf(stderr, msg, ap);
 }
@@ -34,6 +41,7 @@ void log_msg(const char *msg, ...)
     va_start(ap, msg);
     log_common(msg, ap);
     putc('\n', stderr);
+    funlockfile(stderr);
     va_end(ap);
 }
 
@@ -46,4 +54,6 @@ void log_syserr(const char *msg, ...)
     va_start(ap, msg);
     log_common(msg, ap);
     fprintf(stderr, " - %s\n", syserr);
+    funlockfile(stderr);
+    va_end(ap);
 }
@@ -1,7 +1,17 @@
 #ifndef CC_DEFS_H
 #define CC_DEFS_H
 
-#define MAX_SENSOR   10
+/*
+ * Sensors are numbered from 0 and are a bit each in an unsigned mask, as
+ * the parser and the history take them, so there may be up to MAX_SENSOR
+ * across receivers.  A receiver has RECV_SENSORS, which the pages name
+ * and which are all the rollups, the energy index and the bucket cache
+ * have room for.
+ */
+
+#define MAX_SENSOR   32
+#define RECV_SENSORS 10
+
 #define ISO_DATE_LEN 21
 #define MAX_LINE_LEN 1300
 
@@ -13,9 +23,50 @@
 #define BASE_URL    "http://fosdick.slyip.net/cgi-bin/"
 #endif
 
+/*
+ * With FIXED_POINT defined, temperatures and power are carried as scaled
+ * integers (centidegrees and deciwatts) from the parser through to the
+ * aggregation of history and only become decimal on output, which avoids
+ * software floating point on CPUs without an FPU.
+ */
+
+#ifdef FIXED_POINT
+typedef long cc_real;
+#define TEMP_SCALE  100
+#define WATTS_SCALE 10
+#define temp_to_double(t)   ((double) (t) / TEMP_SCALE)
+#define watts_to_double(w)  ((double) (w) / WATTS_SCALE)
+#define temp_from_double(d) ((cc_real) ((d) * TEMP_SCALE + ((d) < 0 ? -0.5 : 0.5)))
+#define watts_from_double(d) ((cc_real) ((d) * WATTS_SCALE + ((d) < 0 ? -0.5 : 0.5)))
+#else
+typedef double cc_real;
+#define TEMP_SCALE  1
+#define WATTS_SCALE 1
+#define temp_to_double(t)   (t)
+#define watts_to_double(w)  (w)
+#define temp_from_double(d) (d)
+#define watts_from_double(d) (d)
+#endif
+
 #define XML_FILE "cc-%Y-%m-%d.xml"
 #define DATE_ISO "%Y-%m-%dT%H:%M:%SZ"
 
+#define SECS_IN_DAY 86400
+#define MINS_IN_DAY 1440
+
+/*
+ * Sensor 8 meters the solar panels and sensor 9 what is imported, and
+ * while nothing is imported the clamp, sensor 0, shows what is exported.
+ * The power drawn from the grid, negative when exporting, is then the
+ * import or less the clamp, and the house uses the solar power plus it.
+ */
+
+#define SENSOR_CLAMP  0
+#define SENSOR_SOLAR  8
+#define SENSOR_IMPORT 9
+
+#define grid_power(import, clamp) ((import) > 0 ? (import) : -(clamp))
+
 extern const char xml_file[];
 extern const char date_iso[];
 
@@ -18,6 +18,7 @@
 struct _cc_ctx {
     logger_t *logger;
     const char *db_conn;
+    const char *sqlite_file;
     int vendor_id;
     int product_id;
     int interface;
@@ -114,7 +115,7 @@ int cc_ftdi(cc_ctx_t *ctx)
     int status;
     struct sigaction sa;
 
-    if ((ctx->logger = logger_new(ctx->db_conn))) {
+    if ((ctx->logger = logger_new(ctx->db_conn, ctx->sqlite_file))) {
         memset(&sa, 0, sizeof sa);
         sa.sa_handler = exit_handler;
         if (sigaction(SIGTERM, &sa, NULL) == 0) {
@@ -146,11 +147,12 @@ int main(int argc, char **argv)
     int c;
 
     ctx.db_conn = NULL;
+    ctx.sqlite_file = NULL;
     ctx.vendor_id = DEFAULT_VENDOR_ID;
     ctx.product_id = DEFAULT_PRODUCT_ID;
     ctx.interface = DEFAULT_INTERFACE;
 
-    while ((c = getopt(argc, argv, "d:D:i:p:v:")) != EOF) {
+    while ((c = getopt(argc, argv, "d:D:S:i:p:v:")) != EOF) {
         switch (c) {
             case 'd':
                 dir = optarg;
@@ -158,6 +160,9 @@ int main(int argc, char **argv)
             case 'D':
                 ctx.db_conn = optarg;
                 break;
+            case 'S':
+                ctx.sqlite_file = optarg;
+                break;
             case 'i':
                 ctx.interface = strtoul(optarg, NULL, 0);
                 break;
@@ -172,7 +177,7 @@ int main(int argc, char **argv)
         }
     }
     if (status)
-        fputs("Usage: cc-ftdi [ -d dir ] [ -D <db-conn> ] [ -i interface ] [ -p product-id ] [ -v vendor-id ]\n", stderr);
+        fputs("Usage: cc-ftdi [ -d dir ] [ -D <db-conn> ] [ -S <sqlite-file> ] [ -i interface ] [ -p product-id ] [ -v vendor-id ]\n", stderr);
     else
         status = cc_daemon(dir, log_file, pid_file, cc_ftdi, &ctx);
     return status;
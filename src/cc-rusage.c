@@ -1,6 +1,7 @@
 #include "cgi-main.h"
 #include "cc-rusage.h"
 #include "cc-common.h"
+#include "mapfile.h"
 #include <sys/resource.h>
 
 static const char rusage_html_head[] =
@@ -37,6 +38,12 @@ static const char cnt_fmt[] =
     "  <td class=\"ru\">%'ld</td>"
     "</tr>";
 
+static const char io_fmt[] =
+    "<tr>"
+    "  <td class=\"ru\">Read (%s)</td>"
+    "  <td class=\"ru\">%lu files, %'llu bytes, %'llu \u00B5s</td>"
+    "</tr>";
+
 static void send_cpu(FILE *cgi_str, const char *label, time_t secs, unsigned long usec)
 {
     if (secs > 0)
@@ -55,6 +62,8 @@ void cc_rusage(struct timespec *start, FILE *cgi_str)
 {
     struct timespec end, elapsed;
     struct rusage ru;
+    mf_stat io[MF_NSTRATEGY];
+    int i;
 
     clock_gettime(CLOCK_REALTIME, &end);
     elapsed.tv_sec = end.tv_sec - start->tv_sec;
@@ -72,6 +81,10 @@ void cc_rusage(struct timespec *start, FILE *cgi_str)
         send_cnt(cgi_str, "Page faults", ru.ru_majflt);
         send_cnt(cgi_str, "Blocks in", ru.ru_inblock);
         send_cnt(cgi_str, "Blocks out", ru.ru_oublock);
+        mf_get_stats(io);
+        for (i = 0; i < MF_NSTRATEGY; i++)
+            if (io[i].files > 0)
+                fprintf(cgi_str, io_fmt, mf_strategy_names[i], io[i].files, io[i].bytes, io[i].nsecs / 1000);
         fwrite(rusage_html_tail, sizeof(rusage_html_tail) - 1, 1, cgi_str);
     }
     else
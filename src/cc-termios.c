@@ -17,6 +17,7 @@
 struct _cc_ctx {
     logger_t *logger;
     const char *db_conn;
+    const char *sqlite_file;
     const char *port;
     struct termios tio;
 
@@ -87,7 +88,7 @@ int cc_termios(cc_ctx_t * ctx)
     struct sigaction sa;
     struct itimerval it;
 
-    if ((ctx->logger = logger_new(ctx->db_conn))) {
+    if ((ctx->logger = logger_new(ctx->db_conn, ctx->sqlite_file))) {
         memset(&sa, 0, sizeof sa);
         sa.sa_handler = exit_handler;
         if (sigaction(SIGTERM, &sa, NULL) == 0) {
@@ -145,9 +146,10 @@ int main(int argc, char **argv)
     int c;
 
     ctx.db_conn = NULL;
+    ctx.sqlite_file = NULL;
     ctx.port = default_port;
 
-    while ((c = getopt(argc, argv, "d:D:p:")) != EOF) {
+    while ((c = getopt(argc, argv, "d:D:S:p:")) != EOF) {
         switch (c) {
             case 'd':
                 dir = optarg;
@@ -155,6 +157,9 @@ int main(int argc, char **argv)
             case 'D':
                 ctx.db_conn = optarg;
                 break;
+            case 'S':
+                ctx.sqlite_file = optarg;
+                break;
             case 'p':
                 ctx.port = optarg;
                 break;
@@ -163,7 +168,7 @@ int main(int argc, char **argv)
         }
     }
     if (status)
-        fputs("Usage: cc-termios [ -d dir ] [ -D <db-conn> ] [ -p port ]\n", stderr);
+        fputs("Usage: cc-termios [ -d dir ] [ -D <db-conn> ] [ -S <sqlite-file> ] [ -p port ]\n", stderr);
     else
         status = cc_daemon(dir, log_file, pid_file, cc_termios, &ctx);
     return status;
@@ -0,0 +1,128 @@
+/*
+ * cgi-dist
+ *
+ * Serves the distribution of each sensor's power over a range in JSON:
+ * the count of samples, a table of percentiles and a histogram, all from
+ * quantile sketches so the memory used does not grow with the range.  As
+ * with the history page the range is taken in 720 points, and with the
+ * series parameter the median and 95th percentile of each point are sent
+ * as well.  The start and end are times or, given a sign, seconds from
+ * now, and sens has a bit set for each sensor to leave out.
+ */
+
+#include "cc-html.h"
+#include "history.h"
+#include "cgi-main.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char prog_name[] = "cc-dist";
+
+/* *INDENT-OFF* */
+static const char http_hdr[] =
+    "Content-Type: application/json\n"
+    "Cache-Control: no-cache\n"
+    "\n";
+/* *INDENT-ON* */
+
+static const int percentiles[] = { 5, 25, 50, 75, 90, 95, 99 };
+
+static void send_sensor(hist_context *hc, int sensor, int series, FILE *cgi_str)
+{
+    int i, ch;
+
+    fprintf(cgi_str, "\"%s\":{\"count\":%u,\"percentiles\":", sensor_names[sensor], hc->sensors[sensor].range->count);
+    ch = '{';
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        fprintf(cgi_str, "%c\"%d\":%g", ch, percentiles[i], hist_quantile(hc, sensor, percentiles[i] / 100.0));
+        ch = ',';
+    }
+    html_puts("},\"histogram\":", cgi_str);
+    hist_js_sens_histogram_out(hc, sensor, cgi_str);
+    if (series) {
+        html_puts(",\"median\":", cgi_str);
+        hist_js_sens_quantile_out(hc, sensor, 0.5, cgi_str);
+        html_puts(",\"p95\":", cgi_str);
+        hist_js_sens_quantile_out(hc, sensor, 0.95, cgi_str);
+    }
+    putc('}', cgi_str);
+}
+
+static int cgi_dist(const hist_backend *backend, time_t start, time_t end, unsigned sens, int series, FILE *cgi_str)
+{
+    hist_context *hc;
+    time_t step;
+    int i, ch;
+
+    if (chdir(default_dir)) {
+        log_syserr("unable to chdir to '%s'", default_dir);
+        return 2;
+    }
+    if ((step = (end - start) / 720) == 0)
+        step = 1;
+    hist_sketches = series ? HIST_SKETCH_POINTS : HIST_SKETCH_RANGE;
+    if ((hc = hist_get(backend, start, end, step, ~sens & ((1 << RECV_SENSORS) - 1), 0)) == NULL)
+        return 3;
+    fwrite(http_hdr, sizeof(http_hdr) - 1, 1, cgi_str);
+    fprintf(cgi_str, "{\"start\":%ld,\"end\":%ld,\"step\":%ld,\"sensors\":", (long) hc->start_ts, (long) hc->end_ts, (long) hc->step);
+    ch = '{';
+    for (i = 0; i < RECV_SENSORS; i++) {
+        if (hist_has_sensor(hc, i)) {
+            putc(ch, cgi_str);
+            send_sensor(hc, i, series, cgi_str);
+            ch = ',';
+        }
+    }
+    if (ch == '{')
+        putc(ch, cgi_str);
+    html_puts("}}\n", cgi_str);
+    hist_free(hc);
+    return 0;
+}
+
+static time_t parse_limit(const char *value, time_t now)
+{
+    long n;
+
+    n = strtol(value, NULL, 10);
+    if (*value == '+' || *value == '-')
+        return now + n;
+    return n;
+}
+
+int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
+{
+    int status = 0;
+    const hist_backend *backend = hist_default_backend;
+    const char *start_str, *end_str, *str;
+    time_t start_secs, end_secs;
+    unsigned sens = 0;
+
+    if ((start_str = cgi_get_param(query, "start")) == NULL) {
+        log_msg("missing 'start' parameter");
+        status = 1;
+    }
+    if ((end_str = cgi_get_param(query, "end")) == NULL) {
+        log_msg("missing 'end' parameter");
+        status = 1;
+    }
+    if ((str = cgi_get_param(query, "src")) && (backend = hist_find_backend(str)) == NULL) {
+        log_msg("unknown history source '%s'", str);
+        status = 1;
+    }
+    if ((str = cgi_get_param(query, "sens")))
+        sens = strtoul(str, NULL, 16);
+    if (status == 0) {
+        start_secs = parse_limit(start_str, start->tv_sec);
+        end_secs = parse_limit(end_str, start->tv_sec);
+        if (end_secs <= start_secs) {
+            log_msg("end must be greater than start");
+            status = 1;
+        }
+        else
+            status = cgi_dist(backend, start_secs, end_secs, sens, cgi_get_param(query, "series") != NULL, cgi_str);
+    }
+    return status;
+}
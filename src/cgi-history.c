@@ -1,5 +1,7 @@
 #include "cc-html.h"
 #include "cc-rusage.h"
+#include "energy.h"
+#include "hist-cache.h"
 #include "history.h"
 #include "cgi-main.h"
 
@@ -8,7 +10,6 @@
 #include <unistd.h>
 
 #define SECS_IN_HOUR (60*60)
-#define SECS_IN_DAY  (SECS_IN_HOUR*24)
 #define SECS_IN_WEEK (SECS_IN_DAY*7)
 
 const char prog_name[] = "cc-history";
@@ -52,7 +53,60 @@ static const char form_tail[] =
 
 /* *INDENT-ON* */
 
-static void send_labels(time_t start, time_t end, time_t delta, time_t step, FILE * cgi_str)
+/*
+ * Each point is either the mean of the samples in it, the mean with the
+ * lowest and highest sample as extra series so short peaks still show,
+ * or picked by LTTB from LTTB_FACTOR times as many points.
+ */
+
+typedef enum {
+    MODE_MEAN,
+    MODE_ENVELOPE,
+    MODE_LTTB
+} hist_mode;
+
+static const char *const mode_names[] = { "mean", "envelope", "lttb" };
+
+#define LTTB_FACTOR 4
+
+/*
+ * The same range some days before can be overlaid on the graph, the
+ * choices being given as the list of days back for each.
+ */
+
+static const char *const overlay_choices[][2] = {
+    { "", "no overlay" },
+    { "1", "day before" },
+    { "7", "week before" },
+    { "1,7", "day and week before" }
+};
+
+/*
+ * A long range may be drawn from only one line in some number of each
+ * day file, and however it is drawn, reading stops after the budget so
+ * the page is sent with what there is by then rather than timing out.
+ */
+
+static const char *const sample_choices[][2] = {
+    { "", "every sample" },
+    { "10", "1 in 10 samples" },
+    { "100", "1 in 100 samples" }
+};
+
+#define HISTORY_BUDGET_MS 20000
+
+static const hist_backend *backend;
+static char src_param[20];
+static hist_mode mode;
+static char mode_param[20];
+static time_t overlay_offsets[HIST_MAX_RANGES];
+static int nranges;
+static char overlay_list[30];
+static char overlay_param[40];
+static char sample_list[8];
+static char sample_param[20];
+
+static void send_labels(time_t origin, time_t start, time_t end, time_t delta, time_t step, FILE * cgi_str)
 {
     time_t label_step, label;
     const char *label_fmt;
@@ -83,7 +137,7 @@ static void send_labels(time_t start, time_t end, time_t delta, time_t step, FIL
     ch = '{';
     while (label <= end) {
         strftime(tmstr, sizeof tmstr, label_fmt, localtime(&label));
-        fprintf(cgi_str, "%c%ld:'%s'", ch, (long) ((label - start) / step), tmstr);
+        fprintf(cgi_str, "%c%ld:'%s'", ch, (long) ((label - origin) / step), tmstr);
         ch = ',';
         label += label_step;
     }
@@ -91,7 +145,8 @@ static void send_labels(time_t start, time_t end, time_t delta, time_t step, FIL
 
 static void send_hist_link(time_t start, time_t end, const char *desc, unsigned sens, FILE *cgi_str)
 {
-    fprintf(cgi_str, "<a href=\"%scc-history.cgi?start=%lu&end=%lu&sens=%x\">%s</a>&nbsp;\n", base_url, start, end, sens, desc);
+    fprintf(cgi_str, "<a href=\"%scc-history.cgi?start=%lu&end=%lu&sens=%x%s%s%s%s\">%s</a>&nbsp;\n", base_url, start, end, sens, src_param, mode_param,
+            overlay_param, sample_param, desc);
 }
 
 static void send_navlinks(time_t start, time_t end, time_t delta, unsigned sens, FILE * cgi_str)
@@ -117,18 +172,115 @@ static void send_checkboxes(time_t start, time_t end, unsigned sens, FILE *cgi_s
     const char *chk;
 
     fprintf(cgi_str, form_head, start, end);
-    for (i = 0; i < MAX_SENSOR; i++) {
+    if (backend != hist_default_backend)
+        fprintf(cgi_str, "      <input type=\"hidden\" name=\"src\" value=\"%s\">\n", backend->name);
+    for (i = 0; i < RECV_SENSORS; i++) {
         chk = sens & (1 << i) ? "" : " checked";
         fprintf(cgi_str, "<input type=\"checkbox\" name=\"s%d\" value=\"on\"%s>&nbsp;%s\n", i, chk, sensor_names[i]);
     }
+    html_puts("      <select name=\"mode\">\n", cgi_str);
+    for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++)
+        fprintf(cgi_str, "        <option%s>%s</option>\n", i == mode ? " selected" : "", mode_names[i]);
+    html_puts("      </select>\n", cgi_str);
+    html_puts("      <select name=\"overlay\">\n", cgi_str);
+    for (i = 0; i < sizeof(overlay_choices) / sizeof(overlay_choices[0]); i++)
+        fprintf(cgi_str, "        <option value=\"%s\"%s>%s</option>\n", overlay_choices[i][0],
+                strcmp(overlay_list, overlay_choices[i][0]) ? "" : " selected", overlay_choices[i][1]);
+    html_puts("      </select>\n", cgi_str);
+    html_puts("      <select name=\"sample\">\n", cgi_str);
+    for (i = 0; i < sizeof(sample_choices) / sizeof(sample_choices[0]); i++)
+        fprintf(cgi_str, "        <option value=\"%s\"%s>%s</option>\n", sample_choices[i][0],
+                strcmp(sample_list, sample_choices[i][0]) ? "" : " selected", sample_choices[i][1]);
+    html_puts("      </select>\n", cgi_str);
     fwrite(form_tail, sizeof(form_tail) - 1, 1, cgi_str);
 }
 
+static void send_overlay(hist_context *hc, time_t offset, unsigned sens, FILE *cgi_str)
+{
+    char when[24];
+    int i, days = -offset / SECS_IN_DAY;
+
+    snprintf(when, sizeof when, days == 1 ? "1 day before" : "%d days before", days);
+    for (i = 0; i < RECV_SENSORS; i++) {
+        if (!(sens & (1 << i)) && hist_has_sensor(hc, i)) {
+            fprintf(cgi_str, "g.data(\"%s (%s)\", ", sensor_names[i], when);
+            hist_js_sens_out(hc, i, cgi_str);
+            html_puts(");\n", cgi_str);
+        }
+    }
+    fprintf(cgi_str, "g.data(\"Total Consumption (%s)\", ", when);
+    hist_js_total_out(hc, cgi_str);
+    html_puts(");\n", cgi_str);
+}
+
+/*
+ * Say how far the graph is from the exact one, if it is, going by the
+ * sensor with the largest error as the total is drawn from several.
+ */
+
+static void send_accuracy(hist_context *hc, FILE *cgi_str)
+{
+    double error, worst = 0.0;
+    char tmstr[20];
+    int i;
+
+    if (hc->sampled < 1) {
+        for (i = 0; i < RECV_SENSORS; i++)
+            if ((error = hist_error(hc, i)) > worst)
+                worst = error;
+        fprintf(cgi_str, "    <p>Approximate: %d of %d points from %.1f%% of their samples, within about %.0f W</p>\n", hc->raw_points, hc->points,
+                hc->sampled * 100, worst);
+    }
+    if (hist_partial(hc)) {
+        strftime(tmstr, sizeof tmstr, time_fmt, localtime(&hc->read_to));
+        fprintf(cgi_str, "    <p>Incomplete: out of time, samples read up to %s</p>\n", tmstr);
+    }
+}
+
+/*
+ * The energy used over the range from the energy index rather than from
+ * the points, so it is exact whatever the step and however the graph was
+ * drawn, and for the pulse sensors from their counts at the ends of the
+ * range, so it holds even where the index has nothing.
+ */
+
+static void send_energy(hist_context *hc, time_t start, time_t end, unsigned sens, FILE *cgi_str)
+{
+    double wh[EN_SERIES];
+    unsigned shown, exact;
+    const char *sep = " ";
+    int i, indexed;
+
+    shown = ~sens & ((1 << RECV_SENSORS) - 1);
+    indexed = en_energy(start, end, wh) == 0;
+    exact = en_pulse_energy(start, end, shown, wh);
+    if (indexed || exact) {
+        html_puts("    <p>Energy:", cgi_str);
+        if (indexed) {
+            fprintf(cgi_str, " %.2f kWh in total", wh[EN_TOTAL] / 1000);
+            sep = ", ";
+        }
+        for (i = 0; i < RECV_SENSORS; i++) {
+            if ((exact & (1 << i)) || (indexed && (shown & (1 << i)) && hist_has_sensor(hc, i))) {
+                fprintf(cgi_str, "%s%s %.2f kWh", sep, sensor_names[i], wh[i] / 1000);
+                sep = ", ";
+            }
+        }
+        html_puts("</p>\n", cgi_str);
+    }
+}
+
+/*
+ * The step is about a 720th of the range, moved to the nearest one the
+ * bucket cache keeps so panning and zooming reuse its buckets, and the
+ * number of points follows from it.
+ */
+
 static int cgi_history(struct timespec *prog_start, time_t start, time_t end, unsigned sens, FILE *cgi_str)
 {
-    int status, i;
+    int status, i, factor;
     time_t delta, step;
-    hist_context *hc;
+    hist_context *hc, *ranges[HIST_MAX_RANGES];
     char tm_from[20], tm_to[20];
 
     delta = end - start;
@@ -136,22 +288,39 @@ static int cgi_history(struct timespec *prog_start, time_t start, time_t end, un
     if (step == 0)
         step = 1;
     if (chdir(default_dir) == 0) {
+        hist_cache_dir = BC_DIR;
+        hist_budget_ms = HISTORY_BUDGET_MS;
         strftime(tm_from, sizeof(tm_from), time_fmt, localtime(&start));
         strftime(tm_to, sizeof(tm_to), time_fmt, localtime(&end));
         log_msg("from %s to %s", tm_from, tm_to);
-        if ((hc = hist_get(start, end, step))) {
+        factor = 1;
+        if (mode == MODE_LTTB && (factor = step < LTTB_FACTOR ? step : LTTB_FACTOR) > 1)
+            step /= factor;
+        step = bc_nearest_step(step);
+        if (hist_get_ranges(backend, start, end, step, (~sens & ((1 << RECV_SENSORS) - 1)) | HIST_DERIVED_SENSORS, 0, overlay_offsets, nranges,
+                            ranges) == HIST_SUCCESS) {
             status = 0;
+            for (i = 0; i < nranges; i++)
+                ranges[i] = hist_lttb(ranges[i], factor);
+            hc = ranges[0];
             fwrite(http_hdr, sizeof(http_hdr) - 1, 1, cgi_str);
             html_send_top(cgi_str);
             fprintf(cgi_str, html_middle, tm_from, tm_to);
             send_navlinks(start, end, delta, sens, cgi_str);
             fprintf(cgi_str, graph_head, tm_from, tm_to);
-            for (i = 0; i < MAX_SENSOR; i++) {
+            for (i = 0; i < RECV_SENSORS; i++) {
                 if (!(sens & (1 << i))) {
-                    if (hc->flags[i]) {
+                    if (hist_has_sensor(hc, i)) {
                         fprintf(cgi_str, "g.data(\"%s\", ", sensor_names[i]);
                         hist_js_sens_out(hc, i, cgi_str);
                         html_puts(");\n", cgi_str);
+                        if (mode == MODE_ENVELOPE) {
+                            fprintf(cgi_str, "g.data(\"%s (min)\", ", sensor_names[i]);
+                            hist_js_sens_min_out(hc, i, cgi_str);
+                            fprintf(cgi_str, ");\ng.data(\"%s (max)\", ", sensor_names[i]);
+                            hist_js_sens_max_out(hc, i, cgi_str);
+                            html_puts(");\n", cgi_str);
+                        }
                     }
                 }
             }
@@ -161,9 +330,14 @@ static int cgi_history(struct timespec *prog_start, time_t start, time_t end, un
             html_puts("g.data(\"Others\", ", cgi_str);
             hist_js_others_out(hc, cgi_str);
             html_puts(");\n", cgi_str);
-            send_labels(start, end, delta, step, cgi_str);
-            hist_free(hc);
+            for (i = 1; i < nranges; i++)
+                send_overlay(ranges[i], overlay_offsets[i], sens, cgi_str);
+            send_labels(hc->start_ts, start, end, delta, hc->step, cgi_str);
             fwrite(graph_end, sizeof(graph_end) - 1, 1, cgi_str);
+            send_energy(hc, start, end, sens, cgi_str);
+            send_accuracy(hc, cgi_str);
+            for (i = 0; i < nranges; i++)
+                hist_free(ranges[i]);
             send_navlinks(start, end, delta, sens, cgi_str);
             send_checkboxes(start, end, sens, cgi_str);
             cc_rusage(prog_start, cgi_str);
@@ -189,6 +363,33 @@ static time_t parse_limit(const char *value, time_t now)
     return n;
 }
 
+/*
+ * The overlays are a comma separated list of how many days before the
+ * range each is.
+ */
+
+static int which_overlays(const char *list)
+{
+    char *end;
+    long days;
+
+    overlay_offsets[0] = 0;
+    nranges = 1;
+    while (*list) {
+        if ((days = strtol(list, &end, 10)) <= 0 || end == list || (*end && *end != ',')) {
+            log_msg("bad overlay list '%s'", list);
+            return -1;
+        }
+        if (nranges == HIST_MAX_RANGES) {
+            log_msg("at most %d overlays", HIST_MAX_RANGES - 1);
+            return -1;
+        }
+        overlay_offsets[nranges++] = -days * SECS_IN_DAY;
+        list = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
 static int which_sensors(cgi_query_t *query)
 {
     int i;
@@ -199,7 +400,7 @@ static int which_sensors(cgi_query_t *query)
         bits = strtoul(ptr, NULL, 16);
     else {
         strcpy(name, "sx");
-        for (i = 0; i < MAX_SENSOR; i++) {
+        for (i = 0; i < RECV_SENSORS; i++) {
             name[1] = '0' + i;
             if ((ptr = cgi_get_param(query, name)) == NULL || strcmp(ptr, "on"))
                 bits |= (1 << i);
@@ -211,7 +412,7 @@ static int which_sensors(cgi_query_t *query)
 int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
 {
     int status = 0;
-    const char *start_str, *end_str;
+    const char *start_str, *end_str, *src_str, *mode_str, *overlay_str, *sample_str;
     time_t start_secs, end_secs;
 
     if ((start_str = cgi_get_param(query, "start")) == NULL) {
@@ -222,6 +423,44 @@ int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
         log_msg("missing 'end' parameter");
         status = 1;
     }
+    backend = hist_default_backend;
+    if ((src_str = cgi_get_param(query, "src"))) {
+        if ((backend = hist_find_backend(src_str)) == NULL) {
+            log_msg("unknown history source '%s'", src_str);
+            status = 1;
+        }
+        else if (backend != hist_default_backend)
+            snprintf(src_param, sizeof(src_param), "&src=%s", backend->name);
+    }
+    mode = MODE_MEAN;
+    if ((mode_str = cgi_get_param(query, "mode"))) {
+        while (mode < sizeof(mode_names) / sizeof(mode_names[0]) && strcmp(mode_str, mode_names[mode]))
+            mode++;
+        if (mode == sizeof(mode_names) / sizeof(mode_names[0])) {
+            log_msg("unknown history mode '%s'", mode_str);
+            status = 1;
+        }
+        else if (mode != MODE_MEAN)
+            snprintf(mode_param, sizeof(mode_param), "&mode=%s", mode_names[mode]);
+    }
+    if ((overlay_str = cgi_get_param(query, "overlay")) == NULL)
+        overlay_str = "";
+    if (which_overlays(overlay_str))
+        status = 1;
+    else if (*overlay_str) {
+        snprintf(overlay_list, sizeof(overlay_list), "%s", overlay_str);
+        snprintf(overlay_param, sizeof(overlay_param), "&overlay=%s", overlay_list);
+    }
+    if ((sample_str = cgi_get_param(query, "sample")) && *sample_str) {
+        if ((hist_stride = atoi(sample_str)) < 1 || hist_stride > 10000) {
+            log_msg("bad sample stride '%s'", sample_str);
+            status = 1;
+        }
+        else if (hist_stride > 1) {
+            snprintf(sample_list, sizeof(sample_list), "%d", hist_stride);
+            snprintf(sample_param, sizeof(sample_param), "&sample=%s", sample_list);
+        }
+    }
     if (status == 0) {
         start_secs = parse_limit(start_str, start->tv_sec);
         end_secs = parse_limit(end_str, start->tv_sec);
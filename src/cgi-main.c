@@ -33,15 +33,18 @@ static FILE *log_str, *cgi_str;
 static char *log_ptr, *cgi_ptr;
 static size_t log_size, cgi_size;
 
+/* history workers log too, so each line is written with the stream locked */
+
 static void log_begin(const char *msg, va_list ap)
 {
     struct timespec ts;
-    struct tm *tp;
+    struct tm tm;
     char stamp[24];
 
     clock_gettime(CLOCK_REALTIME, &ts);
-    tp = localtime(&ts.tv_sec);
-    strftime(stamp, sizeof stamp, log_hdr1, tp);
+    localtime_r(&ts.tv_sec, &tm);
+    strftime(stamp, sizeof stamp, log_hdr1, &tm);
+    flockfile(log_str);
     fprintf(log_str, log_hdr2, stamp, (int) (ts.tv_nsec / 1000000), prog_name);
     vfprintf(log_str, msg, ap);
 }
@@ -54,6 +57,7 @@ void log_msg(const char *msg, ...)
     log_begin(msg, ap);
     va_end(ap);
     putc('\n', log_str);
+    funlockfile(log_str);
 }
 
 void log_syserr(const char *msg, ...)
@@ -66,6 +70,7 @@ void log_syserr(const char *msg, ...)
     log_begin(msg, ap);
     va_end(ap);
     fprintf(log_str, ": %s\n", syserr);
+    funlockfile(log_str);
 }
 
 char *cgi_urldec(char *dest, const char *src)
@@ -15,7 +15,7 @@ const char prog_name[] = "cc-now";
 struct latest {
     time_t timestamp;
     double temp;
-    double watts[MAX_SENSOR];
+    double watts[RECV_SENSORS];
 };
 
 static mf_status filter_cb(pf_context *ctx, time_t ts)
@@ -33,10 +33,10 @@ static mf_status sample_cb(pf_context *ctx, pf_sample * smp)
     struct latest *l = ctx->user_data;
 
     if (l->temp < 0)
-        l->temp = smp->temp;
-    if (smp->sensor >= 0 && smp->sensor < MAX_SENSOR)
+        l->temp = temp_to_double(smp->temp);
+    if (smp->sensor >= 0 && smp->sensor < RECV_SENSORS)
         if (l->watts[smp->sensor] < 0)
-            l->watts[smp->sensor] = smp->data.watts;
+            l->watts[smp->sensor] = watts_to_double(smp->data.watts);
     return MF_SUCCESS;
 }
 
@@ -94,17 +94,14 @@ static void cgi_output(struct latest *l, unsigned sens, FILE *cgi_str)
     html_send_top(cgi_str);
     fprintf(cgi_str, html_middle, base_url, sens);
     apps = 0.0;
-    for (i = 0; i < MAX_SENSOR; i++) {
+    for (i = 0; i < RECV_SENSORS; i++) {
         value = l->watts[i];
         if (i >= 1 && i <= 5)
             apps += value;
         if (value >= 0)
             output_cell(value, sensor_names[i], cgi_str);
     }
-    if (l->watts[9] > 0)
-        total = l->watts[8] + l->watts[9];
-    else
-        total = l->watts[8] - l->watts[0];
+    total = l->watts[SENSOR_SOLAR] + grid_power(l->watts[SENSOR_IMPORT], l->watts[SENSOR_CLAMP]);
     if (total >= 0) {
         output_cell(total, "Total Consumption", cgi_str);
         value = total - apps;
@@ -139,7 +136,7 @@ int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
             pf->user_data = &l;
             l.timestamp = 0;
             l.temp = -1.0;
-            for (i = 0; i < MAX_SENSOR; i++) {
+            for (i = 0; i < RECV_SENSORS; i++) {
                 l.watts[i] = -1.0;
             }
             if (pf_parse_file(pf, name) != MF_FAIL) {
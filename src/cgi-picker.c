@@ -1,8 +1,11 @@
+#include "catalog.h"
+#include "energy.h"
 #include "cgi-main.h"
 #include "cc-html.h"
 
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 const char prog_name[] = "cc-picker";
 
@@ -52,12 +55,30 @@ static const char tab_end[] =
     "    <p><a href=\"%scc-now.cgi\">Current Consumption</a></p>\n";
 /* *INDENT-ON* */
 
-static void send_calendar(time_t start_secs, struct tm *tp, unsigned sens, FILE *cgi_str)
+/*
+ * The energy used over a day from the energy index, left out for days
+ * yet to start or before the index began.
+ */
+
+static void send_energy(time_t secs, time_t now, FILE *cgi_str)
 {
-    time_t secs;
+    double wh[EN_SERIES];
+
+    if (secs <= now && en_energy(secs, secs + 86400, wh) == 0)
+        fprintf(cgi_str, "<br/><small>%.1f kWh</small>", wh[EN_TOTAL] / 1000);
+}
+
+/*
+ * Days the catalog knows to have no data are shown without a link.
+ */
+
+static void send_calendar(const cat_catalog *cat, time_t start_secs, struct tm *tp, unsigned sens, FILE *cgi_str)
+{
+    time_t secs, now;
     int home_month, i;
     char caption[50];
 
+    time(&now);
     secs = start_secs;
     strftime(caption, sizeof caption, "%B %Y", tp);
     fprintf(cgi_str, cal_top, caption);
@@ -71,10 +92,16 @@ static void send_calendar(time_t start_secs, struct tm *tp, unsigned sens, FILE
     do {
         html_puts("<tr>\n", cgi_str);
         for (i = 0; i < 7; i++) {
-            if (secs == start_secs)
-                fprintf(cgi_str, "<td>%d</td>\n", tp->tm_mday);
-            else
-                fprintf(cgi_str, "<td><a href=\"%scc-picker.cgi?start=%lu&sens=%x\">%2d</a></td>\n", base_url, secs, sens, tp->tm_mday);
+            if (cat && !cat_has_data(cat, secs, secs + 86400) && secs != start_secs)
+                fprintf(cgi_str, "<td class=\"nodata\">%2d</td>\n", tp->tm_mday);
+            else {
+                if (secs == start_secs)
+                    fprintf(cgi_str, "<td>%d", tp->tm_mday);
+                else
+                    fprintf(cgi_str, "<td><a href=\"%scc-picker.cgi?start=%lu&sens=%x\">%2d</a>", base_url, secs, sens, tp->tm_mday);
+                send_energy(secs, now, cgi_str);
+                html_puts("</td>\n", cgi_str);
+            }
             secs += 86400;
             tp = localtime(&secs);
         }
@@ -170,6 +197,7 @@ int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
     struct tm start_tm;
     char tmstr[20];
     unsigned sens;
+    cat_catalog *cat = NULL;
 
     if ((start_str = cgi_get_param(query, "start")))
         start_secs = strtoul(start_str, NULL, 10);
@@ -190,7 +218,12 @@ int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
     fwrite(http_hdr, sizeof(http_hdr) - 1, 1, cgi_str);
     html_send_top(cgi_str);
     fprintf(cgi_str, html_middle, base_url);
-    send_calendar(midnight, &start_tm, sens, cgi_str);
+    if (chdir(default_dir) == 0)
+        cat = cat_load();
+    else
+        log_syserr("unable to chdir to '%s'", default_dir);
+    send_calendar(cat, midnight, &start_tm, sens, cgi_str);
+    cat_free(cat);
     send_middle_links(midnight, &start_tm, sens, cgi_str);
     send_hour_links(midnight, sens, cgi_str);
     fprintf(cgi_str, tab_end, base_url);
@@ -0,0 +1,229 @@
+/*
+ * cgi-tile
+ *
+ * Serves the history as tiles of TILE_POINTS points in JSON for a graph
+ * to fetch as it is zoomed and panned.  At level n a point covers
+ * TILE_STEP << n seconds and tile i starts at i times the span of a tile
+ * from the epoch, so a client works out which tiles it needs from the
+ * range on screen.  Each sensor has the lowest and highest sample in each
+ * point as well as the mean.  A tile that ends in the past is made once, kept in
+ * the tile cache in the data directory and sent with headers that let it
+ * be cached for good; one that is still filling is made each time.  So is
+ * one without samples, as the days it covers may yet be filled in, and
+ * the tile cache is not even looked in for one the catalog shows to have
+ * none.  The levels are those the history cache keeps buckets for.
+ */
+
+#include "catalog.h"
+#include "cc-html.h"
+#include "hist-cache.h"
+#include "history.h"
+#include "cgi-main.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TILE_POINTS    256
+#define TILE_STEP      BC_BASE_STEP
+#define TILE_MAX_LEVEL BC_MAX_SHIFT
+#define TILE_COMPLETE  120
+
+const char prog_name[] = "cc-tile";
+
+static const char tile_dir[] = "tile-cache";
+
+/* *INDENT-OFF* */
+static const char http_final[] =
+    "Content-Type: application/json\n"
+    "Cache-Control: public, max-age=31536000, immutable\n"
+    "\n";
+
+static const char http_partial[] =
+    "Content-Type: application/json\n"
+    "Cache-Control: no-cache\n"
+    "\n";
+/* *INDENT-ON* */
+
+static void send_sensors(hist_context *hc, const char *name, void (*out)(hist_context *, int, FILE *), FILE *fp)
+{
+    int i, ch;
+
+    fprintf(fp, ",\"%s\":", name);
+    ch = '{';
+    for (i = 0; i < RECV_SENSORS; i++) {
+        if (hist_has_sensor(hc, i)) {
+            fprintf(fp, "%c\"%s\":", ch, sensor_names[i]);
+            out(hc, i, fp);
+            ch = ',';
+        }
+    }
+    if (ch == '{')
+        putc(ch, fp);
+    putc('}', fp);
+}
+
+/*
+ * Returns 1 if the tile has no samples, 0 if it has, or -1 on failure.
+ */
+
+static int make_tile(const hist_backend *backend, int level, long tile, FILE *fp)
+{
+    hist_context *hc;
+    time_t step, start;
+    int empty = 1, i;
+
+    step = (time_t) TILE_STEP << level;
+    start = tile * step * TILE_POINTS;
+    if ((hc = hist_get(backend, start, start + step * TILE_POINTS, step, ~0U, 1)) == NULL)
+        return -1;
+    fprintf(fp, "{\"level\":%d,\"tile\":%ld,\"start\":%ld,\"step\":%ld", level, tile, (long) start, (long) step);
+    send_sensors(hc, "sensors", hist_js_sens_out, fp);
+    send_sensors(hc, "min", hist_js_sens_min_out, fp);
+    send_sensors(hc, "max", hist_js_sens_max_out, fp);
+    html_puts(",\"total\":", fp);
+    hist_js_total_out(hc, fp);
+    html_puts(",\"others\":", fp);
+    hist_js_others_out(hc, fp);
+    html_puts(",\"temp\":", fp);
+    hist_js_temp_out(hc, fp);
+    html_puts("}\n", fp);
+    for (i = 0; i < RECV_SENSORS; i++)
+        if (hist_has_sensor(hc, i))
+            empty = 0;
+    hist_free(hc);
+    return empty;
+}
+
+static int send_file(const char *file, const char *hdr, FILE *cgi_str)
+{
+    FILE *fp;
+    char buf[8192];
+    size_t n;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        if (errno != ENOENT)
+            log_syserr("unable to open tile '%s'", file);
+        return -1;
+    }
+    fputs(hdr, cgi_str);
+    while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+        fwrite(buf, 1, n, cgi_str);
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Make a complete tile and keep it, writing it to a temporary file first
+ * so a request made at the same time never sees it half written.  An
+ * empty tile is sent from the temporary file and not kept.
+ */
+
+static int store_tile(const hist_backend *backend, int level, long tile, const char *file, FILE *cgi_str)
+{
+    FILE *fp;
+    char tmp[PATH_MAX + 16];
+    int rc;
+
+    if (mkdir(tile_dir, 0775) && errno != EEXIST)
+        log_syserr("unable to create tile directory '%s'", tile_dir);
+    else {
+        snprintf(tmp, sizeof tmp, "%s.%d", file, (int) getpid());
+        if ((fp = fopen(tmp, "w"))) {
+            if ((rc = make_tile(backend, level, tile, fp)) >= 0) {
+                if (fclose(fp) == 0) {
+                    if (rc == 1) {
+                        rc = send_file(tmp, http_partial, cgi_str);
+                        unlink(tmp);
+                        return rc;
+                    }
+                    if (rename(tmp, file) == 0)
+                        return send_file(file, http_final, cgi_str);
+                    log_syserr("unable to rename '%s' to '%s'", tmp, file);
+                }
+                else
+                    log_syserr("unable to write tile '%s'", tmp);
+            }
+            else
+                fclose(fp);
+            unlink(tmp);
+        }
+        else
+            log_syserr("unable to open '%s' for writing", tmp);
+    }
+    return -1;
+}
+
+/*
+ * The catalog only describes the day files so it is only asked about
+ * tiles from them.
+ */
+
+static int no_samples(const hist_backend *backend, time_t start, time_t end)
+{
+    cat_catalog *cat;
+    int none = 0;
+
+    if (backend == &hist_xml_backend && (cat = cat_load())) {
+        none = !cat_has_data(cat, start, end);
+        cat_free(cat);
+    }
+    return none;
+}
+
+static int cgi_tile(struct timespec *prog_start, const hist_backend *backend, int level, long tile, FILE *cgi_str)
+{
+    time_t start, end;
+    char file[PATH_MAX];
+
+    if (chdir(default_dir)) {
+        log_syserr("unable to chdir to '%s'", default_dir);
+        return 2;
+    }
+    hist_cache_dir = BC_DIR;
+    start = tile * ((time_t) TILE_STEP << level) * TILE_POINTS;
+    end = start + ((time_t) TILE_STEP << level) * TILE_POINTS;
+    if (end <= prog_start->tv_sec - TILE_COMPLETE && !no_samples(backend, start, end)) {
+        snprintf(file, sizeof file, "%s/%s-%d-%ld.json", tile_dir, backend->name, level, tile);
+        if (send_file(file, http_final, cgi_str) == 0 || store_tile(backend, level, tile, file, cgi_str) == 0)
+            return 0;
+        return 3;
+    }
+    fwrite(http_partial, sizeof(http_partial) - 1, 1, cgi_str);
+    return make_tile(backend, level, tile, cgi_str) < 0 ? 3 : 0;
+}
+
+int cgi_main(struct timespec *start, cgi_query_t *query, FILE *cgi_str)
+{
+    int status = 0, level = 0;
+    const hist_backend *backend = hist_default_backend;
+    const char *str;
+    long tile = 0;
+
+    if ((str = cgi_get_param(query, "level")) == NULL) {
+        log_msg("missing 'level' parameter");
+        status = 1;
+    }
+    else if ((level = atoi(str)) < 0 || level > TILE_MAX_LEVEL) {
+        log_msg("level must be from 0 to %d", TILE_MAX_LEVEL);
+        status = 1;
+    }
+    if ((str = cgi_get_param(query, "tile")) == NULL) {
+        log_msg("missing 'tile' parameter");
+        status = 1;
+    }
+    else if ((tile = strtol(str, NULL, 10)) < 0 || tile >= LONG_MAX / ((long) TILE_STEP << TILE_MAX_LEVEL) / TILE_POINTS) {
+        log_msg("tile %ld is out of range", tile);
+        status = 1;
+    }
+    if ((str = cgi_get_param(query, "src")) && (backend = hist_find_backend(str)) == NULL) {
+        log_msg("unknown history source '%s'", str);
+        status = 1;
+    }
+    if (status == 0)
+        status = cgi_tile(start, backend, level, tile, cgi_str);
+    return status;
+}
@@ -167,25 +167,16 @@ static void enqueue(db_logger_t *db_logger, sample_t *smp, const char *stmt)
 
 extern void db_logger_line(db_logger_t *db_logger, struct timespec *when, const char *line, const char *line_end)
 {
-    const char *ptr;
+    const char *stmt;
     sample_t *smp;
+    lt_line ln;
 
     if ((smp = malloc(sizeof(sample_t)))) {
         smp->when = *when;
-        smp->ptr.data_ptr = smp->data;
-        if ((ptr = parse_real(smp, 3, "<tmpr>", line, line_end))) {
-            if ((ptr = parse_int(smp, 1, "<sensor>", ptr, line_end))) {
-                if ((ptr = parse_int(smp, 2, "<id>", ptr, line_end))) {
-                    if (parse_real(smp, 4, "<watts>", ptr, line_end)) {
-                        enqueue(db_logger, smp, "power");
-                        return;
-                    }
-                    else if (parse_int(smp, 4, "<imp>", ptr, line_end)) {
-                        enqueue(db_logger, smp, "pulse");
-                        return;
-                    }
-                }
-            }
+        lt_init(&ln);
+        if ((stmt = pg_parse_line(smp, &ln, line, line_end))) {
+            enqueue(db_logger, smp, stmt);
+            return;
         }
         free(smp);
     }
@@ -0,0 +1,729 @@
+/*
+ * energy
+ *
+ * The energy index is kept in the directory cc-energy under the data
+ * directory in a file for each UTC day, named for the day number counted
+ * from the epoch.  A file has the energy each series had used before the
+ * day began and then, at each minute boundary of the day, the energy used
+ * since it began in hundredths of a watt-hour, filled as far as the count
+ * of minutes in the header.  Each minute adds its mean power for a
+ * sixtieth of an hour, a sensor with no samples in a minute being taken
+ * to stay at its last mean for up to EN_HOLD minutes and at none after.
+ */
+
+#include "cc-common.h"
+#include "energy.h"
+#include "linetok.h"
+#include "parsefile.h"
+#include "rollup.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define EN_MAGIC    0x47524e45
+#define EN_VERSION  1
+#define EN_SCALE    100
+
+const char energy_dir[] = "cc-energy";
+
+typedef union {
+    struct {
+        unsigned magic;
+        unsigned version;
+        unsigned scale;
+        unsigned minutes;
+        long day;
+        double base[EN_SERIES];
+    } h;
+    char pad[128];
+} en_header;
+
+typedef int en_row[EN_SERIES];
+
+#define row_offset(i) (sizeof(en_header) + (i) * sizeof(en_row))
+
+/*
+ * The nearest day before or after the one given that has a file, or -1
+ * if there is none.
+ */
+
+static long nearest_day(long day, int after)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char *end;
+    long n, best = -1;
+
+    if ((dir = opendir(energy_dir)) == NULL) {
+        if (errno != ENOENT)
+            log_syserr("unable to read energy directory '%s'", energy_dir);
+        return -1;
+    }
+    while ((ent = readdir(dir))) {
+        n = strtol(ent->d_name, &end, 10);
+        if (end > ent->d_name && *end == '\0' && (after ? n > day && (best < 0 || n < best) : n < day && n > best))
+            best = n;
+    }
+    closedir(dir);
+    return best;
+}
+
+static int read_row(int fd, unsigned i, en_row row)
+{
+    if (pread(fd, row, sizeof(en_row), row_offset(i)) == sizeof(en_row))
+        return 0;
+    log_syserr("unable to read energy record");
+    return -1;
+}
+
+static int day_end(int fd, const en_header * hdr, double *wh)
+{
+    en_row row;
+    int s;
+
+    if (read_row(fd, hdr->h.minutes, row))
+        return -1;
+    for (s = 0; s < EN_SERIES; s++)
+        wh[s] = hdr->h.base[s] + (double) row[s] / EN_SCALE;
+    return 0;
+}
+
+static int chain_base(long day, double *base);
+
+static int day_open(long day, int create, en_header * hdr)
+{
+    ssize_t nbytes;
+    char file[PATH_MAX];
+    int fd;
+
+    snprintf(file, sizeof file, "%s/%ld", energy_dir, day);
+    if ((fd = open(file, create ? O_RDWR | O_CREAT : O_RDONLY, 0664)) < 0) {
+        if (errno != ENOENT || create)
+            log_syserr("unable to open energy file '%s'", file);
+        return -1;
+    }
+    if ((nbytes = pread(fd, hdr, sizeof(en_header), 0)) == 0 && create) {
+        memset(hdr, 0, sizeof(en_header));
+        hdr->h.magic = EN_MAGIC;
+        hdr->h.version = EN_VERSION;
+        hdr->h.scale = EN_SCALE;
+        hdr->h.day = day;
+        if (chain_base(day, hdr->h.base) == 0 && pwrite(fd, hdr, sizeof(en_header), 0) == sizeof(en_header)
+            && ftruncate(fd, row_offset(MINS_IN_DAY + 1)) == 0)
+            return fd;
+        log_syserr("unable to initialise energy file '%s'", file);
+    }
+    else if (nbytes < 0)
+        log_syserr("unable to read energy file '%s'", file);
+    else if (nbytes == sizeof(en_header) && hdr->h.magic == EN_MAGIC && hdr->h.version == EN_VERSION && hdr->h.scale == EN_SCALE
+             && hdr->h.day == day && hdr->h.minutes <= MINS_IN_DAY)
+        return fd;
+    else if (nbytes > 0)
+        log_msg("energy file '%s' is not valid", file);
+    close(fd);
+    return -1;
+}
+
+/*
+ * A day starts from where the last day before it with a file ended, as
+ * there was nothing to add up in between.
+ */
+
+static int chain_base(long day, double *base)
+{
+    en_header hdr;
+    int fd, status;
+
+    if ((day = nearest_day(day, 0)) < 0) {
+        memset(base, 0, EN_SERIES * sizeof(double));
+        return 0;
+    }
+    if ((fd = day_open(day, 0, &hdr)) < 0)
+        return -1;
+    flock(fd, LOCK_SH);
+    if (pread(fd, &hdr, sizeof hdr, 0) == sizeof hdr)
+        status = day_end(fd, &hdr, base);
+    else {
+        log_syserr("unable to read energy file header");
+        status = -1;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return status;
+}
+
+/*
+ * Carry the end of a day on as the start of the days after it, stopping
+ * at the first that already starts there.
+ */
+
+static int rechain(long day)
+{
+    en_header hdr;
+    double end[EN_SERIES], diff;
+    int fd, status, same, s;
+
+    if ((fd = day_open(day, 0, &hdr)) < 0)
+        return -1;
+    status = day_end(fd, &hdr, end);
+    close(fd);
+    for (same = 0; status == 0 && !same && (day = nearest_day(day, 1)) >= 0;) {
+        if ((fd = day_open(day, 1, &hdr)) < 0)
+            return -1;
+        if (flock(fd, LOCK_EX) == 0) {
+            if (pread(fd, &hdr, sizeof hdr, 0) == sizeof hdr) {
+                for (same = 1, s = 0; s < EN_SERIES; s++)
+                    if ((diff = hdr.h.base[s] - end[s]) > 0.001 || diff < -0.001)
+                        same = 0;
+                if (!same) {
+                    memcpy(hdr.h.base, end, sizeof(hdr.h.base));
+                    if (pwrite(fd, hdr.h.base, sizeof(hdr.h.base), offsetof(en_header, h.base)) != sizeof(hdr.h.base)) {
+                        log_syserr("unable to write energy file header");
+                        status = -1;
+                    }
+                }
+                if (status == 0)
+                    status = day_end(fd, &hdr, end);
+            }
+            else {
+                log_syserr("unable to read energy file header");
+                status = -1;
+            }
+            flock(fd, LOCK_UN);
+        }
+        else {
+            log_syserr("unable to lock energy file");
+            status = -1;
+        }
+        close(fd);
+    }
+    return status;
+}
+
+void en_state_init(en_state * st)
+{
+    int s;
+
+    for (s = 0; s < RECV_SENSORS; s++) {
+        st->watts[s] = 0;
+        st->held[s] = EN_HOLD;
+    }
+    for (s = 0; s < EN_SERIES; s++)
+        st->wh[s] = 0;
+}
+
+/*
+ * The total is worked out from the sensors as the history's is: from the
+ * solar and import meters while importing, otherwise from the solar meter
+ * less the clamp, which is then measuring the export.
+ */
+
+void en_add_minute(en_state * st, const double *sum, const unsigned *count)
+{
+    int s;
+
+    for (s = 0; s < RECV_SENSORS; s++) {
+        if (count[s] > 0) {
+            st->watts[s] = sum[s] / count[s];
+            st->held[s] = 0;
+        }
+        else if (st->held[s] < EN_HOLD)
+            st->held[s]++;
+        else
+            st->watts[s] = 0;
+        st->wh[s] += st->watts[s] / 60;
+    }
+    st->wh[EN_TOTAL] += (st->watts[SENSOR_SOLAR] + grid_power(st->watts[SENSOR_IMPORT], st->watts[SENSOR_CLAMP])) / 60;
+}
+
+static void state_row(const en_state * st, en_row row)
+{
+    double x;
+    int s;
+
+    for (s = 0; s < EN_SERIES; s++) {
+        x = st->wh[s] * EN_SCALE;
+        row[s] = x < 0 ? x - 0.5 : x + 0.5;
+    }
+}
+
+/*
+ * Index a day from its minute rollups, which must have been made, and
+ * move the days after it on by any change in its energy.
+ */
+
+int en_build_day(time_t day)
+{
+    int status = -1, fd, m, s;
+    ru_reader *rr;
+    ru_record *recs;
+    en_row *rows;
+    en_header hdr;
+    en_state st;
+    double sum[RECV_SENSORS];
+    unsigned count[RECV_SENSORS];
+    long day_num;
+
+    day -= day % SECS_IN_DAY;
+    day_num = day / SECS_IN_DAY;
+    if ((recs = malloc(MINS_IN_DAY * sizeof(ru_record) + (MINS_IN_DAY + 1) * sizeof(en_row)))) {
+        rows = (en_row *) (recs + MINS_IN_DAY);
+        if ((rr = ru_open(60))) {
+            if (ru_read(rr, day, MINS_IN_DAY, recs) == 0) {
+                if (recs[0].done && recs[MINS_IN_DAY - 1].done) {
+                    en_state_init(&st);
+                    state_row(&st, rows[0]);
+                    for (m = 0; m < MINS_IN_DAY; m++) {
+                        for (s = 0; s < RECV_SENSORS; s++) {
+                            sum[s] = (double) recs[m].sensors[s].sum / WATTS_SCALE;
+                            count[s] = recs[m].sensors[s].count;
+                        }
+                        en_add_minute(&st, sum, count);
+                        state_row(&st, rows[m + 1]);
+                    }
+                    if ((fd = day_open(day_num, 1, &hdr)) >= 0) {
+                        if (flock(fd, LOCK_EX) == 0) {
+                            hdr.h.minutes = MINS_IN_DAY;
+                            if (chain_base(day_num, hdr.h.base) == 0) {
+                                if (pwrite(fd, &hdr, sizeof hdr, 0) == sizeof hdr
+                                    && pwrite(fd, rows, (MINS_IN_DAY + 1) * sizeof(en_row), row_offset(0)) == (MINS_IN_DAY + 1) * sizeof(en_row))
+                                    status = 0;
+                                else
+                                    log_syserr("unable to write energy records");
+                            }
+                            flock(fd, LOCK_UN);
+                        }
+                        else
+                            log_syserr("unable to lock energy file");
+                        close(fd);
+                    }
+                }
+                else
+                    log_msg("day %ld has not been rolled up", day_num);
+            }
+            ru_close(rr);
+        }
+        free(recs);
+    }
+    else
+        log_syserr("unable to allocate space for energy records");
+    if (status == 0)
+        status = rechain(day_num);
+    return status;
+}
+
+/*
+ * Index the day given once it is over, from its rollups, which the live
+ * index is replaced by.  Days missed are left to xml2rollup.
+ */
+
+int en_update_day(time_t day)
+{
+    struct stat stb;
+    ru_reader *rr;
+    ru_record rec;
+    int done = 0;
+
+    if (stat(energy_dir, &stb))
+        return errno == ENOENT ? 0 : -1;
+    day -= day % SECS_IN_DAY;
+    if ((rr = ru_open(SECS_IN_DAY))) {
+        done = ru_read(rr, day, 1, &rec) == 0 && rec.done;
+        ru_close(rr);
+    }
+    return done ? en_build_day(day) : 0;
+}
+
+/*
+ * The energy used up to a time, interpolated between the minutes either
+ * side of it, or up to the last minute filled.  A time on a day without a
+ * file is at the end of the last day before it with one.  Returns 1 if
+ * the time is before the index began.
+ */
+
+static int lookup(time_t ts, double *wh)
+{
+    en_header hdr;
+    en_row rows[2];
+    double frac;
+    unsigned m;
+    long day;
+    int fd, status = -1, s;
+
+    day = ts / SECS_IN_DAY;
+    if ((fd = day_open(day, 0, &hdr)) < 0) {
+        if (errno != ENOENT)
+            return -1;
+        if ((day = nearest_day(day, 0)) < 0) {
+            memset(wh, 0, EN_SERIES * sizeof(double));
+            return 1;
+        }
+        ts = (day + 1) * SECS_IN_DAY;
+        if ((fd = day_open(day, 0, &hdr)) < 0)
+            return -1;
+    }
+    flock(fd, LOCK_SH);
+    if (pread(fd, &hdr, sizeof hdr, 0) == sizeof hdr) {
+        if ((m = ts - day * SECS_IN_DAY) / 60 >= hdr.h.minutes)
+            status = day_end(fd, &hdr, wh);
+        else if (pread(fd, rows, sizeof rows, row_offset(m / 60)) == sizeof rows) {
+            frac = (m % 60) / 60.0;
+            for (s = 0; s < EN_SERIES; s++)
+                wh[s] = hdr.h.base[s] + (rows[0][s] + (rows[1][s] - rows[0][s]) * frac) / EN_SCALE;
+            status = 0;
+        }
+        else
+            log_syserr("unable to read energy records");
+    }
+    else
+        log_syserr("unable to read energy file header");
+    flock(fd, LOCK_UN);
+    close(fd);
+    return status;
+}
+
+int en_energy(time_t start, time_t end, double *wh)
+{
+    double from[EN_SERIES];
+    int s;
+
+    if (lookup(start, from) < 0 || lookup(end, wh) != 0)
+        return -1;
+    for (s = 0; s < EN_SERIES; s++)
+        wh[s] -= from[s];
+    return 0;
+}
+
+/*
+ * The file logger's writer adds up the samples for the current minute and
+ * writes the minute to today's file when a sample for a later one comes,
+ * along with any minutes in between.  On starting it carries on from the
+ * last minute already in today's file, the minutes missed having nothing.
+ */
+
+struct _en_writer {
+    pf_context *pf;
+    long minute;                /* being added up, from the epoch, or 0 */
+    int fd;                     /* its day's file, -1 if none */
+    double sum[RECV_SENSORS];
+    unsigned count[RECV_SENSORS];
+    en_state st;
+};
+
+static void writer_open(en_writer * ew, long minute)
+{
+    struct stat stb;
+    en_header hdr;
+    en_row row;
+    long day = minute / MINS_IN_DAY;
+    int s;
+
+    en_state_init(&ew->st);
+    ew->minute = minute;
+    ew->fd = -1;
+    if (stat(energy_dir, &stb) == 0 && (ew->fd = day_open(day, 1, &hdr)) >= 0) {
+        if (hdr.h.minutes > 0 && read_row(ew->fd, hdr.h.minutes, row) == 0)
+            for (s = 0; s < EN_SERIES; s++)
+                ew->st.wh[s] = (double) row[s] / EN_SCALE;
+        ew->minute = day * MINS_IN_DAY + hdr.h.minutes;
+    }
+}
+
+static void writer_close_minute(en_writer * ew)
+{
+    en_row row;
+    unsigned m = ew->minute % MINS_IN_DAY + 1;
+
+    en_add_minute(&ew->st, ew->sum, ew->count);
+    memset(ew->sum, 0, sizeof(ew->sum));
+    memset(ew->count, 0, sizeof(ew->count));
+    if (ew->fd >= 0) {
+        state_row(&ew->st, row);
+        if (flock(ew->fd, LOCK_EX) == 0) {
+            if (pwrite(ew->fd, row, sizeof row, row_offset(m)) != sizeof row
+                || pwrite(ew->fd, &m, sizeof m, offsetof(en_header, h.minutes)) != sizeof m)
+                log_syserr("unable to write energy record");
+            flock(ew->fd, LOCK_UN);
+        }
+        else
+            log_syserr("unable to lock energy file");
+    }
+    if (++ew->minute % MINS_IN_DAY == 0) {
+        if (ew->fd >= 0)
+            close(ew->fd);
+        writer_open(ew, ew->minute);
+    }
+}
+
+static void writer_add(en_writer * ew, time_t ts, int sensor, cc_real watts)
+{
+    long minute = ts / 60;
+
+    if (sensor >= 0 && sensor < RECV_SENSORS) {
+        if (ew->minute == 0)
+            writer_open(ew, minute);
+        while (ew->minute < minute)
+            writer_close_minute(ew);
+        if (ew->minute == minute) {
+            ew->sum[sensor] += watts_to_double(watts);
+            ew->count[sensor]++;
+        }
+    }
+}
+
+static mf_status writer_sample_cb(pf_context * pf, pf_sample * smp)
+{
+    writer_add(pf->user_data, smp->timestamp, smp->sensor, smp->data.watts);
+    return MF_SUCCESS;
+}
+
+en_writer *en_writer_new(void)
+{
+    en_writer *ew;
+
+    if ((ew = malloc(sizeof(en_writer)))) {
+        if ((ew->pf = pf_new())) {
+            ew->pf->sample_cb = writer_sample_cb;
+            ew->pf->user_data = ew;
+            ew->minute = 0;
+            ew->fd = -1;
+            memset(ew->sum, 0, sizeof(ew->sum));
+            memset(ew->count, 0, sizeof(ew->count));
+            return ew;
+        }
+        free(ew);
+    }
+    log_syserr("unable to allocate energy writer");
+    return NULL;
+}
+
+void en_writer_free(en_writer * ew)
+{
+    if (ew->fd >= 0)
+        close(ew->fd);
+    pf_free(ew->pf);
+    free(ew);
+}
+
+#define LINE_FIELDS  (LT_BIT(LT_SENSOR) | LT_BIT(LT_WATTS) | LT_BIT(LT_IMP) | LT_BIT(LT_IPU))
+#define PULSE_FIELDS (LT_BIT(LT_IMP) | LT_BIT(LT_IPU))
+
+void en_writer_line(en_writer * ew, time_t when, const char *line, const char *end)
+{
+    pf_sample smp;
+    lt_line ln;
+
+    lt_init(&ln);
+    lt_scan(&ln, LINE_FIELDS, line, end);
+    if (ln.found & LT_BIT(LT_SENSOR)) {
+        if (ln.found & LT_BIT(LT_WATTS))
+            writer_add(ew, when, ln.sensor, ln.watts);
+        else if ((ln.found & PULSE_FIELDS) == PULSE_FIELDS) {
+            smp.timestamp = when;
+            smp.usecs = 0;
+            smp.temp = 0;
+            smp.sensor = ln.sensor;
+            smp.data.pulse.count = ln.count;
+            smp.data.pulse.ipu = ln.ipu;
+            pf_default_pulse_cb(ew->pf, &smp);
+        }
+    }
+}
+
+/*
+ * Energy from the pulse counters is worked out from the counts either
+ * side of each end of the range, found by seeking in the day files, each
+ * read within EN_NEAR seconds of the end and the count at the end taken
+ * between them.  A count at the end of the range lower than the one at
+ * the start means the counter was reset in between, so the last reading
+ * before the reset is found by bisecting the readings, the counts after
+ * it having started again from nothing.  A reset the count has since
+ * climbed back past cannot be told from the ends and is missed.
+ */
+
+#define EN_NEAR 900
+
+typedef struct {
+    time_t ts;                  /* 0 if none was found */
+    long count;
+    int ipu;
+} en_reading;
+
+typedef struct {
+    time_t target;
+    unsigned want_before;       /* sensors yet to be found each side */
+    unsigned want_after;
+    en_reading before[RECV_SENSORS];      /* the last at or before the target */
+    en_reading after[RECV_SENSORS];       /* and the first after it */
+} en_probe;
+
+#define READING_FIELDS (LT_BIT(LT_TSTAMP) | LT_BIT(LT_SENSOR) | PULSE_FIELDS)
+
+static int read_pulse(const char *line, const char *end, en_reading * rd)
+{
+    lt_line ln;
+
+    lt_init(&ln);
+    lt_scan(&ln, READING_FIELDS, line, end);
+    rd->ts = ln.found & LT_BIT(LT_TSTAMP) ? ln.secs : 0;
+    if ((ln.found & (LT_BIT(LT_TSTAMP) | LT_BIT(LT_SENSOR) | LT_BIT(LT_IMP))) != (LT_BIT(LT_TSTAMP) | LT_BIT(LT_SENSOR) | LT_BIT(LT_IMP))
+        || ln.sensor < 0 || ln.sensor >= RECV_SENSORS)
+        return -1;
+    rd->count = ln.count;
+    rd->ipu = ln.found & LT_BIT(LT_IPU) ? ln.ipu : 0;
+    return ln.sensor;
+}
+
+static mf_status probe_cb(void *user_data, const void *file_data, size_t file_size)
+{
+    en_probe *pr = user_data;
+    const char *start = file_data;
+    const char *end = start + file_size;
+    const char *mid, *line, *nl;
+    en_reading rd;
+    int s;
+
+    mid = tf_seek(start, end, pf_line_time, pr->target + 1);
+    for (nl = mid; pr->want_before && nl > start; nl = line) {
+        for (line = nl - 1; line > start && line[-1] != '\n'; line--);
+        if ((s = read_pulse(line, nl, &rd)) >= 0 && (pr->want_before & (1U << s))) {
+            pr->before[s] = rd;
+            pr->want_before &= ~(1U << s);
+        }
+        if (rd.ts > 0 && rd.ts < pr->target - EN_NEAR)
+            break;
+    }
+    for (line = mid; pr->want_after && line < end; line = nl + 1) {
+        if ((nl = memchr(line, '\n', end - line)) == NULL)
+            nl = end;
+        if ((s = read_pulse(line, nl, &rd)) >= 0 && (pr->want_after & (1U << s))) {
+            pr->after[s] = rd;
+            pr->want_after &= ~(1U << s);
+        }
+        if (rd.ts > pr->target + EN_NEAR)
+            break;
+    }
+    return MF_SUCCESS;
+}
+
+static int probe_day(en_probe * pr, time_t day)
+{
+    struct stat stb;
+    struct tm tm;
+    char file[30];
+
+    gmtime_r(&day, &tm);
+    strftime(file, sizeof file, xml_file, &tm);
+    if (stat(file, &stb)) {
+        if (errno == ENOENT)
+            return 0;
+        log_syserr("unable to stat '%s'", file);
+        return -1;
+    }
+    return mf_read_file(file, MF_MAP, pr, probe_cb) == MF_SUCCESS ? 0 : -1;
+}
+
+static int probe(en_probe * pr, time_t target, unsigned sensors)
+{
+    time_t day = target - target % SECS_IN_DAY;
+    int status;
+
+    memset(pr, 0, sizeof(en_probe));
+    pr->target = target;
+    pr->want_before = pr->want_after = sensors;
+    status = probe_day(pr, day);
+    if (status == 0 && pr->want_before && target - EN_NEAR < day)
+        status = probe_day(pr, day - SECS_IN_DAY);
+    if (status == 0 && pr->want_after && target + EN_NEAR >= day + SECS_IN_DAY)
+        status = probe_day(pr, day + SECS_IN_DAY);
+    return status;
+}
+
+/*
+ * The count at the target, taken between the readings either side unless
+ * the counter was reset between them, and the reading to bisect from.
+ */
+
+static const en_reading *boundary(const en_probe * pr, int s, double *count)
+{
+    const en_reading *b = pr->before + s, *a = pr->after + s;
+
+    if (b->ts && a->ts && a->count >= b->count) {
+        *count = b->count + (double) (a->count - b->count) * (pr->target - b->ts) / (a->ts - b->ts);
+        return b;
+    }
+    if (b->ts) {
+        *count = b->count;
+        return b;
+    }
+    if (a->ts) {
+        *count = a->count;
+        return a;
+    }
+    return NULL;
+}
+
+/*
+ * Narrow lo and hi, readings before and after a reset, down to the last
+ * before it and the first after, or as near as the readings go.
+ */
+
+static int find_reset(int s, en_reading * lo, en_reading * hi)
+{
+    en_probe pr;
+    en_reading *rd;
+
+    while (hi->ts - lo->ts > 1) {
+        if (probe(&pr, lo->ts + (hi->ts - lo->ts) / 2, 1U << s))
+            return -1;
+        if ((rd = pr.before + s)->ts <= lo->ts && ((rd = pr.after + s)->ts == 0 || rd->ts >= hi->ts))
+            break;
+        if (rd->count >= lo->count)
+            *lo = *rd;
+        else
+            *hi = *rd;
+    }
+    return 0;
+}
+
+unsigned en_pulse_energy(time_t start, time_t end, unsigned sensors, double *wh)
+{
+    en_probe from, to;
+    en_reading lo, hi;
+    const en_reading *rd;
+    double c0, c1;
+    unsigned found = 0;
+    int s, ipu;
+
+    sensors &= (1U << RECV_SENSORS) - 1;
+    if (probe(&from, start, sensors) || probe(&to, end, sensors))
+        return 0;
+    for (s = 0; s < RECV_SENSORS; s++) {
+        if (!(sensors & (1U << s)) || (rd = boundary(&from, s, &c0)) == NULL)
+            continue;
+        lo = *rd;
+        if ((rd = boundary(&to, s, &c1)) == NULL)
+            continue;
+        hi = to.after[s].ts ? to.after[s] : *rd;
+        if ((ipu = hi.ipu) == 0 && (ipu = lo.ipu) == 0)
+            continue;
+        if (c1 < c0) {
+            if (hi.count >= lo.count || find_reset(s, &lo, &hi))
+                continue;
+            c1 += lo.count - c0;
+            c0 = 0;
+        }
+        wh[s] = (c1 - c0) * 1000 / ipu;
+        found |= 1U << s;
+    }
+    return found;
+}
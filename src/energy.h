@@ -0,0 +1,64 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include "cc-defs.h"
+
+#include <time.h>
+
+/*
+ * The energy index holds, for each sensor of a receiver and for the
+ * derived total, the energy used since the index began at every minute
+ * of each UTC day, so the energy over any range is the difference between
+ * two lookups, each taken between the minutes either side of the time.  Days over are
+ * indexed from their minute rollups, and the file logger extends today's
+ * index as each minute ends.  Nothing is indexed unless xml2rollup has
+ * made the energy directory.
+ */
+
+#define EN_TOTAL  RECV_SENSORS
+#define EN_SERIES (RECV_SENSORS + 1)
+
+extern const char energy_dir[];
+
+/*
+ * The energy used is added up a minute at a time from the sum and count
+ * of each sensor's samples in the minute, a sensor with none being taken
+ * to stay at its last mean for up to EN_HOLD minutes and at none after.
+ */
+
+#define EN_HOLD 5
+
+typedef struct {
+    double watts[RECV_SENSORS]; /* the last mean of each sensor */
+    int held[RECV_SENSORS];     /* minutes it has been held for */
+    double wh[EN_SERIES];       /* used since the start of the day */
+} en_state;
+
+extern void en_state_init(en_state * st);
+extern void en_add_minute(en_state * st, const double *sum, const unsigned *count);
+
+extern int en_build_day(time_t day);
+extern int en_update_day(time_t day);
+
+/*
+ * Set the watt-hours used over the range for each series, returning -1 if
+ * the index has nothing at or before the end of the range.
+ */
+
+extern int en_energy(time_t start, time_t end, double *wh);
+
+/*
+ * Set the watt-hours used over the range by each of the sensors given
+ * that count pulses, from their counts at the ends of the range rather
+ * than from the index, returning a bit set for each sensor done.
+ */
+
+extern unsigned en_pulse_energy(time_t start, time_t end, unsigned sensors, double *wh);
+
+typedef struct _en_writer en_writer;
+
+extern en_writer *en_writer_new(void);
+extern void en_writer_free(en_writer * ew);
+extern void en_writer_line(en_writer * ew, time_t when, const char *line, const char *end);
+
+#endif
@@ -1,7 +1,12 @@
 #include "cc-common.h"
+#include "catalog.h"
+#include "energy.h"
 #include "file-logger.h"
+#include "rollup.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +15,11 @@
 struct _file_logger_t {
     time_t switch_secs;
     FILE *xml_fp;
+    en_writer *energy;
+    pthread_t day_thread;
+    int day_started;
+    int day_running;
+    time_t day;
 };
 
 extern file_logger_t *file_logger_new(void)
@@ -19,7 +29,11 @@ extern file_logger_t *file_logger_new(void)
     if ((file_logger = malloc(sizeof(file_logger_t)))) {
         file_logger->switch_secs = 0;
         file_logger->xml_fp = NULL;
-        return file_logger;
+        file_logger->day_started = 0;
+        file_logger->day_running = 0;
+        if ((file_logger->energy = en_writer_new()))
+            return file_logger;
+        free(file_logger);
     }
     return NULL;
 }
@@ -27,25 +41,77 @@ extern file_logger_t *file_logger_new(void)
 extern void file_logger_free(file_logger_t * file_logger)
 {
     if (file_logger) {
+        if (file_logger->day_started)
+            pthread_join(file_logger->day_thread, NULL);
         if (file_logger->xml_fp)
             fclose(file_logger->xml_fp);
+        en_writer_free(file_logger->energy);
         free(file_logger);
     }
 }
 
+/*
+ * Once a day is over it is catalogued, rolled up and indexed on a thread
+ * of its own so the serial port is still read meanwhile.  The thread
+ * blocks every signal so they still interrupt the reads.
+ */
+
+static void *day_thread(void *ptr)
+{
+    file_logger_t *file_logger = ptr;
+    time_t day = file_logger->day;
+
+    if (cat_update_day(day))
+        log_msg("unable to update catalog for the previous day");
+    if (ru_update_day(day))
+        log_msg("unable to roll up the previous day");
+    else if (en_update_day(day))
+        log_msg("unable to index the energy of the previous day");
+    __atomic_store_n(&file_logger->day_running, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void day_over(file_logger_t * file_logger, time_t day)
+{
+    sigset_t all, old;
+    int res;
+
+    if (file_logger->day_started) {
+        if (__atomic_load_n(&file_logger->day_running, __ATOMIC_ACQUIRE)) {
+            log_msg("still updating for the day before, the previous day is left to xml2rollup");
+            return;
+        }
+        pthread_join(file_logger->day_thread, NULL);
+        file_logger->day_started = 0;
+    }
+    file_logger->day = day;
+    __atomic_store_n(&file_logger->day_running, 1, __ATOMIC_RELAXED);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if ((res = pthread_create(&file_logger->day_thread, NULL, day_thread, file_logger)) == 0)
+        file_logger->day_started = 1;
+    else {
+        log_msg("unable to create thread for the change of day - %s", strerror(res));
+        __atomic_store_n(&file_logger->day_running, 0, __ATOMIC_RELAXED);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
 static void switch_file(file_logger_t * file_logger, time_t now_secs)
 {
-    struct tm *tp;
+    struct tm tm;
     FILE *nfp;
     char file[30];
 
-    tp = gmtime(&now_secs);
-    strftime(file, sizeof file, xml_file, tp);
+    gmtime_r(&now_secs, &tm);
+    strftime(file, sizeof file, xml_file, &tm);
     if ((nfp = fopen(file, "a"))) {
         if (file_logger->xml_fp != NULL)
             fclose(file_logger->xml_fp);
         file_logger->xml_fp = nfp;
         file_logger->switch_secs = now_secs + 86400 - (now_secs % 86400);
+        /* the previous day is now complete */
+        day_over(file_logger, now_secs - 86400);
     }
     else
         log_syserr("unable to open file '%s' for append", file);
@@ -57,6 +123,7 @@ extern void file_logger_line(file_logger_t *file_logger, struct timespec *when,
     FILE *fp;
 
     if ((ptr = strstr(line, "<msg>"))) {
+        en_writer_line(file_logger->energy, when->tv_sec, line, end);
         if (when->tv_sec >= file_logger->switch_secs)
             switch_file(file_logger, when->tv_sec);
         if ((fp = file_logger->xml_fp)) {
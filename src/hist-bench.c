@@ -0,0 +1,154 @@
+/*
+ * hist-bench
+ *
+ * Measures hist_get over a range of days from the current directory,
+ * using the same step as the history page for about 720 points, and prints
+ * the mean of the total consumption points so builds with and without
+ * FIXED_POINT can be checked against each other.  The -m and -T options
+ * restrict the sensors and drop the temperature as the history page does,
+ * -j sets the number of threads reading day files, -c caches buckets in
+ * the directory given, so repeats after the first come from the cache,
+ * -R reads every sample even where the day files are rolled up, each -o
+ * also fetches the range that many days before, as an overlay would,
+ * -q keeps quantile sketches, 1 for the range and 2 for each point too,
+ * -a reads only one line in that many and -b stops reading after that
+ * many milliseconds, either way printing how approximate the result is.
+ */
+
+#include "cc-common.h"
+#include "hist-cache.h"
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+const char prog_name[] = "hist-bench";
+
+static void print_io_stats(FILE *fp)
+{
+    mf_stat io[MF_NSTRATEGY];
+    int i;
+
+    mf_get_stats(io);
+    for (i = 0; i < MF_NSTRATEGY; i++)
+        if (io[i].files > 0)
+            fprintf(fp, "%-12s %6lu files %12llu bytes %10.3f ms\n", mf_strategy_names[i], io[i].files, io[i].bytes, io[i].nsecs / 1e6);
+}
+
+static double mean_total(hist_context * hc)
+{
+    double sum = 0.0;
+    int count = 0, i;
+
+    for (i = 0; i < hc->points; i++) {
+        if (hc->total[i] >= 0) {
+            sum += watts_to_double(hc->total[i]);
+            count++;
+        }
+    }
+    return count ? sum / count : 0.0;
+}
+
+static void print_approx(hist_context * hc, FILE * fp)
+{
+    double error, worst = 0.0;
+    int i;
+
+    for (i = 0; i < MAX_SENSOR; i++)
+        if ((error = hist_error(hc, i)) > worst)
+            worst = error;
+    if (hc->sampled < 1)
+        fprintf(fp, "sampled %.2f%% of lines for %d of %d points, largest error %.1f W\n", hc->sampled * 100, hc->raw_points, hc->points, worst);
+    if (hist_partial(hc))
+        fprintf(fp, "out of time, read to %ld of %ld\n", (long) hc->read_to, (long) hc->end_ts);
+}
+
+int main(int argc, char **argv)
+{
+    int status = 0, repeat = 1, days = 7, need_temp = 1, nranges = 1, c, i, r;
+    unsigned sensors = ~0U;
+    const hist_backend *backend = hist_default_backend;
+    time_t start, end, step, offsets[HIST_MAX_RANGES] = { 0 };
+    hist_context *ranges[HIST_MAX_RANGES];
+    struct timespec t0, t1;
+    double secs, total = 0.0;
+
+    while ((c = getopt(argc, argv, "a:b:c:j:m:n:o:q:Rs:T")) != EOF) {
+        switch (c) {
+            case 'a':
+                hist_stride = atoi(optarg);
+                break;
+            case 'b':
+                hist_budget_ms = atoi(optarg);
+                break;
+            case 'c':
+                hist_cache_dir = optarg;
+                break;
+            case 'j':
+                hist_threads = atoi(optarg);
+                break;
+            case 'm':
+                sensors = strtoul(optarg, NULL, 16) | HIST_DERIVED_SENSORS;
+                break;
+            case 'n':
+                repeat = atoi(optarg);
+                break;
+            case 'o':
+                if (nranges < HIST_MAX_RANGES)
+                    offsets[nranges++] = -atol(optarg) * 86400;
+                else {
+                    fprintf(stderr, "hist-bench: at most %d overlays\n", HIST_MAX_RANGES - 1);
+                    status = 1;
+                }
+                break;
+            case 'q':
+                hist_sketches = atoi(optarg);
+                break;
+            case 'R':
+                hist_rollups = 0;
+                break;
+            case 's':
+                if ((backend = hist_find_backend(optarg)) == NULL) {
+                    fprintf(stderr, "hist-bench: unknown source '%s'\n", optarg);
+                    status = 1;
+                }
+                break;
+            case 'T':
+                need_temp = 0;
+                break;
+            default:
+                status = 1;
+        }
+    }
+    if (status || optind >= argc || optind + 2 < argc) {
+        fputs("Usage: hist-bench [ -a stride ] [ -b budget-ms ] [ -c cache-dir ] [ -j threads ] [ -m sensor-mask ] [ -n repeat ] [ -o days ] [ -q sketches ] [ -R ] [ -s source ] [ -T ] <start-time> [ <days> ]\n", stderr);
+        return 1;
+    }
+    start = strtol(argv[optind], NULL, 10);
+    if (optind + 1 < argc)
+        days = atoi(argv[optind + 1]);
+    end = start + days * 86400;
+    if ((step = (end - start) / 720) == 0)
+        step = 1;
+    step = bc_nearest_step(step);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < repeat; i++) {
+        if (hist_get_ranges(backend, start, end, step, sensors, need_temp, offsets, nranges, ranges) != HIST_SUCCESS) {
+            status = 2;
+            break;
+        }
+        total = mean_total(ranges[0]);
+        if (i == repeat - 1)
+            print_approx(ranges[0], stdout);
+        for (r = 0; r < nranges; r++)
+            hist_free(ranges[r]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%d days from %s x%d in %.3fs: %.1f ms per hist_get, mean total %.1f W\n",
+           days, backend->name, i, secs, secs * 1000 / (i ? i : 1), total);
+    print_io_stats(stdout);
+    return status;
+}
@@ -0,0 +1,378 @@
+/*
+ * hist-cache
+ *
+ * History buckets are cached in files of BC_CHUNK buckets each, named for
+ * the source, the bucket size and the chunk number, and mapped shared so
+ * a bucket stored by one process is seen by the others.  A bucket is
+ * marked valid only after its contents are written so readers need no
+ * lock; writers lock every file covering their range, in order, so
+ * concurrent requests for the same range compute it once.  A file made by
+ * a build with a different bucket layout is left alone.  A file in use is
+ * touched at most once every BC_TOUCH_SECS, and old files are looked for
+ * only when a new one is made.
+ */
+
+#include "cc-common.h"
+#include "hist-cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BC_CHUNK       1024
+#define BC_MAGIC       0x4b424343
+#define BC_VERSION     3
+#define BC_TOUCH_SECS  86400
+
+typedef union {
+    struct {
+        unsigned magic;
+        unsigned version;
+        unsigned rec_size;
+        long step;
+        long chunk;
+    } h;
+    char pad[64];
+} bc_header;
+
+typedef struct {
+    hist_sum total[RECV_SENSORS];
+    hist_mean min[RECV_SENSORS];
+    hist_mean max[RECV_SENSORS];
+    int count[RECV_SENSORS];
+    hist_sum temp_total;
+    int temp_count;
+    unsigned valid;
+} bc_record;
+
+typedef struct {
+    int fd;
+    bc_header *map;
+    bc_record *recs;
+} bc_chunk;
+
+struct _bucket_cache {
+    long first_chunk;
+    int nchunks;
+    bc_chunk chunks[];
+};
+
+#define CHUNK_SIZE (sizeof(bc_header) + BC_CHUNK * sizeof(bc_record))
+
+int bc_cached_step(time_t step)
+{
+    int shift;
+
+    for (shift = 0; shift <= BC_MAX_SHIFT; shift++)
+        if (step == (time_t) BC_BASE_STEP << shift)
+            return 1;
+    return 0;
+}
+
+time_t bc_nearest_step(time_t step)
+{
+    time_t lower, upper;
+    int shift;
+
+    if (step < BC_BASE_STEP || step > (time_t) BC_BASE_STEP << BC_MAX_SHIFT)
+        return step;
+    for (shift = 0; (upper = (time_t) BC_BASE_STEP << shift) < step; shift++);
+    if (shift > 0 && step * step < (lower = upper / 2) * upper)
+        return lower;
+    return upper;
+}
+
+/*
+ * Returns 1 having made a new file, 0 having opened an existing one, or
+ * -1 on failure, which is not logged when a file not to be made is not
+ * there.
+ */
+
+static int chunk_open(bc_chunk *ch, const char *dir, const char *source, time_t step, long chunk, int create)
+{
+    bc_header *hdr;
+    struct stat stb;
+    char file[PATH_MAX];
+
+    snprintf(file, sizeof file, "%s/%s-%ld-%ld", dir, source, (long) step, chunk);
+    if ((ch->fd = open(file, create ? O_RDWR | O_CREAT : O_RDWR, 0664)) >= 0) {
+        if (fstat(ch->fd, &stb) == 0) {
+            if (stb.st_size == 0 && ftruncate(ch->fd, CHUNK_SIZE))
+                log_syserr("unable to size cache file '%s'", file);
+            else if (stb.st_size != 0 && stb.st_size != CHUNK_SIZE)
+                log_msg("cache file '%s' has the wrong size", file);
+            else if ((hdr = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ch->fd, 0)) == MAP_FAILED)
+                log_syserr("unable to map cache file '%s'", file);
+            else {
+                if (hdr->h.magic == 0) {
+                    hdr->h.version = BC_VERSION;
+                    hdr->h.rec_size = sizeof(bc_record);
+                    hdr->h.step = step;
+                    hdr->h.chunk = chunk;
+                    __sync_synchronize();
+                    hdr->h.magic = BC_MAGIC;
+                }
+                if (hdr->h.magic == BC_MAGIC && hdr->h.version == BC_VERSION && hdr->h.rec_size == sizeof(bc_record)) {
+                    ch->map = hdr;
+                    ch->recs = (bc_record *) (hdr + 1);
+                    if (stb.st_size != 0 && stb.st_mtime < time(NULL) - BC_TOUCH_SECS)
+                        futimens(ch->fd, NULL);
+                    return stb.st_size == 0;
+                }
+                log_msg("cache file '%s' is from a different build", file);
+                munmap(hdr, CHUNK_SIZE);
+            }
+        }
+        else
+            log_syserr("unable to stat cache file '%s'", file);
+        close(ch->fd);
+    }
+    else if (create || errno != ENOENT)
+        log_syserr("unable to open cache file '%s'", file);
+    ch->fd = -1;
+    return -1;
+}
+
+static void chunk_close(bc_chunk *ch)
+{
+    if (ch->fd >= 0) {
+        munmap(ch->map, CHUNK_SIZE);
+        close(ch->fd);
+    }
+}
+
+static void expire_files(const char *dir)
+{
+    DIR *dp;
+    struct dirent *de;
+    struct stat stb;
+    char file[PATH_MAX];
+    time_t old;
+    int n = 0;
+
+    old = time(NULL) - BC_EXPIRE_SECS;
+    if ((dp = opendir(dir))) {
+        while ((de = readdir(dp))) {
+            if (de->d_name[0] == '.')
+                continue;
+            snprintf(file, sizeof file, "%s/%s", dir, de->d_name);
+            if (stat(file, &stb) == 0 && S_ISREG(stb.st_mode) && stb.st_mtime < old && unlink(file) == 0)
+                n++;
+        }
+        closedir(dp);
+        if (n)
+            log_msg("removed %d unused cache files", n);
+    }
+    else
+        log_syserr("unable to read cache directory '%s'", dir);
+}
+
+/*
+ * Only the files covering one of the ranges are opened, those between
+ * ranges far apart being left closed, as are those without a bucket
+ * ending by the time given as complete.
+ */
+
+static int chunk_wanted(long chunk, const long *firsts, int nranges, long count, time_t step, time_t complete)
+{
+    int r;
+
+    if ((chunk * BC_CHUNK + 1) * step > complete)
+        return 0;
+    for (r = 0; r < nranges; r++)
+        if (chunk >= firsts[r] / BC_CHUNK && chunk <= (firsts[r] + count - 1) / BC_CHUNK)
+            return 1;
+    return 0;
+}
+
+bucket_cache *bc_open(const char *dir, const char *source, time_t step, const long *firsts, int nranges, long count, time_t complete)
+{
+    bucket_cache *bc;
+    long first_chunk, last_chunk;
+    int nchunks, made = 0, rc, i;
+
+    if (mkdir(dir, 0775) && errno != EEXIST) {
+        log_syserr("unable to create cache directory '%s'", dir);
+        return NULL;
+    }
+    first_chunk = firsts[0] / BC_CHUNK;
+    last_chunk = (firsts[0] + count - 1) / BC_CHUNK;
+    for (i = 1; i < nranges; i++) {
+        if (firsts[i] / BC_CHUNK < first_chunk)
+            first_chunk = firsts[i] / BC_CHUNK;
+        if ((firsts[i] + count - 1) / BC_CHUNK > last_chunk)
+            last_chunk = (firsts[i] + count - 1) / BC_CHUNK;
+    }
+    nchunks = last_chunk - first_chunk + 1;
+    if ((bc = malloc(sizeof(bucket_cache) + nchunks * sizeof(bc_chunk)))) {
+        bc->first_chunk = first_chunk;
+        for (i = 0; i < nchunks; i++) {
+            if (!chunk_wanted(first_chunk + i, firsts, nranges, count, step, complete))
+                bc->chunks[i].fd = -1;
+            else if ((rc = chunk_open(bc->chunks + i, dir, source, step, first_chunk + i, 1)) < 0)
+                break;
+            else
+                made |= rc;
+        }
+        if ((bc->nchunks = i) == nchunks) {
+            if (made)
+                expire_files(dir);
+            return bc;
+        }
+        bc_close(bc);
+    }
+    else
+        log_syserr("unable to allocate bucket cache");
+    return NULL;
+}
+
+void bc_close(bucket_cache *bc)
+{
+    int i;
+
+    for (i = 0; i < bc->nchunks; i++)
+        chunk_close(bc->chunks + i);
+    free(bc);
+}
+
+int bc_lock(bucket_cache *bc)
+{
+    int i;
+
+    for (i = 0; i < bc->nchunks; i++) {
+        if (bc->chunks[i].fd >= 0 && flock(bc->chunks[i].fd, LOCK_EX)) {
+            log_syserr("unable to lock bucket cache");
+            while (--i >= 0)
+                if (bc->chunks[i].fd >= 0)
+                    flock(bc->chunks[i].fd, LOCK_UN);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void bc_unlock(bucket_cache *bc)
+{
+    int i;
+
+    for (i = bc->nchunks - 1; i >= 0; i--)
+        if (bc->chunks[i].fd >= 0)
+            flock(bc->chunks[i].fd, LOCK_UN);
+}
+
+static inline bc_record *bc_record_at(bucket_cache *bc, long index)
+{
+    bc_chunk *ch = bc->chunks + index / BC_CHUNK - bc->first_chunk;
+
+    return ch->fd >= 0 ? ch->recs + index % BC_CHUNK : NULL;
+}
+
+int bc_fetch(bucket_cache *bc, long index, hist_context *ctx, int point)
+{
+    bc_record *rec = bc_record_at(bc, index);
+    hist_series *ser;
+    int sens_num;
+
+    if (rec && rec->valid) {
+        __sync_synchronize();
+        for (sens_num = 0; sens_num < ctx->nsensors && sens_num < RECV_SENSORS; sens_num++) {
+            ser = ctx->sensors + sens_num;
+            if (ser->total) {
+                ser->total[point] = rec->total[sens_num];
+                ser->min[point] = rec->min[sens_num];
+                ser->max[point] = rec->max[sens_num];
+                ser->count[point] = rec->count[sens_num];
+            }
+        }
+        if (ctx->temp_total) {
+            ctx->temp_total[point] = rec->temp_total;
+            ctx->temp_count[point] = rec->temp_count;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Sensors the history has no arrays for are stored as having no samples.
+ * A bucket with samples of sensors beyond those a record has room for is
+ * not stored, so it is always read from the samples.
+ */
+
+void bc_store(bucket_cache *bc, long index, const hist_context *ctx, int point)
+{
+    bc_record *rec = bc_record_at(bc, index);
+    const hist_series *ser;
+    int sens_num;
+
+    if (rec == NULL)
+        return;
+    for (sens_num = RECV_SENSORS; sens_num < ctx->nsensors; sens_num++)
+        if (ctx->sensors[sens_num].total && ctx->sensors[sens_num].count[point])
+            return;
+    memset(rec, 0, offsetof(bc_record, valid));
+    for (sens_num = 0; sens_num < ctx->nsensors && sens_num < RECV_SENSORS; sens_num++) {
+        ser = ctx->sensors + sens_num;
+        if (ser->total) {
+            rec->total[sens_num] = ser->total[point];
+            rec->min[sens_num] = ser->min[point];
+            rec->max[sens_num] = ser->max[point];
+            rec->count[sens_num] = ser->count[point];
+        }
+    }
+    if (ctx->temp_total) {
+        rec->temp_total = ctx->temp_total[point];
+        rec->temp_count = ctx->temp_count[point];
+    }
+    __sync_synchronize();
+    rec->valid = 1;
+}
+
+/*
+ * Mark every cached bucket of the source overlapping the range as not
+ * valid, in the files there are, locking each as a writer would.
+ */
+
+void bc_invalidate(const char *dir, const char *source, time_t from, time_t to)
+{
+    bc_chunk ch;
+    time_t step;
+    long index, first, last, chunk;
+    int shift, n = 0;
+
+    if (to <= from)
+        return;
+    for (shift = 0; shift <= BC_MAX_SHIFT; shift++) {
+        step = (time_t) BC_BASE_STEP << shift;
+        last = (to - 1) / step;
+        for (chunk = from / step / BC_CHUNK; chunk <= last / BC_CHUNK; chunk++) {
+            if (chunk_open(&ch, dir, source, step, chunk, 0) == 0) {
+                if (flock(ch.fd, LOCK_EX) == 0) {
+                    first = from / step > chunk * BC_CHUNK ? from / step : chunk * BC_CHUNK;
+                    for (index = first; index <= last && index / BC_CHUNK == chunk; index++) {
+                        if (ch.recs[index % BC_CHUNK].valid) {
+                            ch.recs[index % BC_CHUNK].valid = 0;
+                            n++;
+                        }
+                    }
+                    flock(ch.fd, LOCK_UN);
+                }
+                else
+                    log_syserr("unable to lock bucket cache");
+                chunk_close(&ch);
+            }
+        }
+    }
+    if (n)
+        log_msg("invalidated %d cached %s buckets", n, source);
+}
@@ -0,0 +1,47 @@
+#ifndef HIST_CACHE_H
+#define HIST_CACHE_H
+
+#include "history.h"
+
+#include <time.h>
+
+/*
+ * A cache of history buckets on disk, keyed by the history source, the
+ * bucket size and the bucket's index on a grid of that size counted from
+ * the epoch.  It is shared between processes by mapping the files, and
+ * filling it is serialised by locking the files covering a request,
+ * which may be for several ranges of count buckets each.
+ * A bucket holds every sensor of a receiver and the temperature; fetching
+ * one copies just those the history has arrays for into its point.
+ *
+ * Only the steps of the tile levels, BC_BASE_STEP seconds shifted left
+ * by up to BC_MAX_SHIFT, are cached, and files are only made for buckets
+ * that end by the time given as complete.  Files not used for
+ * BC_EXPIRE_SECS are removed.  A program that changes the samples of past
+ * days invalidates the buckets covering them.
+ */
+
+#define BC_DIR          "hist-cache"
+#define BC_BASE_STEP    15
+#define BC_MAX_SHIFT    16
+#define BC_EXPIRE_SECS  (30 * 86400L)
+
+typedef struct _bucket_cache bucket_cache;
+
+extern int bc_cached_step(time_t step);
+
+/*
+ * The cached step nearest by ratio to the one given, for a caller free to
+ * pick its step, or the one given if it is outside the cached steps.
+ */
+
+extern time_t bc_nearest_step(time_t step);
+extern bucket_cache *bc_open(const char *dir, const char *source, time_t step, const long *firsts, int nranges, long count, time_t complete);
+extern void bc_close(bucket_cache *bc);
+extern int bc_lock(bucket_cache *bc);
+extern void bc_unlock(bucket_cache *bc);
+extern int bc_fetch(bucket_cache *bc, long index, hist_context *ctx, int point);
+extern void bc_store(bucket_cache *bc, long index, const hist_context *ctx, int point);
+extern void bc_invalidate(const char *dir, const char *source, time_t from, time_t to);
+
+#endif
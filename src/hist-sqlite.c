@@ -0,0 +1,124 @@
+/*
+ * hist-sqlite
+ *
+ * History backend reading the SQLite database built by xml2sqlite or the
+ * sqlite-logger.  The samples and pulses tables are each read with a range
+ * query on their time-ordered primary key and the two result streams are
+ * merged on time stamp, so the callbacks see samples in time order just as
+ * they would from the XML files.  With a budget the time is checked every
+ * SQL_CHECK_ROWS rows.  Every sample is read, so there is no sampling.
+ */
+
+#include "cc-common.h"
+#include "history.h"
+#include "sqlite-common.h"
+
+static const char samples_sql[] =
+    "SELECT time_stamp, temperature, sensor, watts, usecs FROM samples "
+    "WHERE time_stamp >= ?1 AND time_stamp < ?2 AND (?3 >> sensor) & 1 "
+    "ORDER BY time_stamp, usecs";
+
+static const char pulses_sql[] =
+    "SELECT time_stamp, temperature, sensor, count, ipu, usecs FROM pulses "
+    "WHERE time_stamp >= ?1 AND time_stamp < ?2 AND (?3 >> sensor) & 1 "
+    "ORDER BY time_stamp, usecs";
+
+#define SQL_CHECK_ROWS 1024
+
+static int bind_range(sqlite3_stmt *stmt, time_t start, time_t end, unsigned sensors)
+{
+    int rc;
+
+    if ((rc = sqlite3_bind_int64(stmt, 1, start)) == SQLITE_OK)
+        if ((rc = sqlite3_bind_int64(stmt, 2, end)) == SQLITE_OK)
+            rc = sqlite3_bind_int64(stmt, 3, sensors);
+    return rc;
+}
+
+static mf_status merge_rows(pf_context * pf, sqlite3 *db, sqlite3_stmt *smp_stmt, sqlite3_stmt *pls_stmt, hist_scan_info * info)
+{
+    mf_status status = MF_SUCCESS;
+    pf_sample smp;
+    int smp_rc, pls_rc, smp_next;
+    unsigned rows = 0;
+
+    smp_rc = sqlite3_step(smp_stmt);
+    pls_rc = sqlite3_step(pls_stmt);
+    while (status == MF_SUCCESS && (smp_rc == SQLITE_ROW || pls_rc == SQLITE_ROW)) {
+        smp_next = pls_rc != SQLITE_ROW || (smp_rc == SQLITE_ROW && sqlite3_column_int64(smp_stmt, 0) <= sqlite3_column_int64(pls_stmt, 0));
+        if (rows++ % SQL_CHECK_ROWS == 0 && hist_out_of_time(info)) {
+            info->read_to = sqlite3_column_int64(smp_next ? smp_stmt : pls_stmt, 0);
+            return MF_STOP;
+        }
+        if (smp_next) {
+            smp.timestamp = sqlite3_column_int64(smp_stmt, 0);
+            smp.usecs = sqlite3_column_int(smp_stmt, 4);
+            smp.temp = temp_from_double(sqlite3_column_double(smp_stmt, 1));
+            smp.sensor = sqlite3_column_int(smp_stmt, 2);
+            smp.data.watts = watts_from_double(sqlite3_column_double(smp_stmt, 3));
+            status = pf_deliver(pf, &smp);
+            smp_rc = sqlite3_step(smp_stmt);
+        }
+        else {
+            smp.timestamp = sqlite3_column_int64(pls_stmt, 0);
+            smp.usecs = sqlite3_column_int(pls_stmt, 5);
+            smp.temp = temp_from_double(sqlite3_column_double(pls_stmt, 1));
+            smp.sensor = sqlite3_column_int(pls_stmt, 2);
+            smp.data.pulse.count = sqlite3_column_int64(pls_stmt, 3);
+            smp.data.pulse.ipu = sqlite3_column_int(pls_stmt, 4);
+            status = pf->pulse_cb(pf, &smp);
+            pls_rc = sqlite3_step(pls_stmt);
+        }
+    }
+    if (status == MF_STOP)
+        status = MF_SUCCESS;
+    else if (status == MF_SUCCESS && (smp_rc != SQLITE_DONE || pls_rc != SQLITE_DONE)) {
+        log_sqlite_err(db, "unable to read history");
+        status = MF_FAIL;
+    }
+    return status;
+}
+
+/*
+ * The statements are prepared once and run again for each span.
+ */
+
+static mf_status sqlite_scan(pf_context * pf, const hist_span * spans, int nspans, unsigned sensors, hist_scan_info * info)
+{
+    mf_status status = MF_FAIL;
+    sqlite3 *db;
+    sqlite3_stmt *smp_stmt, *pls_stmt;
+    int i;
+
+    if (sqlite3_open_v2(sqlite_db_file, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK) {
+        if (sqlite3_prepare_v2(db, samples_sql, sizeof(samples_sql) - 1, &smp_stmt, NULL) == SQLITE_OK) {
+            if (sqlite3_prepare_v2(db, pulses_sql, sizeof(pulses_sql) - 1, &pls_stmt, NULL) == SQLITE_OK) {
+                for (status = MF_SUCCESS, i = 0; i < nspans && status == MF_SUCCESS; i++) {
+                    sqlite3_reset(smp_stmt);
+                    sqlite3_reset(pls_stmt);
+                    if (bind_range(smp_stmt, spans[i].start, spans[i].end, sensors) == SQLITE_OK
+                        && bind_range(pls_stmt, spans[i].start, spans[i].end, sensors) == SQLITE_OK)
+                        status = merge_rows(pf, db, smp_stmt, pls_stmt, info);
+                    else {
+                        log_sqlite_err(db, "unable to bind history range");
+                        status = MF_FAIL;
+                    }
+                }
+                if (status == MF_STOP)
+                    status = MF_SUCCESS;
+                sqlite3_finalize(pls_stmt);
+            }
+            else
+                log_sqlite_err(db, "unable to prepare pulse query");
+            sqlite3_finalize(smp_stmt);
+        }
+        else
+            log_sqlite_err(db, "unable to prepare sample query");
+    }
+    else
+        log_sqlite_err(db, "unable to open sqlite database '%s'", sqlite_db_file);
+    sqlite3_close(db);
+    return status;
+}
+
+const hist_backend hist_sqlite_backend = { HIST_SQLITE_NAME, sqlite_scan };
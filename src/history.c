@@ -1,249 +1,1305 @@
+#include "catalog.h"
 #include "cgi-main.h"
+#include "hist-cache.h"
 #include "history.h"
+#include "rollup.h"
 #include "parsefile.h"
+#include "pool.h"
 
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
-static void init_data(hist_context * ctx)
+static void hist_clear(hist_context * ctx)
 {
-    hist_point *point;
-    hist_sensor *sens, *sens_end;
+    hist_series *ser;
+    int sens_num;
 
-    for (point = ctx->data; point < ctx->end; point++) {
-        point->total = -1;
-        point->others = -1;
-        point->temp_total = 0;
-        point->temp_count = 0;
-        point->temp_mean = -1;
-        sens = point->sensors;
-        for (sens_end = sens + MAX_SENSOR; sens < sens_end; sens++) {
-            sens->mean = -1;
-            sens->total = 0;
-            sens->count = 0;
+    for (sens_num = 0; sens_num < ctx->nsensors; sens_num++) {
+        ser = ctx->sensors + sens_num;
+        if (ser->total) {
+            memset(ser->total, 0, ctx->points * sizeof(hist_sum));
+            memset(ser->count, 0, ctx->points * sizeof(int));
         }
+        if (ser->range)
+            memset(ser->range, 0, sizeof(sketch));
+        if (ser->sketches)
+            memset(ser->sketches, 0, ctx->points * sizeof(sketch));
+        ser->filled = 0;
+        ser->samples = ser->sum = ser->squares = 0;
+    }
+    if (ctx->temp_total) {
+        memset(ctx->temp_total, 0, ctx->points * sizeof(hist_sum));
+        memset(ctx->temp_count, 0, ctx->points * sizeof(int));
     }
-    memset(ctx->flags, 0, sizeof(ctx->flags));
+    memset(ctx->flags, 0, ctx->nsensors);
+    ctx->raw_points = 0;
+    ctx->sampled = 1;
+    ctx->read_to = ctx->end_ts;
 }
 
-static mf_status sample_cb(pf_context * pf, pf_sample * smp)
+/*
+ * A history and all its arrays are allocated as one block: the context,
+ * the series, then the arrays of sums, of means, of counts and of
+ * sketches, which keeps each kind aligned, and the flags last.
+ */
+
+static hist_context *hist_alloc(time_t start, time_t step, int points, unsigned sensors, int need_temp, int sketches)
 {
-    hist_context *ctx = pf->user_data;
-    hist_point *point;
-    hist_sensor *sens_ptr;
-    int sens_num;
+    hist_context *ctx;
+    hist_series *ser;
+    hist_sum *sums;
+    hist_mean *means;
+    int *counts;
+    sketch *sks;
+    int nsensors, nactive, sens_num, nsketches;
 
-    if (smp->timestamp >= ctx->start_ts && smp->timestamp < ctx->end_ts) {
-        point = ctx->data + ((smp->timestamp - ctx->start_ts) / ctx->step);
-        if (point < ctx->end) {
-            point->temp_total += smp->temp;
-            point->temp_count++;
-            sens_num = smp->sensor;
-            if (sens_num >= 0 && sens_num < MAX_SENSOR) {
-                sens_ptr = point->sensors + sens_num;
-                sens_ptr->total += smp->data.watts;
-                sens_ptr->count++;
-                ctx->flags[sens_num] = 'W';
-            }
+#if MAX_SENSOR < 32
+    sensors &= (1U << MAX_SENSOR) - 1;
+#endif
+    for (nsensors = nactive = 0; nsensors < 32 && sensors >> nsensors; nsensors++)
+        if (sensors & (1U << nsensors))
+            nactive++;
+    need_temp = need_temp != 0;
+    nsketches = sketches == 0 ? 0 : sketches == HIST_SKETCH_POINTS ? points + 1 : 1;
+    ctx = malloc(sizeof(hist_context) + nsensors * sizeof(hist_series)
+                 + (nactive + need_temp) * points * sizeof(hist_sum)
+                 + (nactive * 3 + 2 + need_temp) * points * sizeof(hist_mean)
+                 + (nactive + need_temp) * points * sizeof(int)
+                 + nactive * nsketches * sizeof(sketch) + nsensors);
+    if (ctx == NULL) {
+        log_syserr("unable to allocate space for history points");
+        return NULL;
+    }
+    ctx->start_ts = start;
+    ctx->step = step;
+    ctx->points = points;
+    ctx->end_ts = start + points * step;
+    ctx->mask = sensors;
+    ctx->nsensors = nsensors;
+    ctx->sketches = sketches;
+    ctx->sensors = (hist_series *) (ctx + 1);
+    sums = (hist_sum *) (ctx->sensors + nsensors);
+    means = (hist_mean *) (sums + (nactive + need_temp) * points);
+    counts = (int *) (means + (nactive * 3 + 2 + need_temp) * points);
+    sks = (sketch *) (counts + (nactive + need_temp) * points);
+    ctx->flags = (char *) (sks + nactive * nsketches);
+    for (sens_num = 0; sens_num < nsensors; sens_num++) {
+        ser = ctx->sensors + sens_num;
+        if (sensors & (1U << sens_num)) {
+            ser->total = sums;
+            sums += points;
+            ser->mean = means;
+            ser->min = means + points;
+            ser->max = means + 2 * points;
+            means += 3 * points;
+            ser->count = counts;
+            counts += points;
+            ser->range = nsketches ? sks : NULL;
+            ser->sketches = nsketches > 1 ? sks + 1 : NULL;
+            sks += nsketches;
         }
         else
-            log_msg("watt point with timestamp %lu is too big", smp->timestamp);
+            memset(ser, 0, sizeof(hist_series));
     }
-    return MF_SUCCESS;
+    ctx->total = means;
+    ctx->others = means + points;
+    means += 2 * points;
+    if (need_temp) {
+        ctx->temp_total = sums;
+        ctx->temp_mean = means;
+        ctx->temp_count = counts;
+    }
+    else {
+        ctx->temp_total = NULL;
+        ctx->temp_mean = NULL;
+        ctx->temp_count = NULL;
+    }
+    hist_clear(ctx);
+    return ctx;
 }
 
-static mf_status filter_cb_forw(pf_context * pf, time_t ts)
+/*
+ * Samples are added to the buckets of a history only where they fall in
+ * the part of it being filled, so one history can be filled piecemeal.
+ * The parts of all the histories wanted that need samples are gathered
+ * into a plan and filled in one scan, a sample going to every part it
+ * falls in.
+ */
+
+typedef struct {
+    hist_context *ctx;
+    time_t from;
+    time_t to;
+} hist_target;
+
+typedef struct {
+    hist_target *targets;
+    int count;
+    int size;
+    struct timespec deadline;
+} hist_plan;
+
+static void add_batch(const hist_target * tgt, const pf_batch * batch)
 {
-    hist_context *ctx = pf->user_data;
+    hist_context *ctx = tgt->ctx;
+    hist_series *ser;
+    hist_mean watts;
+    time_t ts;
+    unsigned i;
+    int sens_num, idx;
 
-    if (ts < ctx->start_ts)
-        return MF_IGNORE;
-    if (ts >= ctx->end_ts)
-        return MF_STOP;
+    for (i = 0; i < batch->count; i++) {
+        ts = batch->timestamp[i];
+        if (ts >= tgt->from && ts < tgt->to) {
+            sens_num = batch->sensor[i];
+            if (sens_num >= 0 && sens_num < ctx->nsensors && (ser = ctx->sensors + sens_num)->total) {
+                idx = (ts - ctx->start_ts) / ctx->step;
+                watts = batch->watts[i];
+                if (ser->count[idx]++ == 0) {
+                    ser->min[idx] = ser->max[idx] = watts;
+                    ser->filled++;
+                }
+                else if (watts < ser->min[idx])
+                    ser->min[idx] = watts;
+                else if (watts > ser->max[idx])
+                    ser->max[idx] = watts;
+                ser->total[idx] += watts;
+                ser->samples++;
+                ser->sum += watts;
+                ser->squares += (double) watts * watts;
+                if (ser->sketches)
+                    sk_add(ser->sketches + idx, batch->watts[i]);
+                else if (ser->range)
+                    sk_add(ser->range, batch->watts[i]);
+            }
+        }
+    }
+    if (ctx->temp_total) {
+        for (i = 0; i < batch->count; i++) {
+            ts = batch->timestamp[i];
+            if (ts >= tgt->from && ts < tgt->to) {
+                idx = (ts - ctx->start_ts) / ctx->step;
+                ctx->temp_total[idx] += batch->temp[i];
+                ctx->temp_count[idx]++;
+            }
+        }
+    }
+}
+
+static mf_status batch_cb(pf_context * pf, pf_batch * batch)
+{
+    hist_plan *plan = pf->user_data;
+    int i;
+
+    for (i = 0; i < plan->count; i++)
+        add_batch(plan->targets + i, batch);
     return MF_SUCCESS;
 }
 
-static mf_status filter_cb_back(pf_context * pf, time_t ts)
+#define PREFETCH_DAYS 2
+
+/*
+ * Start reading a later day's file into the page cache so it is there by
+ * the time the days before it have been parsed.  A day only partly in the
+ * range is left alone as only the pages its bisection touches are needed.
+ */
+
+static void prefetch_day(time_t ts, time_t end)
+{
+    struct tm tm;
+    char file[30];
+
+    if (ts + SECS_IN_DAY <= end) {
+        gmtime_r(&ts, &tm);
+        strftime(file, sizeof file, xml_file, &tm);
+        mf_prefetch(file);
+    }
+}
+
+/*
+ * Decide whether a day file is to be read in whole, in part, or not at
+ * all.  Where the catalog covers the day it says whether there is a file
+ * and whether it has any samples in the range for the sensors wanted,
+ * otherwise a day with no file is taken to have none.
+ */
+
+typedef enum {
+    DAY_SKIP,
+    DAY_PART,
+    DAY_WHOLE
+} day_plan;
+
+static day_plan plan_day(const cat_catalog *cat, time_t ts, const char *file, time_t start, time_t end, unsigned sensors)
+{
+    const cat_day *ent;
+    struct stat stb;
+
+    if (cat && cat_covers(cat, ts)) {
+        if ((ent = cat_find(cat, ts)) == NULL || ent->lines == 0 || !(ent->sensors & sensors) || ent->first >= end || ent->last < start)
+            return DAY_SKIP;
+        if (ent->first >= start && ent->last < end)
+            return DAY_WHOLE;
+        return DAY_PART;
+    }
+    if (stat(file, &stb) && errno == ENOENT)
+        return DAY_SKIP;
+    if (ts >= start && ts + SECS_IN_DAY <= end)
+        return DAY_WHOLE;
+    return DAY_PART;
+}
+
+/*
+ * Day files are in time order so where only part of a day is wanted the
+ * file is bisected for the start and end of the range rather than read
+ * through.  Days wanted whole are read straight through and, as every
+ * page of those is needed, paged in at once.
+ */
+
+typedef struct {
+    time_t day;
+    time_t start;               /* the part of the day wanted */
+    time_t end;
+    day_plan plan;
+    mf_status status;
+    char file[30];
+    tf_sampling sampling;
+    pf_sample first[MAX_SENSOR];        /* first pulse reading, sensor -1 if none */
+    prev_pulse_t last[MAX_SENSOR];      /* pulse state at the end of the day */
+} day_task;
+
+int hist_stride = 0;
+
+static mf_status parse_day(pf_context * pf, day_task * task)
+{
+    pf->start_ts = task->start;
+    pf->end_ts = task->end;
+    if (hist_stride > 1) {
+        log_msg("sample file '%s'", task->file);
+        return pf_sample_range(pf, task->file, hist_stride, &task->sampling);
+    }
+    if (task->plan == DAY_WHOLE) {
+        log_msg("read file '%s'", task->file);
+        return pf_parse_file_using(pf, task->file, MF_MAP_POPULATE);
+    }
+    log_msg("read part of file '%s'", task->file);
+    return pf_parse_range(pf, task->file);
+}
+
+static mf_status scan_serial(pf_context * pf, day_task * tasks, int ntasks, hist_scan_info * info)
 {
-    hist_context *ctx = pf->user_data;
+    day_task *task;
+    int i;
 
-    if (ts < ctx->start_ts)
-        return MF_STOP;
-    if (ts >= ctx->end_ts)
-        return MF_IGNORE;
+    for (i = 1; i < PREFETCH_DAYS && i < ntasks; i++)
+        prefetch_day(tasks[i].day, tasks[i].end);
+    for (task = tasks; task < tasks + ntasks; task++) {
+        if (hist_out_of_time(info)) {
+            info->read_to = task->start;
+            break;
+        }
+        if (task + PREFETCH_DAYS < tasks + ntasks)
+            prefetch_day(task[PREFETCH_DAYS].day, task[PREFETCH_DAYS].end);
+        if (parse_day(pf, task) == MF_FAIL)
+            return MF_FAIL;
+    }
     return MF_SUCCESS;
 }
 
-static inline int same_day(struct tm *a, struct tm *b)
+/*
+ * With more than one CPU the days are shared out between threads, each
+ * taking the next day not yet started and adding the samples into its
+ * own copy of the parts of the histories being filled.  These are summed
+ * into the caller's once all are done.
+ *
+ * A pulse reading only becomes a power sample given the one before it
+ * so a thread cannot convert the first reading of each sensor in a day.
+ * It keeps that reading and the pulse state at the end of the day so the
+ * first readings can be converted afterwards, in day order, just as they
+ * would have been had the days been read one after another.  Once out of
+ * time the threads start no more days, and the pulse state is lost over
+ * those not read.
+ */
+
+int hist_threads = 0;
+
+typedef struct {
+    day_task *tasks;
+    pool_queue queue;
+    const hist_scan_info *info;
+} scan_job;
+
+typedef struct {
+    hist_plan plan;             /* first, as batch_cb takes it from user_data */
+    pf_context *pf;
+    pf_batch *batch;
+    scan_job *job;
+    day_task *task;
+} hist_worker;
+
+static mf_status worker_pulse_cb(pf_context * pf, pf_sample * smp)
+{
+    hist_worker *w = pf->user_data;
+    int sens_num = smp->sensor;
+
+    if (sens_num >= 0 && sens_num < MAX_SENSOR && pf->prev_pulses[sens_num].count < 0)
+        w->task->first[sens_num] = *smp;
+    return pf_default_pulse_cb(pf, smp);
+}
+
+static void *scan_worker(void *arg)
+{
+    hist_worker *w = arg;
+    scan_job *job = w->job;
+    day_task *task;
+    prev_pulse_t *prev;
+    unsigned i;
+    int sens_num;
+
+    while ((i = pool_take(&job->queue)) < job->queue.count) {
+        task = w->task = job->tasks + i;
+        if (hist_out_of_time(job->info)) {
+            task->status = MF_STOP;
+            break;
+        }
+        for (sens_num = 0; sens_num < MAX_SENSOR; sens_num++) {
+            prev = w->pf->prev_pulses + sens_num;
+            prev->timestamp = 0;
+            prev->count = -1;
+            prev->ipu = 0;
+            task->first[sens_num].sensor = -1;
+        }
+        task->status = parse_day(w->pf, task);
+        memcpy(task->last, w->pf->prev_pulses, sizeof(task->last));
+    }
+    pf_flush(w->pf);
+    return NULL;
+}
+
+static void free_copies(hist_plan * plan)
+{
+    int i;
+
+    for (i = 0; i < plan->count; i++)
+        hist_free(plan->targets[i].ctx);
+    free(plan->targets);
+}
+
+static int worker_init(hist_worker * w, pf_context * pf, scan_job * job)
+{
+    const hist_plan *plan = pf->user_data;
+    const hist_target *tgt;
+    hist_target *copy;
+
+    w->job = job;
+    if ((w->plan.targets = malloc(plan->count * sizeof(hist_target))) == NULL) {
+        log_syserr("unable to allocate space for history targets");
+        return -1;
+    }
+    w->plan.size = plan->count;
+    for (w->plan.count = 0; w->plan.count < plan->count; w->plan.count++) {
+        tgt = plan->targets + w->plan.count;
+        copy = w->plan.targets + w->plan.count;
+        *copy = *tgt;
+        if ((copy->ctx = hist_alloc(tgt->from, tgt->ctx->step, (tgt->to - tgt->from) / tgt->ctx->step, tgt->ctx->mask,
+                                    tgt->ctx->temp_total != NULL, tgt->ctx->sketches)) == NULL)
+            break;
+    }
+    if (w->plan.count == plan->count) {
+        if ((w->batch = malloc(sizeof(pf_batch)))) {
+            if ((w->pf = pf_new())) {
+                w->batch->count = 0;
+                w->pf->file_cb = pf->file_cb;
+                w->pf->filter_cb = pf->filter_cb;
+                w->pf->pulse_cb = worker_pulse_cb;
+                w->pf->batch_cb = pf->batch_cb;
+                w->pf->batch = w->batch;
+                w->pf->user_data = w;
+                w->pf->sensors = pf->sensors;
+                w->pf->need_temp = pf->need_temp;
+                return 0;
+            }
+            free(w->batch);
+        }
+        else
+            log_syserr("unable to allocate space for sample batch");
+    }
+    free_copies(&w->plan);
+    return -1;
+}
+
+/*
+ * Add the samples in one bucket of a history into a bucket of another
+ * that has the same sensors or more.
+ */
+
+static void merge_bucket(hist_context * dst, int di, const hist_context * src, int si)
+{
+    const hist_series *from;
+    hist_series *to;
+    int sens_num;
+
+    for (sens_num = 0; sens_num < dst->nsensors; sens_num++) {
+        to = dst->sensors + sens_num;
+        from = src->sensors + sens_num;
+        if (to->total && from->count[si] > 0) {
+            if (to->count[di] == 0) {
+                to->min[di] = from->min[si];
+                to->max[di] = from->max[si];
+            }
+            else {
+                if (from->min[si] < to->min[di])
+                    to->min[di] = from->min[si];
+                if (from->max[si] > to->max[di])
+                    to->max[di] = from->max[si];
+            }
+            to->total[di] += from->total[si];
+            to->count[di] += from->count[si];
+            if (to->sketches && from->sketches)
+                sk_merge(to->sketches + di, from->sketches + si);
+        }
+    }
+    if (dst->temp_total) {
+        dst->temp_total[di] += src->temp_total[si];
+        dst->temp_count[di] += src->temp_count[si];
+    }
+}
+
+/*
+ * Add all the buckets of a history into those of another from the one
+ * given, a series at a time.
+ */
+
+static void merge_history(hist_context * ctx, int first, const hist_context * src)
 {
-    return a->tm_mday == b->tm_mday && a->tm_mon == b->tm_mon && a->tm_year == b->tm_year;
+    const hist_series *from;
+    hist_series *to;
+    hist_sum *total;
+    hist_mean *min, *max;
+    int *count;
+    int sens_num, i;
+
+    for (sens_num = 0; sens_num < ctx->nsensors; sens_num++) {
+        to = ctx->sensors + sens_num;
+        from = src->sensors + sens_num;
+        if (to->total) {
+            total = to->total + first;
+            count = to->count + first;
+            min = to->min + first;
+            max = to->max + first;
+            for (i = 0; i < src->points; i++) {
+                if (from->count[i] > 0) {
+                    if (count[i] == 0 || from->min[i] < min[i])
+                        min[i] = from->min[i];
+                    if (count[i] == 0 || from->max[i] > max[i])
+                        max[i] = from->max[i];
+                }
+            }
+            for (i = 0; i < src->points; i++) {
+                total[i] += from->total[i];
+                count[i] += from->count[i];
+            }
+            if (to->sketches && from->sketches)
+                for (i = 0; i < src->points; i++)
+                    sk_merge(to->sketches + first + i, from->sketches + i);
+            else if (to->range && from->range)
+                sk_merge(to->range, from->range);
+            to->filled += from->filled;
+            to->samples += from->samples;
+            to->sum += from->sum;
+            to->squares += from->squares;
+        }
+    }
+    if (ctx->temp_total) {
+        for (i = 0; i < src->points; i++) {
+            ctx->temp_total[first + i] += src->temp_total[i];
+            ctx->temp_count[first + i] += src->temp_count[i];
+        }
+    }
+    ctx->raw_points += src->raw_points;
+    if (src->sampled < ctx->sampled)
+        ctx->sampled = src->sampled;
+    if (hist_partial(src) && src->read_to < ctx->read_to)
+        ctx->read_to = src->read_to;
 }
 
-#define SECS_IN_DAY (24 * 60 * 60)
+static void worker_merge(hist_plan * plan, hist_worker * w)
+{
+    const hist_target *tgt;
+    int i;
 
-static mf_status fetch_data(hist_context * ctx)
+    for (i = 0; i < plan->count; i++) {
+        tgt = plan->targets + i;
+        merge_history(tgt->ctx, (tgt->from - tgt->ctx->start_ts) / tgt->ctx->step, w->plan.targets[i].ctx);
+    }
+}
+
+static void worker_free(hist_worker * w)
+{
+    pf_free(w->pf);
+    free(w->batch);
+    free_copies(&w->plan);
+}
+
+static mf_status scan_parallel(pf_context * pf, day_task * tasks, int ntasks, int nthreads, hist_scan_info * info)
+{
+    mf_status status = MF_SUCCESS;
+    hist_worker workers[POOL_MAX_THREADS];
+    scan_job job;
+    day_task *task;
+    int ready, run, i, sens_num;
+
+    job.tasks = tasks;
+    job.queue.count = ntasks;
+    job.queue.next = 0;
+    job.info = info;
+    for (ready = 0; ready < nthreads; ready++)
+        if (worker_init(workers + ready, pf, &job))
+            break;
+    run = ready > 0 ? pool_run(scan_worker, workers, sizeof(hist_worker), ready) : 0;
+    for (i = 0; i < ready; i++) {
+        if (i < run)
+            worker_merge(pf->user_data, workers + i);
+        worker_free(workers + i);
+    }
+    if (run == 0)
+        return MF_FAIL;
+    for (i = job.queue.next; i < ntasks; i++)
+        tasks[i].status = MF_STOP;
+    for (task = tasks; task < tasks + ntasks && status != MF_FAIL; task++) {
+        if (task->status == MF_STOP) {
+            if (task->start < info->read_to)
+                info->read_to = task->start;
+            for (sens_num = 0; sens_num < MAX_SENSOR; sens_num++)
+                pf->prev_pulses[sens_num].count = -1;
+        }
+        else if ((status = task->status) != MF_FAIL) {
+            for (sens_num = 0; sens_num < MAX_SENSOR && status != MF_FAIL; sens_num++)
+                if (task->first[sens_num].sensor >= 0)
+                    status = pf->pulse_cb(pf, task->first + sens_num);
+            for (sens_num = 0; sens_num < MAX_SENSOR; sens_num++)
+                if (task->last[sens_num].count >= 0)
+                    pf->prev_pulses[sens_num] = task->last[sens_num];
+        }
+    }
+    return status;
+}
+
+/*
+ * A day file needed by more than one span is read once for the part of
+ * the day from the start of the first span in it to the end of the last.
+ */
+
+static mf_status xml_scan(pf_context * pf, const hist_span * spans, int nspans, unsigned sensors, hist_scan_info * info)
 {
     mf_status status = MF_FAIL;
-    pf_context *pf;
-    time_t now, ts;
-    struct tm tm_now, tm_ts;
-    int mid;
-    char file[30];
+    cat_catalog *cat;
+    day_task *tasks, *task;
+    const hist_span *span;
+    tf_sampling sampling;
+    time_t ts, day;
+    struct tm tm_ts;
+    int ntasks, nthreads, n;
 
-    if ((pf = pf_new())) {
-        pf->filter_cb = filter_cb_forw;
-        pf->sample_cb = sample_cb;
-        pf->user_data = ctx;
-        time(&now);
-        gmtime_r(&now, &tm_now);
-        gmtime_r(&ctx->start_ts, &tm_ts);
-        mid = 12;
-        if (same_day(&tm_now, &tm_ts))
-            mid = tm_now.tm_hour / 2;
-        if (tm_ts.tm_hour > mid) {
-            pf->file_cb = tf_parse_cb_backward;
-            pf->filter_cb = filter_cb_back;
-            log_msg("initial file to be read backwards");
-        }
-        strftime(file, sizeof file, xml_file, &tm_ts);
-        log_msg("read file '%s'", file);
-        if (pf_parse_file(pf, file) != MF_FAIL) {
-            pf->file_cb = tf_parse_cb_forward;
-            pf->filter_cb = filter_cb_forw;
-            status = MF_SUCCESS;
-            ts = ctx->start_ts;
-            ts += SECS_IN_DAY - (ts % SECS_IN_DAY);
-            for (; ts < ctx->end_ts; ts += SECS_IN_DAY) {
-                gmtime_r(&ts, &tm_ts);
-                strftime(file, sizeof file, xml_file, &tm_ts);
-                log_msg("read file '%s'", file);
-                if (pf_parse_file(pf, file) == MF_FAIL) {
-                    status = MF_FAIL;
-                    break;
+    pf->file_cb = tf_parse_cb_forward;
+    pf->filter_cb = pf_filter_range_forw;
+    ntasks = 0;
+    for (span = spans; span < spans + nspans; span++)
+        ntasks += (span->end - 1) / SECS_IN_DAY - span->start / SECS_IN_DAY + 1;
+    if ((tasks = malloc(ntasks * sizeof(day_task)))) {
+        ntasks = 0;
+        for (span = spans; span < spans + nspans; span++) {
+            for (ts = span->start; ts < span->end; ts = day + SECS_IN_DAY) {
+                day = ts - ts % SECS_IN_DAY;
+                if (ntasks > 0 && tasks[ntasks - 1].day == day)
+                    task = tasks + ntasks - 1;
+                else {
+                    task = tasks + ntasks++;
+                    task->day = day;
+                    task->start = ts;
+                    task->sampling.range = task->sampling.taken = 0;
                 }
+                task->end = span->end < day + SECS_IN_DAY ? span->end : day + SECS_IN_DAY;
             }
         }
-        pf_free(pf);
+        cat = cat_load();
+        for (task = tasks, n = 0; task < tasks + ntasks; task++) {
+            gmtime_r(&task->day, &tm_ts);
+            strftime(task->file, sizeof(task->file), xml_file, &tm_ts);
+            if ((task->plan = plan_day(cat, task->day, task->file, task->start, task->end, sensors)) == DAY_SKIP)
+                log_msg("no data in file '%s'", task->file);
+            else {
+                task->status = MF_SUCCESS;
+                tasks[n++] = *task;
+            }
+        }
+        cat_free(cat);
+        ntasks = n;
+        if ((nthreads = pool_size(hist_threads, ntasks)) > 1)
+            status = scan_parallel(pf, tasks, ntasks, nthreads, info);
+        else
+            status = scan_serial(pf, tasks, ntasks, info);
+        sampling.range = sampling.taken = 0;
+        for (task = tasks; task < tasks + ntasks; task++) {
+            sampling.range += task->sampling.range;
+            sampling.taken += task->sampling.taken;
+        }
+        if (sampling.taken < sampling.range)
+            info->sampled = (double) sampling.taken / sampling.range;
+        free(tasks);
     }
+    else
+        log_syserr("unable to allocate space for day list");
     return status;
 }
 
+const hist_backend hist_xml_backend = { HIST_XML_NAME, xml_scan };
+
+#ifndef HIST_BACKEND
+#define HIST_BACKEND hist_xml_backend
+#endif
+
+const hist_backend *hist_default_backend = &HIST_BACKEND;
+
+const hist_backend *hist_find_backend(const char *name)
+{
+    if (strcmp(name, hist_xml_backend.name) == 0)
+        return &hist_xml_backend;
+    if (strcmp(name, hist_sqlite_backend.name) == 0)
+        return &hist_sqlite_backend;
+    return NULL;
+}
+
+#ifdef FIXED_POINT
+static inline hist_mean hist_div(hist_sum sum, int count)
+{
+    return (sum >= 0 ? sum + count / 2 : sum - count / 2) / count;
+}
+#else
+#define hist_div(sum, count) ((sum) / (count))
+#endif
+
+/*
+ * Work out the means, then the total and others series from them, a
+ * series at a time so each loop runs along contiguous arrays.  A sensor
+ * with no series counts as having no samples.
+ */
+
 static void crunch_data(hist_context * ctx)
 {
-    hist_point *point;
-    hist_sensor *sens;
-    int sens_num;
-    double apps, total, value;
+    hist_series *ser;
+    hist_mean *none = NULL;
+    const hist_mean *mean[MAX_SENSOR];
+    cc_real apps, total;
+    int n = ctx->points, sens_num, i;
 
-    for (point = ctx->data; point < ctx->end; point++) {
-        apps = 0.0;
-        for (sens_num = 0; sens_num < MAX_SENSOR; sens_num++) {
-            sens = point->sensors + sens_num;
-            value = -1;
-            if (sens->count > 0)
-                value = sens->total / sens->count;
-            sens->mean = value;
-            if (sens_num >= 1 && sens_num <= 5) // if applicance monitor.
-                apps += value;
+    for (sens_num = 0; sens_num < MAX_SENSOR; sens_num++) {
+        if (sens_num < ctx->nsensors && (ser = ctx->sensors + sens_num)->total) {
+            for (i = 0; i < n; i++)
+                ser->mean[i] = ser->count[i] > 0 ? hist_div(ser->total[i], ser->count[i]) : -1;
+            mean[sens_num] = ser->mean;
+        }
+        else {
+            if (none == NULL) {
+                if ((none = malloc(n * sizeof(hist_mean))) == NULL) {
+                    log_syserr("unable to allocate space for history points");
+                    return;
+                }
+                for (i = 0; i < n; i++)
+                    none[i] = -1;
+            }
+            mean[sens_num] = none;
         }
-        if (point->sensors[9].mean > 0) {
-            // As the import meter is showing a reading this means the total
-            // consumption is more than the solar panels are generating so
-            // it is sum of the solar generation meter and the import meter
+    }
+    for (i = 0; i < n; i++) {
+        total = mean[SENSOR_SOLAR][i] + grid_power(mean[SENSOR_IMPORT][i], mean[SENSOR_CLAMP][i]);
+        apps = 0;
+        for (sens_num = 1; sens_num <= 5; sens_num++)  // applicance monitors.
+            apps += mean[sens_num][i];
+        ctx->total[i] = total;
+        ctx->others[i] = total - apps;
+    }
+    if (ctx->temp_total)
+        for (i = 0; i < n; i++)
+            ctx->temp_mean[i] = ctx->temp_count[i] > 0 ? hist_div(ctx->temp_total[i], ctx->temp_count[i]) : -1;
+    free(none);
+}
+
+static void set_flags(hist_context * ctx)
+{
+    hist_series *ser;
+    int sens_num, i;
 
-            total = point->sensors[8].mean + point->sensors[9].mean;
+    for (sens_num = 0; sens_num < ctx->nsensors; sens_num++) {
+        ser = ctx->sensors + sens_num;
+        if (ser->total) {
+            for (i = 0; i < ctx->points && ser->count[i] == 0; i++);
+            if (i < ctx->points)
+                ctx->flags[sens_num] = 'W';
         }
-        else {
-            // The import meter is at zero which means some of the energy
-            // from the solar panels is being exported.  In this case the
-            // consumption in the house is the solar generation meter less
-            // the clamp sensor, which in this case is works as an export meter
+    }
+}
+
+/*
+ * Plan to add the samples for count buckets from the one given into the
+ * history.  Reading starts a few minutes early so the pulse counters have
+ * a reading to work from at the start, which means the contents of a
+ * bucket do not depend on where the range it was computed for began.
+ */
+
+#define HIST_LEAD_SECS 300
 
-            total = point->sensors[8].mean - point->sensors[0].mean;
+static mf_status plan_raw(hist_plan * plan, hist_context * ctx, int first, int count)
+{
+    hist_target *tgt;
+
+    if (plan->count == plan->size) {
+        if ((tgt = realloc(plan->targets, (plan->size + 16) * sizeof(hist_target))) == NULL) {
+            log_syserr("unable to allocate space for history targets");
+            return MF_FAIL;
         }
-        point->total = total;
-        point->others = total - apps;
-        if (point->temp_count > 0)
-            point->temp_mean = point->temp_total / point->temp_count;
+        plan->targets = tgt;
+        plan->size += 16;
     }
+    tgt = plan->targets + plan->count++;
+    tgt->ctx = ctx;
+    tgt->from = ctx->start_ts + first * ctx->step;
+    tgt->to = tgt->from + count * ctx->step;
+    ctx->raw_points += count;
+    return MF_SUCCESS;
 }
 
-hist_context *hist_get(time_t from, time_t to, int step)
+static int span_cmp(const void *a, const void *b)
 {
+    const hist_span *x = a, *y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/*
+ * Read the samples for all the parts planned, as few spans as cover them,
+ * then note in each history how much of its part was read.
+ */
+
+static void note_scan(hist_plan * plan, const hist_scan_info * info)
+{
+    const hist_target *tgt;
     hist_context *ctx;
-    int points;
-
-    if ((ctx = malloc(sizeof(hist_context)))) {
-        ctx->start_ts = from;
-        ctx->end_ts = to;
-        ctx->step = step;
-        points = (to - from) / step + 1;
-        if ((ctx->data = malloc(points * sizeof(hist_point)))) {
-            ctx->end = ctx->data + points;
-            init_data(ctx);
-            if (fetch_data(ctx) == MF_SUCCESS) {
-                crunch_data(ctx);
-                return ctx;
-            }
+    int i;
+
+    for (i = 0; i < plan->count; i++) {
+        tgt = plan->targets + i;
+        ctx = tgt->ctx;
+        if (info->sampled < ctx->sampled)
+            ctx->sampled = info->sampled;
+        if (info->read_to < tgt->to && info->read_to < ctx->read_to)
+            ctx->read_to = info->read_to > tgt->from ? info->read_to : tgt->from;
+    }
+}
+
+static mf_status scan_plan(const hist_backend *backend, hist_plan * plan)
+{
+    mf_status status = MF_FAIL;
+    hist_span *spans;
+    hist_scan_info info;
+    pf_context *pf;
+    pf_batch *batch;
+    unsigned sensors = 0;
+    int need_temp = 0, nspans, i;
+
+    if (plan->count == 0)
+        return MF_SUCCESS;
+    if ((spans = malloc(plan->count * sizeof(hist_span))) == NULL) {
+        log_syserr("unable to allocate space for history spans");
+        return MF_FAIL;
+    }
+    for (i = 0; i < plan->count; i++) {
+        spans[i].start = plan->targets[i].from - HIST_LEAD_SECS;
+        spans[i].end = plan->targets[i].to;
+        sensors |= plan->targets[i].ctx->mask;
+        need_temp |= plan->targets[i].ctx->temp_total != NULL;
+    }
+    qsort(spans, plan->count, sizeof(hist_span), span_cmp);
+    for (nspans = 0, i = 1; i < plan->count; i++) {
+        if (spans[i].start <= spans[nspans].end) {
+            if (spans[i].end > spans[nspans].end)
+                spans[nspans].end = spans[i].end;
         }
         else
-            log_syserr("unable to allocate space for history points");
-        free(ctx);
+            spans[++nspans] = spans[i];
+    }
+    nspans++;
+    if ((batch = malloc(sizeof(pf_batch)))) {
+        if ((pf = pf_new())) {
+            batch->count = 0;
+            pf->batch = batch;
+            pf->batch_cb = batch_cb;
+            pf->user_data = plan;
+            pf->sensors = sensors;
+            pf->need_temp = need_temp;
+            info.deadline = plan->deadline;
+            info.sampled = 1;
+            info.read_to = spans[nspans - 1].end;
+            if ((status = backend->scan(pf, spans, nspans, sensors, &info)) == MF_SUCCESS && (status = pf_flush(pf)) == MF_SUCCESS)
+                note_scan(plan, &info);
+            pf_free(pf);
+        }
+        free(batch);
     }
     else
-        log_syserr("unable to allocate space for history context");
+        log_syserr("unable to allocate space for sample batch");
+    free(spans);
+    plan->count = 0;
+    return status;
+}
+
+/*
+ * Where the day files have been rolled up, buckets are filled from the
+ * coarsest rollup whose records either fit the buckets exactly or are
+ * small enough that there are several to a bucket, a record that spans
+ * two buckets going in the one it starts in.  Buckets not wholly covered
+ * by rollups, such as those for today, or with samples of wanted sensors
+ * the rollups do not keep are read from the samples.
+ */
+
+#define HIST_RU_SPREAD 8
+
+int hist_rollups = 1;
+
+static time_t rollup_res(time_t step)
+{
+    time_t res;
+    int i;
+
+    for (i = RU_LEVELS - 1; i >= 0; i--) {
+        res = ru_resolutions[i];
+        if (step % res == 0 || step >= res * HIST_RU_SPREAD)
+            return res;
+    }
+    return 0;
+}
+
+static void add_records(hist_context * ctx, int idx, const ru_record * rec, unsigned count)
+{
+    const ru_value *val;
+    hist_series *ser;
+    int sens_num;
+
+    for (; count > 0; count--, rec++) {
+        for (sens_num = 0; sens_num < ctx->nsensors && sens_num < RECV_SENSORS; sens_num++) {
+            ser = ctx->sensors + sens_num;
+            val = rec->sensors + sens_num;
+            if (ser->total && val->count > 0) {
+                if (ser->count[idx] == 0) {
+                    ser->min[idx] = val->min;
+                    ser->max[idx] = val->max;
+                }
+                else {
+                    if (val->min < ser->min[idx])
+                        ser->min[idx] = val->min;
+                    if (val->max > ser->max[idx])
+                        ser->max[idx] = val->max;
+                }
+                ser->total[idx] += val->sum;
+                ser->count[idx] += val->count;
+            }
+        }
+        if (ctx->temp_total) {
+            ctx->temp_total[idx] += rec->temp.sum;
+            ctx->temp_count[idx] += rec->temp.count;
+        }
+    }
+}
+
+static mf_status scan_rollup(hist_plan * plan, hist_context * ctx, int first, int count, time_t res)
+{
+    mf_status status = MF_SUCCESS;
+    ru_reader *rr;
+    ru_record *recs;
+    time_t start, step = ctx->step, rec_first, next;
+    unsigned n, j;
+    int i, miss = -1, rolled = 0;
+
+    if ((recs = malloc((step / res + 1) * sizeof(ru_record))) == NULL) {
+        log_syserr("unable to allocate space for rollup records");
+        return MF_FAIL;
+    }
+    if ((rr = ru_open(res))) {
+        start = ctx->start_ts + first * step;
+        next = (start + res - 1) / res * res;
+        for (i = 0; i <= count && status == MF_SUCCESS; i++) {
+            if (i < count) {
+                rec_first = next;
+                next = (start + (i + 1) * step + res - 1) / res * res;
+                n = (next - rec_first) / res;
+                if (ru_read(rr, rec_first, n, recs) == 0) {
+                    for (j = 0; j < n && recs[j].done && !(recs[j].beyond & ctx->mask); j++);
+                    if (j == n) {
+                        add_records(ctx, first + i, recs, n);
+                        rolled++;
+                    }
+                }
+                else
+                    j = 0;
+                if (j < n) {
+                    if (miss < 0)
+                        miss = i;
+                    continue;
+                }
+            }
+            if (miss >= 0) {
+                status = plan_raw(plan, ctx, first + miss, i - miss);
+                miss = -1;
+            }
+        }
+        ru_close(rr);
+        log_msg("%d of %d buckets from %ld second rollups", rolled, count, (long) res);
+    }
+    else
+        status = plan_raw(plan, ctx, first, count);
+    free(recs);
+    return status;
+}
+
+static mf_status scan_buckets(const hist_backend *backend, hist_plan * plan, hist_context * ctx, int first, int count)
+{
+    time_t res;
+
+    if (hist_rollups && !ctx->sketches && backend == &hist_xml_backend && (res = rollup_res(ctx->step)))
+        return scan_rollup(plan, ctx, first, count, res);
+    return plan_raw(plan, ctx, first, count);
+}
+
+static mf_status scan_all(const hist_backend *backend, hist_plan * plan, hist_context ** ctxs, int nranges)
+{
+    mf_status status = MF_SUCCESS;
+    int i;
+
+    for (i = 0; i < nranges && status == MF_SUCCESS; i++)
+        status = scan_buckets(backend, plan, ctxs[i], 0, ctxs[i]->points);
+    if (status == MF_SUCCESS)
+        status = scan_plan(backend, plan);
+    return status;
+}
+
+/*
+ * Take what buckets there are from the cache and compute the rest, for
+ * the steps the cache keeps.  The
+ * cache is locked and looked at again before computing anything so a
+ * request for the same range made at the same time waits for this one
+ * and uses its results.  Missing buckets are computed for all sensors and
+ * the temperature so they suit any later request, and only those that
+ * ended at least HIST_COMPLETE_SECS ago are stored as later ones may yet
+ * have samples added.  Nor are those that were sampled or not read before
+ * the budget ran out.
+ */
+
+#define HIST_COMPLETE_SECS 120
+
+const char *hist_cache_dir = NULL;
+
+typedef struct {
+    hist_context *full;         /* all sensors, to be stored */
+    hist_context *ctx;
+    int first;
+} hist_fill;
+
+static void store_fill(bucket_cache * bc, hist_fill * fill, time_t complete)
+{
+    hist_context *full = fill->full;
+    long index = full->start_ts / full->step;
+    int i;
+
+    if (full->read_to < complete)
+        complete = full->read_to;
+    for (i = 0; full->sampled == 1 && i < full->points && full->start_ts + (i + 1) * full->step <= complete; i++)
+        bc_store(bc, index + i, full, i);
+    merge_history(fill->ctx, fill->first, full);
+}
+
+static mf_status cached_buckets(bucket_cache * bc, const hist_backend *backend, hist_plan * plan, hist_context ** ctxs, int nranges, time_t complete)
+{
+    mf_status status = MF_SUCCESS;
+    hist_context *ctx;
+    hist_fill *fills, *fill;
+    long first;
+    int points = ctxs[0]->points, hits = 0, nfills = 0, r, i, j;
+
+    for (r = 0; r < nranges; r++)
+        for (first = ctxs[r]->start_ts / ctxs[r]->step, i = 0; i < points; i++)
+            hits += bc_fetch(bc, first + i, ctxs[r], i);
+    log_msg("%d of %d buckets from cache", hits, points * nranges);
+    if (hits == points * nranges)
+        return MF_SUCCESS;
+    if (bc_lock(bc)) {
+        for (r = 0; r < nranges; r++)
+            hist_clear(ctxs[r]);
+        return scan_all(backend, plan, ctxs, nranges);
+    }
+    if ((fills = malloc(nranges * ((points + 1) / 2) * sizeof(hist_fill)))) {
+        for (r = 0; r < nranges && status == MF_SUCCESS; r++) {
+            ctx = ctxs[r];
+            first = ctx->start_ts / ctx->step;
+            for (i = 0; i < points && status == MF_SUCCESS; i = j) {
+                j = i + 1;
+                if (!bc_fetch(bc, first + i, ctx, i)) {
+                    while (j < points && !bc_fetch(bc, first + j, ctx, j))
+                        j++;
+                    if (ctx->start_ts + (i + 1) * ctx->step > complete)
+                        status = scan_buckets(backend, plan, ctx, i, j - i);
+                    else {
+                        fill = fills + nfills;
+                        if ((fill->full = hist_alloc(ctx->start_ts + i * ctx->step, ctx->step, j - i, ~0U, 1, 0))) {
+                            fill->ctx = ctx;
+                            fill->first = i;
+                            nfills++;
+                            status = scan_buckets(backend, plan, fill->full, 0, j - i);
+                        }
+                        else
+                            status = MF_FAIL;
+                    }
+                }
+            }
+        }
+        if (status == MF_SUCCESS)
+            status = scan_plan(backend, plan);
+        for (fill = fills; fill < fills + nfills; fill++) {
+            if (status == MF_SUCCESS)
+                store_fill(bc, fill, complete);
+            hist_free(fill->full);
+        }
+        free(fills);
+    }
+    else {
+        log_syserr("unable to allocate space for cache fills");
+        status = MF_FAIL;
+    }
+    bc_unlock(bc);
+    return status;
+}
+
+/*
+ * With a sketch for each point that for the whole range is their sum.
+ */
+
+static void sum_sketches(hist_context * ctx)
+{
+    hist_series *ser;
+    int sens_num, i;
+
+    for (sens_num = 0; sens_num < ctx->nsensors; sens_num++) {
+        ser = ctx->sensors + sens_num;
+        if (ser->sketches)
+            for (i = 0; i < ctx->points; i++)
+                sk_merge(ser->range, ser->sketches + i);
+    }
+}
+
+int hist_sketches = 0;
+int hist_budget_ms = 0;
+
+int hist_out_of_time(const hist_scan_info * info)
+{
+    struct timespec now;
+
+    if (info->deadline.tv_sec == 0 && info->deadline.tv_nsec == 0)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > info->deadline.tv_sec || (now.tv_sec == info->deadline.tv_sec && now.tv_nsec >= info->deadline.tv_nsec);
+}
+
+/*
+ * Buckets lie on a grid of the step from the epoch, rather than starting
+ * at the beginning of the range, so they are the same buckets whichever
+ * range they are wanted for.
+ */
+
+hist_status hist_get_ranges(const hist_backend *backend, time_t from, time_t to, int step, unsigned sensors, int need_temp,
+                            const time_t *offsets, int nranges, hist_context **ctxs)
+{
+    mf_status status = MF_FAIL;
+    hist_plan plan;
+    bucket_cache *bc;
+    long firsts[HIST_MAX_RANGES];
+    time_t start, complete;
+    int points, r;
+
+    if (nranges < 1 || nranges > HIST_MAX_RANGES) {
+        log_msg("from 1 to %d ranges may be fetched at once", HIST_MAX_RANGES);
+        return HIST_FAIL;
+    }
+    start = from - from % step;
+    points = (to - start + step - 1) / step;
+    for (r = 0; r < nranges; r++) {
+        if ((ctxs[r] = hist_alloc(start + offsets[r] / step * step, step, points, sensors, need_temp, hist_sketches)) == NULL)
+            break;
+        firsts[r] = ctxs[r]->start_ts / step;
+    }
+    if (r == nranges) {
+        plan.targets = NULL;
+        plan.count = plan.size = 0;
+        memset(&plan.deadline, 0, sizeof(plan.deadline));
+        if (hist_budget_ms > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &plan.deadline);
+            plan.deadline.tv_sec += hist_budget_ms / 1000;
+            if ((plan.deadline.tv_nsec += hist_budget_ms % 1000 * 1000000L) >= 1000000000L) {
+                plan.deadline.tv_sec++;
+                plan.deadline.tv_nsec -= 1000000000L;
+            }
+        }
+        complete = time(NULL) - HIST_COMPLETE_SECS;
+        if (hist_cache_dir && !hist_sketches && bc_cached_step(step)
+            && (bc = bc_open(hist_cache_dir, backend->name, step, firsts, nranges, points, complete))) {
+            status = cached_buckets(bc, backend, &plan, ctxs, nranges, complete);
+            bc_close(bc);
+        }
+        else
+            status = scan_all(backend, &plan, ctxs, nranges);
+        free(plan.targets);
+        if (status == MF_SUCCESS) {
+            for (r = 0; r < nranges; r++) {
+                set_flags(ctxs[r]);
+                crunch_data(ctxs[r]);
+                sum_sketches(ctxs[r]);
+            }
+            return HIST_SUCCESS;
+        }
+    }
+    while (--r >= 0)
+        hist_free(ctxs[r]);
+    return HIST_FAIL;
+}
+
+hist_context *hist_get(const hist_backend *backend, time_t from, time_t to, int step, unsigned sensors, int need_temp)
+{
+    hist_context *ctx;
+    time_t offset = 0;
+
+    if (hist_get_ranges(backend, from, to, step, sensors, need_temp, &offset, 1, &ctx) == HIST_SUCCESS)
+        return ctx;
     return NULL;
 }
 
 void hist_free(hist_context * ctx)
 {
-    free(ctx->data);
     free(ctx);
 }
 
-void hist_js_temp_out(hist_context * ctx, FILE * fp)
+/*
+ * Pick one value in every group of factor by the area of the triangle it
+ * makes with the value picked in the group before and the mean of the
+ * group after, which favours the peaks and troughs.  A value below zero,
+ * meaning none, is taken to be the one before it as it is when output.
+ */
+
+static void lttb_series(const hist_mean * src, hist_mean * dst, int n, int factor, double *y, int *pick)
 {
-    hist_point *point;
-    double cur_value = 0.0, new_value;
-    int ch = '[';
+    int groups = (n + factor - 1) / factor;
+    int g, i, lo, hi, nhi, best;
+    double cur = 0.0, ax, ay, cx, cy, area, max_area;
 
-    for (point = ctx->data; point < ctx->end; point++) {
-        if ((new_value = point->temp_mean) >= 0)
-            cur_value = new_value;
-        fprintf(fp, "%c%.3g", ch, cur_value);
-        ch = ',';
+    for (i = 0; i < n; i++) {
+        if (src[i] >= 0)
+            cur = src[i];
+        y[i] = cur;
     }
-    putc(']', fp);
+    pick[0] = 0;
+    for (g = 1; g < groups; g++) {
+        ax = pick[g - 1];
+        ay = y[pick[g - 1]];
+        lo = g * factor;
+        if ((hi = lo + factor) > n)
+            hi = n;
+        if ((nhi = hi + factor) > n)
+            nhi = n;
+        if (hi < nhi) {
+            cx = (hi + nhi - 1) / 2.0;
+            for (cy = 0.0, i = hi; i < nhi; i++)
+                cy += y[i];
+            cy /= nhi - hi;
+        }
+        else {
+            cx = hi - 1;
+            cy = y[hi - 1];
+        }
+        best = lo;
+        max_area = -1.0;
+        for (i = lo; i < hi; i++) {
+            if ((area = (ax - cx) * (y[i] - ay) - (ax - i) * (cy - ay)) < 0)
+                area = -area;
+            if (area > max_area) {
+                max_area = area;
+                best = i;
+            }
+        }
+        pick[g] = best;
+    }
+    for (g = 0; g < groups; g++)
+        dst[g] = src[pick[g]];
 }
 
-void hist_js_sens_out(hist_context * ctx, int sensor, FILE * fp)
+hist_context *hist_lttb(hist_context * ctx, int factor)
 {
-    hist_point *point;
-    double cur_value = 0.0, new_value;
-    int ch;
-
-    if (sensor >= 0 && sensor < MAX_SENSOR) {
-        if (ctx->flags[sensor]) {
-            ch = '[';
-            for (point = ctx->data; point < ctx->end; point++) {
-                if ((new_value = point->sensors[sensor].mean) >= 0)
-                    cur_value = new_value;
-                fprintf(fp, "%c%g", ch, cur_value);
-                ch = ',';
+    hist_context *out;
+    hist_series *ser;
+    double *y;
+    int *pick;
+    int n = ctx->points, groups, sens_num, i;
+
+    if (factor <= 1 || n == 0)
+        return ctx;
+    groups = (n + factor - 1) / factor;
+    if ((out = hist_alloc(ctx->start_ts, ctx->step * factor, groups, ctx->mask, ctx->temp_total != NULL, ctx->sketches))) {
+        if ((y = malloc(n * sizeof(double)))) {
+            if ((pick = malloc(groups * sizeof(int)))) {
+                for (i = 0; i < n; i++)
+                    merge_bucket(out, i / factor, ctx, i);
+                memcpy(out->flags, ctx->flags, ctx->nsensors);
+                out->raw_points = ctx->raw_points;
+                out->sampled = ctx->sampled;
+                if (hist_partial(ctx))
+                    out->read_to = ctx->read_to;
+                for (sens_num = 0; sens_num < ctx->nsensors; sens_num++) {
+                    ser = ctx->sensors + sens_num;
+                    if (ser->range)
+                        *out->sensors[sens_num].range = *ser->range;
+                    out->sensors[sens_num].filled = ser->filled;
+                    out->sensors[sens_num].samples = ser->samples;
+                    out->sensors[sens_num].sum = ser->sum;
+                    out->sensors[sens_num].squares = ser->squares;
+                    if (ctx->flags[sens_num])
+                        lttb_series(ser->mean, out->sensors[sens_num].mean, n, factor, y, pick);
+                    else if (ser->total)
+                        for (i = 0; i < groups; i++)
+                            out->sensors[sens_num].mean[i] = -1;
+                }
+                lttb_series(ctx->total, out->total, n, factor, y, pick);
+                lttb_series(ctx->others, out->others, n, factor, y, pick);
+                if (ctx->temp_mean)
+                    lttb_series(ctx->temp_mean, out->temp_mean, n, factor, y, pick);
+                free(pick);
+                free(y);
+                hist_free(ctx);
+                return out;
             }
-            putc(']', fp);
+            free(y);
         }
+        log_syserr("unable to allocate space for LTTB");
+        hist_free(out);
     }
+    return ctx;
 }
 
-void hist_js_total_out(hist_context * ctx, FILE * fp)
+static void series_out(const hist_mean * series, int n, double scale, FILE * fp)
 {
-    hist_point *point;
     double cur_value = 0.0, new_value;
-    int ch = '[';
+    int ch = '[', i;
 
-    for (point = ctx->data; point < ctx->end; point++) {
-        if ((new_value = point->total) >= 0)
+    for (i = 0; i < n; i++) {
+        if (series && (new_value = series[i] / scale) >= 0)
             cur_value = new_value;
         fprintf(fp, "%c%.3g", ch, cur_value);
         ch = ',';
@@ -251,17 +1307,132 @@ void hist_js_total_out(hist_context * ctx, FILE * fp)
     putc(']', fp);
 }
 
+void hist_js_temp_out(hist_context * ctx, FILE * fp)
+{
+    series_out(ctx->temp_mean, ctx->points, TEMP_SCALE, fp);
+}
+
+typedef enum {
+    SENS_MEAN,
+    SENS_MIN,
+    SENS_MAX
+} sens_stat;
+
+static void sens_out(hist_context * ctx, int sensor, sens_stat stat, FILE * fp)
+{
+    hist_series *ser;
+    double cur_value = 0.0;
+    int ch, i;
+
+    if (hist_has_sensor(ctx, sensor)) {
+        ser = ctx->sensors + sensor;
+        ch = '[';
+        for (i = 0; i < ctx->points; i++) {
+            if (stat == SENS_MEAN) {
+                if (ser->mean[i] >= 0)
+                    cur_value = watts_to_double(ser->mean[i]);
+            }
+            else if (ser->count[i] > 0)
+                cur_value = watts_to_double(stat == SENS_MIN ? ser->min[i] : ser->max[i]);
+            fprintf(fp, "%c%g", ch, cur_value);
+            ch = ',';
+        }
+        putc(']', fp);
+    }
+}
+
+void hist_js_sens_out(hist_context * ctx, int sensor, FILE * fp)
+{
+    sens_out(ctx, sensor, SENS_MEAN, fp);
+}
+
+void hist_js_sens_min_out(hist_context * ctx, int sensor, FILE * fp)
+{
+    sens_out(ctx, sensor, SENS_MIN, fp);
+}
+
+void hist_js_sens_max_out(hist_context * ctx, int sensor, FILE * fp)
+{
+    sens_out(ctx, sensor, SENS_MAX, fp);
+}
+
+void hist_js_total_out(hist_context * ctx, FILE * fp)
+{
+    series_out(ctx->total, ctx->points, WATTS_SCALE, fp);
+}
+
 void hist_js_others_out(hist_context * ctx, FILE * fp)
 {
-    hist_point *point;
+    series_out(ctx->others, ctx->points, WATTS_SCALE, fp);
+}
+
+double hist_quantile(hist_context * ctx, int sensor, double q)
+{
+    if (sensor >= 0 && sensor < ctx->nsensors && ctx->sensors[sensor].range)
+        return sk_quantile(ctx->sensors[sensor].range, q);
+    return -1;
+}
+
+/*
+ * The spread of all the sensor's samples read is taken as that within a
+ * point, which overstates it where the power changes much over the range,
+ * and the error shrinks as the share of the samples read grows.
+ */
+
+double hist_error(hist_context * ctx, int sensor)
+{
+    hist_series *ser;
+    double var, per_point;
+
+    if (!hist_has_sensor(ctx, sensor) || ctx->sampled >= 1 || (ser = ctx->sensors + sensor)->samples < 2)
+        return 0;
+    var = (ser->squares - ser->sum * ser->sum / ser->samples) / (ser->samples - 1);
+    per_point = ser->samples / ser->filled;
+    return var > 0 ? sqrt(var * (1 - ctx->sampled) / per_point) / WATTS_SCALE : 0;
+}
+
+/*
+ * The quantile q of the samples in each point, where a sketch was kept
+ * for each.
+ */
+
+void hist_js_sens_quantile_out(hist_context * ctx, int sensor, double q, FILE * fp)
+{
+    hist_series *ser;
     double cur_value = 0.0, new_value;
-    int ch = '[';
+    int ch, i;
 
-    for (point = ctx->data; point < ctx->end; point++) {
-        if ((new_value = point->others) >= 0)
-            cur_value = new_value;
-        fprintf(fp, "%c%.3g", ch, cur_value);
-        ch = ',';
+    if (hist_has_sensor(ctx, sensor) && (ser = ctx->sensors + sensor)->sketches) {
+        ch = '[';
+        for (i = 0; i < ctx->points; i++) {
+            if ((new_value = sk_quantile(ser->sketches + i, q)) >= 0)
+                cur_value = new_value;
+            fprintf(fp, "%c%g", ch, cur_value);
+            ch = ',';
+        }
+        putc(']', fp);
+    }
+}
+
+/*
+ * The bins of the sketch for the whole range with any samples in them,
+ * each as the lowest power in it, the power above it and the count.
+ */
+
+void hist_js_sens_histogram_out(hist_context * ctx, int sensor, FILE * fp)
+{
+    const sketch *sk;
+    int ch = '[', i;
+
+    if (sensor >= 0 && sensor < ctx->nsensors && (sk = ctx->sensors[sensor].range)) {
+        for (i = 0; i < SK_BINS; i++) {
+            if (sk->bins[i]) {
+                fprintf(fp, "%c[%g,%g,%u]", ch, sk_bin_low(i), sk_bin_high(i), sk->bins[i]);
+                ch = ',';
+            }
+        }
     }
+    if (ch == '[')
+        putc(ch, fp);
     putc(']', fp);
 }
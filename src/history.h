@@ -2,45 +2,209 @@
 #define HISTORY_H
 
 #include "cc-defs.h"
+#include "parsefile.h"
+#include "sketch.h"
 
 #include <stdio.h>
 #include <time.h>
 
-typedef struct _sensor {
-    float mean;
-    float total;
-    int count;
-} hist_sensor;
-
-typedef struct _point {
-    float total;
-    float others;
-    float temp_total;
-    int temp_count;
-    float temp_mean;
-    hist_sensor sensors[MAX_SENSOR];
-} hist_point;
+#ifdef FIXED_POINT
+typedef long long hist_sum;
+typedef long hist_mean;
+#else
+typedef float hist_sum;
+typedef float hist_mean;
+#endif
+
+/*
+ * A history holds an array per statistic per sensor, each of one entry
+ * per point, so the loops over them run along contiguous memory.  Only
+ * the sensors in the mask it was fetched for have arrays, nsensors being
+ * one more than the highest of them, and there are no temperature arrays
+ * unless the temperature was wanted.  Quantile sketches are only kept if
+ * asked for.
+ */
+
+typedef struct _hist_series {
+    hist_sum *total;            /* NULL if the sensor was not fetched */
+    int *count;
+    hist_mean *mean;
+    hist_mean *min;             /* lowest and highest sample, if count > 0 */
+    hist_mean *max;
+    sketch *sketches;           /* one a point, if kept */
+    sketch *range;              /* the whole range, if kept */
+    int filled;                 /* points read from the samples, */
+    double samples;             /* the samples in them, their sum */
+    double sum;                 /* and the sum of their squares */
+    double squares;
+} hist_series;
 
 typedef struct _hist_context {
     time_t start_ts;
     time_t end_ts;
     time_t step;
-    hist_point *data;
-    hist_point *end;
-    char flags[MAX_SENSOR];
+    int points;
+    unsigned mask;
+    int nsensors;
+    int sketches;
+    hist_series *sensors;
+    hist_mean *total;
+    hist_mean *others;
+    hist_sum *temp_total;       /* NULL without the temperature */
+    int *temp_count;
+    hist_mean *temp_mean;
+    char *flags;                /* 'W' for sensors with samples */
+    int raw_points;             /* points read from the samples */
+    double sampled;             /* share of those samples read */
+    time_t read_to;             /* end_ts unless the budget ran out */
 } hist_context;
 
+#define hist_has_sensor(ctx, n) ((n) >= 0 && (n) < (ctx)->nsensors && (ctx)->flags[n])
+#define hist_partial(ctx) ((ctx)->read_to < (ctx)->end_ts)
+
 typedef enum {
     HIST_SUCCESS,
     HIST_FAIL
 } hist_status;
 
-extern hist_context *hist_get(time_t from, time_t to, int step);
+/*
+ * A storage backend delivers the samples with start <= timestamp < end
+ * for each of the spans, which are in order and apart, in timestamp order
+ * to the sample callback of the parse context.  It may leave out sensors
+ * not in the sensor bitmask.  Given a deadline it stops once that has
+ * passed, lowering read_to from the end of the last span to the time up
+ * to which it delivered every sample, and if it reads only a sample of
+ * the samples it sets the share read.
+ */
+
+typedef struct {
+    time_t start;
+    time_t end;
+} hist_span;
+
+typedef struct {
+    struct timespec deadline;   /* on the monotonic clock, zero for none */
+    double sampled;
+    time_t read_to;
+} hist_scan_info;
+
+typedef mf_status(*hist_scan_fn) (pf_context * pf, const hist_span * spans, int nspans, unsigned sensors, hist_scan_info * info);
+
+extern int hist_out_of_time(const hist_scan_info * info);
+
+typedef struct _hist_backend {
+    const char *name;
+    hist_scan_fn scan;
+} hist_backend;
+
+/* the names also key the bucket cache */
+#define HIST_XML_NAME    "xml"
+#define HIST_SQLITE_NAME "sqlite"
+
+extern const hist_backend hist_xml_backend;
+extern const hist_backend hist_sqlite_backend;
+extern const hist_backend *hist_default_backend;
+
+extern const hist_backend *hist_find_backend(const char *name);
+
+/*
+ * The number of threads the XML backend may parse day files with, or
+ * zero for one per CPU up to a limit.
+ */
+
+extern int hist_threads;
+
+/*
+ * The directory to cache history buckets in, or NULL not to cache them.
+ */
+
+extern const char *hist_cache_dir;
+
+/*
+ * Zero to read the XML backend's samples even where they are rolled up.
+ */
+
+extern int hist_rollups;
+
+/*
+ * Whether to keep quantile sketches of each sensor's power for the whole
+ * range and, with HIST_SKETCH_POINTS, for each point as well.  Sketches
+ * are made from the samples so the cache and the rollups are not used.
+ */
+
+#define HIST_SKETCH_RANGE  1
+#define HIST_SKETCH_POINTS 2
+
+extern int hist_sketches;
+
+/*
+ * For a quick, approximate history of a long range: with a stride of more
+ * than one the XML backend reads only about one line in stride from the
+ * day files, and with a budget of some milliseconds the scan stops once
+ * that long has passed, leaving the history with what was read by then
+ * and marked partial.  Points from the cache or the rollups are exact and
+ * neither is kept in the cache.
+ */
+
+extern int hist_stride;
+extern int hist_budget_ms;
+
+/*
+ * The sensors whose readings go into the total and others series, which
+ * must be fetched whichever individual sensors are to be shown.
+ */
+
+#define HIST_DERIVED_SENSORS 0x33f
+
+extern hist_context *hist_get(const hist_backend *backend, time_t from, time_t to, int step, unsigned sensors, int need_temp);
+
+/*
+ * Fetch the history for the range from to to and for the same range moved
+ * by each of the offsets, such as a day or a week back to compare against,
+ * into one history each.  The offsets are rounded to a whole number of
+ * steps so the points line up.  All the samples needed are read in one
+ * scan, so a file needed for more than one of the ranges is read once.
+ */
+
+#define HIST_MAX_RANGES 8
+
+extern hist_status hist_get_ranges(const hist_backend *backend, time_t from, time_t to, int step, unsigned sensors, int need_temp,
+                                   const time_t *offsets, int nranges, hist_context **ctxs);
 extern void hist_free(hist_context * ctx);
 
+/*
+ * The power below which a fraction q of a sensor's samples over the
+ * whole range fall, or -1 if there are none or no sketches were kept.
+ */
+
+extern double hist_quantile(hist_context * ctx, int sensor, double q);
+
+/*
+ * The standard error, in watts, of a sensor's points where the samples
+ * were sampled, or zero if they were all read.
+ */
+
+extern double hist_error(hist_context * ctx, int sensor);
+
+/*
+ * Reduce a history to one point in every factor by Largest-Triangle-
+ * Three-Buckets, which picks for each series the point in each group
+ * that best keeps the shape of the line, so peaks survive where taking
+ * the mean would flatten them.  Fetch the history at factor times the
+ * resolution wanted first.  The counts, totals and envelopes are for the
+ * whole group.  The history given is freed and the reduced one returned,
+ * or the one given if it cannot be reduced.
+ */
+
+extern hist_context *hist_lttb(hist_context * ctx, int factor);
+
 extern void hist_js_temp_out(hist_context * ctx, FILE *fp);
 extern void hist_js_sens_out(hist_context * ctx, int sensor, FILE *fp);
+extern void hist_js_sens_min_out(hist_context * ctx, int sensor, FILE *fp);
+extern void hist_js_sens_max_out(hist_context * ctx, int sensor, FILE *fp);
 extern void hist_js_total_out(hist_context * ctx, FILE *fp);
 extern void hist_js_others_out(hist_context * ctx, FILE *fp);
+extern void hist_js_sens_quantile_out(hist_context * ctx, int sensor, double q, FILE *fp);
+extern void hist_js_sens_histogram_out(hist_context * ctx, int sensor, FILE *fp);
 
 #endif
@@ -0,0 +1,66 @@
+/*
+ * ledger
+ *
+ * Bookkeeping shared by the loaders for the import ledger, a table in the
+ * target database that records how far into each XML file has already
+ * been imported so a re-run only needs to read what has been appended.
+ */
+
+#include "cc-common.h"
+#include "ledger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int ledger_init(ledger_entry *ent, const char *file, struct stat *stb)
+{
+    if (stat(file, stb) == 0) {
+        if (realpath(file, ent->path)) {
+            ent->size = -1;
+            ent->mtime = 0;
+            ent->offset = 0;
+            ent->last_secs = 0;
+            ent->last_usecs = 0;
+            return 0;
+        }
+        else
+            log_syserr("unable to resolve path '%s'", file);
+    }
+    else
+        log_syserr("unable to stat '%s'", file);
+    return -1;
+}
+
+/*
+ * Given an entry as loaded from the ledger, decide whether there is
+ * anything new to import, returning 1 if there is.  The size and time
+ * recorded are those of the file when the entry was written, which may
+ * have been part way through it, so a file is only done with once the
+ * offset has reached its end.  If the file is smaller than the part
+ * already imported it has been replaced, and it is imported again from
+ * the start if the loader can take the rows it has already again, or
+ * else refused, returning -1.
+ */
+
+int ledger_resume(ledger_entry *ent, const struct stat *stb, int restart)
+{
+    if (ent->offset == stb->st_size && ent->size == stb->st_size && ent->mtime == stb->st_mtime)
+        return 0;
+    if (ent->offset > stb->st_size) {
+        if (!restart) {
+            log_msg("'%s' is shorter than when last imported, so remove its rows and its ledger entry to import it again", ent->path);
+            return -1;
+        }
+        log_msg("'%s' is shorter than when last imported, starting again", ent->path);
+        ent->offset = 0;
+        ent->last_secs = 0;
+        ent->last_usecs = 0;
+    }
+    return ent->offset < stb->st_size;
+}
+
+void ledger_done(ledger_entry *ent, const struct stat *stb)
+{
+    ent->size = stb->st_size;
+    ent->mtime = stb->st_mtime;
+}
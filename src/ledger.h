@@ -0,0 +1,21 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char path[PATH_MAX];
+    long long size;
+    time_t mtime;
+    size_t offset;
+    time_t last_secs;
+    unsigned last_usecs;
+} ledger_entry;
+
+extern int ledger_init(ledger_entry *ent, const char *file, struct stat *stb);
+extern int ledger_resume(ledger_entry *ent, const struct stat *stb, int restart);
+extern void ledger_done(ledger_entry *ent, const struct stat *stb);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * linetok
+ *
+ * Tokeniser for the XML lines logged from the Current Cost meter.  It
+ * makes a single left-to-right pass over the bytes as they are in the
+ * file, without copying or terminating them, hopping from one '<' to the
+ * next, recognising the tags of interest by their first letter and
+ * decoding the numbers as it goes.  Only
+ * the first occurrence of each tag counts, so for a multi-channel sensor
+ * the watts are those of the first channel.
+ *
+ * Scanning stops as soon as all the fields asked for have been found,
+ * taking a watts reading to rule out a pulse count and vice versa, and
+ * can be resumed from the pointer returned, so a caller can look at the
+ * time stamp before deciding whether the rest of the line is wanted.
+ */
+
+#include "linetok.h"
+
+#include <string.h>
+
+static inline const char *dec_uint(const char *ptr, const char *end, unsigned long *value)
+{
+    unsigned long v = 0;
+    unsigned d;
+
+    while (ptr < end && (d = *ptr - '0') <= 9) {
+        v = v * 10 + d;
+        ptr++;
+    }
+    *value = v;
+    return ptr;
+}
+
+#ifdef FIXED_POINT
+
+/* decode a decimal as an integer in units of 1/scale, truncating */
+
+static inline const char *dec_real(const char *ptr, const char *end, long scale, cc_real *value)
+{
+    unsigned long ip;
+    long v;
+    unsigned d;
+    int neg = 0;
+
+    if (ptr < end && *ptr == '-') {
+        neg = 1;
+        ptr++;
+    }
+    ptr = dec_uint(ptr, end, &ip);
+    v = ip;
+    if (ptr < end && *ptr == '.') {
+        for (ptr++; ptr < end && (d = *ptr - '0') <= 9; ptr++) {
+            if (scale > 1) {
+                v = v * 10 + d;
+                scale /= 10;
+            }
+        }
+    }
+    v *= scale;
+    *value = neg ? -v : v;
+    return ptr;
+}
+
+#else
+
+static const double frac_scale[] = {
+    1.0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9
+};
+
+static inline const char *dec_real(const char *ptr, const char *end, long scale, cc_real *value)
+{
+    const char *start;
+    unsigned long ip, fp = 0;
+    int neg = 0, nfrac = 0;
+
+    if (ptr < end && *ptr == '-') {
+        neg = 1;
+        ptr++;
+    }
+    ptr = dec_uint(ptr, end, &ip);
+    if (ptr < end && *ptr == '.') {
+        start = ++ptr;
+        ptr = dec_uint(ptr, end, &fp);
+        if ((nfrac = ptr - start) > 9)
+            return NULL;
+    }
+    *value = ip + fp * frac_scale[nfrac];
+    if (neg)
+        *value = -*value;
+    return ptr;
+}
+
+#endif
+
+static inline const char *dec_tstamp(const char *ptr, const char *end, lt_line *ln)
+{
+    unsigned long v;
+    int n;
+
+    ptr = dec_uint(ptr, end, &v);
+    ln->secs = v;
+    ln->usecs = 0;
+    if (ptr < end && *ptr == '.') {
+        for (n = 0, ptr++; ptr < end && *ptr >= '0' && *ptr <= '9'; n++, ptr++)
+            if (n < 6)
+                ln->usecs = ln->usecs * 10 + *ptr - '0';
+        for (; n < 6; n++)
+            ln->usecs *= 10;
+    }
+    return ptr;
+}
+
+/* the opening tags in lt_field order, each with its closing '>' */
+static const lt_span tags[LT_NFIELD] = {
+    { "host-tstamp>", 12 },
+    { "tmpr>", 5 },
+    { "sensor>", 7 },
+    { "id>", 3 },
+    { "watts>", 6 },
+    { "imp>", 4 },
+    { "ipu>", 4 }
+};
+
+static inline lt_field tag_field(const char *name, const char *end)
+{
+    lt_field field;
+
+    if (name >= end)
+        return LT_NFIELD;
+    switch (*name) {
+        case 'h':
+            field = LT_TSTAMP;
+            break;
+        case 'i':
+            if (end - name > 1 && name[1] == 'd')
+                field = LT_ID;
+            else if (end - name > 1 && name[1] == 'm')
+                field = LT_IMP;
+            else
+                field = LT_IPU;
+            break;
+        case 's':
+            field = LT_SENSOR;
+            break;
+        case 't':
+            field = LT_TMPR;
+            break;
+        case 'w':
+            field = LT_WATTS;
+            break;
+        default:
+            return LT_NFIELD;
+    }
+    if ((size_t) (end - name) > tags[field].len && memcmp(name, tags[field].ptr, tags[field].len) == 0)
+        return field;
+    return LT_NFIELD;
+}
+
+const char *lt_scan(lt_line *ln, unsigned want, const char *ptr, const char *end)
+{
+    const char *value;
+    unsigned long v;
+    lt_field field;
+
+    want &= ~ln->found;
+    while (want && ptr < end && (ptr = memchr(ptr, '<', end - ptr))) {
+        field = tag_field(++ptr, end);
+        if (field == LT_NFIELD || (ln->found & LT_BIT(field)))
+            continue;
+        value = ptr += tags[field].len;
+        switch (field) {
+            case LT_TSTAMP:
+                ptr = dec_tstamp(ptr, end, ln);
+                break;
+            case LT_TMPR:
+                ptr = dec_real(ptr, end, TEMP_SCALE, &ln->temp);
+                break;
+            case LT_WATTS:
+                ptr = dec_real(ptr, end, WATTS_SCALE, &ln->watts);
+                break;
+            case LT_SENSOR:
+                ptr = dec_uint(ptr, end, &v);
+                ln->sensor = v;
+                break;
+            case LT_IMP:
+                ptr = dec_uint(ptr, end, &v);
+                ln->count = v;
+                break;
+            case LT_IPU:
+                ptr = dec_uint(ptr, end, &v);
+                ln->ipu = v;
+                break;
+            default:
+                ptr = dec_uint(ptr, end, &v);
+        }
+        /* a field only counts if it is a non-empty number ending at a tag */
+        if (ptr && ptr > value && ptr < end && *ptr == '<') {
+            ln->text[field].ptr = value;
+            ln->text[field].len = ptr - value;
+            ln->found |= LT_BIT(field);
+            want &= ~LT_BIT(field);
+            /* a line holds either a power or a pulse reading, not both */
+            if (field == LT_WATTS)
+                want &= ~(LT_BIT(LT_IMP) | LT_BIT(LT_IPU));
+            else if (field == LT_IMP)
+                want &= ~LT_BIT(LT_WATTS);
+        }
+        else if (!ptr)
+            ptr = value;
+    }
+    return ptr ? ptr : end;
+}
@@ -0,0 +1,44 @@
+#ifndef LINETOK_H
+#define LINETOK_H
+
+#include "cc-defs.h"
+
+#include <stddef.h>
+#include <time.h>
+
+typedef enum {
+    LT_TSTAMP,
+    LT_TMPR,
+    LT_SENSOR,
+    LT_ID,
+    LT_WATTS,
+    LT_IMP,
+    LT_IPU,
+    LT_NFIELD
+} lt_field;
+
+#define LT_BIT(f) (1U << (f))
+#define LT_ALL    (LT_BIT(LT_NFIELD) - 1)
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} lt_span;
+
+typedef struct {
+    unsigned found;
+    lt_span text[LT_NFIELD];
+    time_t secs;
+    unsigned usecs;
+    cc_real temp;
+    int sensor;
+    cc_real watts;
+    long count;
+    int ipu;
+} lt_line;
+
+#define lt_init(ln) ((ln)->found = 0)
+
+extern const char *lt_scan(lt_line *ln, unsigned want, const char *ptr, const char *end);
+
+#endif
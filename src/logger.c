@@ -3,30 +3,32 @@
 #include "logger.h"
 #include "file-logger.h"
 #include "db-logger.h"
+#include "sqlite-logger.h"
 
 #include <time.h>
 
 struct _logger_t {
     file_logger_t *file_logger;
     db_logger_t *db_logger;
+    sqlite_logger_t *sqlite_logger;
     char *line_ptr;
     char line[MAX_LINE_LEN + 1];
 };
 
-extern logger_t *logger_new(const char *db_conn)
+extern logger_t *logger_new(const char *db_conn, const char *sqlite_file)
 {
     logger_t *logger;
 
     if ((logger = malloc(sizeof(logger_t)))) {
         logger->line_ptr = logger->line;
+        logger->db_logger = NULL;
+        logger->sqlite_logger = NULL;
         if ((logger->file_logger = file_logger_new())) {
-            if (db_conn) {
-                if ((logger->db_logger = db_logger_new(db_conn)))
+            if (db_conn == NULL || (logger->db_logger = db_logger_new(db_conn))) {
+                if (sqlite_file == NULL || (logger->sqlite_logger = sqlite_logger_new(sqlite_file)))
                     return logger;
-            }
-            else {
-                logger->db_logger = NULL;
-                return logger;
+                if (logger->db_logger)
+                    db_logger_free(logger->db_logger);
             }
             file_logger_free(logger->file_logger);
         }
@@ -40,6 +42,8 @@ extern void logger_free(logger_t * logger)
     file_logger_free(logger->file_logger);
     if (logger->db_logger)
         db_logger_free(logger->db_logger);
+    if (logger->sqlite_logger)
+        sqlite_logger_free(logger->sqlite_logger);
     free(logger);
 }
 
@@ -50,6 +54,8 @@ static void invoke_loggers(logger_t *logger, char *end)
     file_logger_line(logger->file_logger, &tv, logger->line, end);
     if (logger->db_logger)
         db_logger_line(logger->db_logger, &tv, logger->line, end);
+    if (logger->sqlite_logger)
+        sqlite_logger_line(logger->sqlite_logger, &tv, logger->line, end);
 }
 
 extern void logger_data(logger_t *logger, const unsigned char *data, size_t size)
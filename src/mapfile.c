@@ -1,35 +1,216 @@
+/*
+ * mapfile
+ *
+ * The I/O layer under the text file parsers.  A file is either mapped
+ * into memory, with access hints chosen by the caller, or streamed with
+ * pread in chunks that end on a line boundary.  Files about to be wanted
+ * can be prefetched into the page cache while another is parsed.  The
+ * time spent and bytes handled are counted by strategy, under a lock
+ * rather than with 64 bit atomics, which some ARM targets can only do
+ * through libgcc helpers that need kernel support they may lack.
+ */
+
+#define _GNU_SOURCE
+
 #include "cc-common.h"
 #include "mapfile.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-mf_status mapfile(const char *filename, void *user_data, mf_callback callback)
+#define STREAM_CHUNK (256 * 1024)
+
+const char *const mf_strategy_names[MF_NSTRATEGY] = {
+    "map",
+    "map-seq",
+    "map-willneed",
+    "map-populate",
+    "stream",
+    "prefetch"
+};
+
+static mf_stat stats[MF_NSTRATEGY];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long now_nsecs(void)
 {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void count(mf_strategy strategy, unsigned long long bytes, unsigned long long nsecs)
+{
+    mf_stat *st = stats + strategy;
+
+    pthread_mutex_lock(&stats_lock);
+    st->files++;
+    st->bytes += bytes;
+    st->nsecs += nsecs;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void mf_get_stats(mf_stat *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    memcpy(out, stats, sizeof(stats));
+    pthread_mutex_unlock(&stats_lock);
+}
 
+static mf_status map_fd(const char *filename, int fd, size_t size, mf_strategy strategy, void *user_data, mf_callback callback, unsigned long long *nsecs)
+{
     mf_status status = MF_FAIL;
-    int fd;
-    struct stat stb;
+    unsigned long long start;
     void *data;
+    int flags = MAP_PRIVATE;
+
+    start = now_nsecs();
+    if (strategy == MF_MAP_POPULATE)
+        flags |= MAP_POPULATE;
+    data = mmap(NULL, size, PROT_READ, flags, fd, 0);
+    if (data != MAP_FAILED) {
+        if (strategy == MF_MAP_SEQ)
+            madvise(data, size, MADV_SEQUENTIAL);
+        else if (strategy == MF_MAP_WILLNEED)
+            madvise(data, size, MADV_WILLNEED);
+        *nsecs += now_nsecs() - start;
+        status = callback(user_data, data, size);
+        start = now_nsecs();
+        munmap(data, size);
+        *nsecs += now_nsecs() - start;
+    }
+    else
+        log_syserr("unable to map file '%s' into memory", filename);
+    return status;
+}
+
+/*
+ * Read the file in chunks, handing over each run of complete lines and
+ * carrying any partial line at the end over to the front of the buffer
+ * for the next read.  The buffer grows if a line will not fit.
+ */
+
+static mf_status stream_fd(const char *filename, int fd, void *user_data, mf_callback callback, unsigned long long *nsecs, unsigned long long *bytes)
+{
+    mf_status status = MF_SUCCESS;
+    unsigned long long start;
+    size_t size = STREAM_CHUNK, used = 0, keep;
+    off_t pos = 0;
+    ssize_t got;
+    char *buf, *nbuf, *nl;
 
+    if ((buf = malloc(size)) == NULL) {
+        log_syserr("unable to allocate buffer to read '%s'", filename);
+        return MF_FAIL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (status == MF_SUCCESS) {
+        if (used == size) {
+            if ((nbuf = realloc(buf, size * 2)) == NULL) {
+                log_syserr("unable to grow buffer to read '%s'", filename);
+                status = MF_FAIL;
+                break;
+            }
+            buf = nbuf;
+            size *= 2;
+        }
+        start = now_nsecs();
+        got = pread(fd, buf + used, size - used, pos);
+        *nsecs += now_nsecs() - start;
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            log_syserr("unable to read '%s'", filename);
+            status = MF_FAIL;
+        }
+        else if (got == 0) {
+            if (used > 0)
+                status = callback(user_data, buf, used);
+            break;
+        }
+        else {
+            pos += got;
+            used += got;
+            *bytes += got;
+            if ((nl = memrchr(buf, '\n', used))) {
+                keep = buf + used - (nl + 1);
+                status = callback(user_data, buf, nl + 1 - buf);
+                memmove(buf, nl + 1, keep);
+                used = keep;
+            }
+        }
+    }
+    free(buf);
+    return status;
+}
+
+mf_status mf_read_file(const char *filename, mf_strategy strategy, void *user_data, mf_callback callback)
+{
+    mf_status status = MF_FAIL;
+    unsigned long long nsecs = 0, bytes = 0, start;
+    struct stat stb;
+    int fd;
+
+    start = now_nsecs();
     if ((fd = open(filename, O_RDONLY)) >= 0) {
         if (fstat(fd, &stb) == 0) {
-            data = mmap(NULL, stb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-            if (data) {
-                status = callback(user_data, data, stb.st_size);
-                munmap(data, stb.st_size);
+            nsecs = now_nsecs() - start;
+            if (stb.st_size == 0)
+                status = MF_SUCCESS;
+            else if (strategy == MF_STREAM)
+                status = stream_fd(filename, fd, user_data, callback, &nsecs, &bytes);
+            else {
+                status = map_fd(filename, fd, stb.st_size, strategy, user_data, callback, &nsecs);
+                bytes = stb.st_size;
             }
-            else
-                log_syserr("unable to map file '%s' into memory", filename);
         }
         else
             log_syserr("unable to fstat '%s'", filename);
+        start = now_nsecs();
         close(fd);
+        nsecs += now_nsecs() - start;
+        if (strategy < MF_NSTRATEGY)
+            count(strategy, bytes, nsecs);
     }
     else
         log_syserr("unable to open file '%s' for reading", filename);
 
     return status;
 }
+
+mf_status mapfile(const char *filename, void *user_data, mf_callback callback)
+{
+    return mf_read_file(filename, MF_MAP, user_data, callback);
+}
+
+/*
+ * Ask the kernel to start reading a file into the page cache without
+ * waiting for it.  A missing file is not an error as a day may have no
+ * log.
+ */
+
+void mf_prefetch(const char *filename)
+{
+    unsigned long long start;
+    struct stat stb;
+    int fd;
+
+    start = now_nsecs();
+    if ((fd = open(filename, O_RDONLY)) >= 0) {
+        if (fstat(fd, &stb) == 0 && stb.st_size > 0) {
+            posix_fadvise(fd, 0, stb.st_size, POSIX_FADV_WILLNEED);
+            close(fd);
+            count(MF_PREFETCH, stb.st_size, now_nsecs() - start);
+        }
+        else
+            close(fd);
+    }
+}
@@ -12,6 +12,34 @@ typedef enum {
 
 typedef mf_status(*mf_callback) (void *user_data, const void *file_data, size_t file_size);
 
+/*
+ * How a file is to be read.  The mapping strategies pass the whole file
+ * to the callback in one go and differ in the hints given to the kernel.
+ * Streaming passes the file in chunks of complete lines so only suits a
+ * callback that reads lines forwards from the start of what it is given.
+ */
+
+typedef enum {
+    MF_MAP,                     /* plain mapping, paged in as touched */
+    MF_MAP_SEQ,                 /* mapping to be read front to back */
+    MF_MAP_WILLNEED,            /* mapping to be read all, in any order */
+    MF_MAP_POPULATE,            /* mapping paged in before the callback */
+    MF_STREAM,                  /* pread in chunks of complete lines */
+    MF_PREFETCH,                /* read ahead of files wanted later */
+    MF_NSTRATEGY
+} mf_strategy;
+
+typedef struct {
+    unsigned long files;
+    unsigned long long bytes;
+    unsigned long long nsecs;   /* spent in the I/O layer, not callbacks */
+} mf_stat;
+
+extern const char *const mf_strategy_names[MF_NSTRATEGY];
+
 extern mf_status mapfile(const char *filename, void *user_data, mf_callback callback);
+extern mf_status mf_read_file(const char *filename, mf_strategy strategy, void *user_data, mf_callback callback);
+extern void mf_prefetch(const char *filename);
+extern void mf_get_stats(mf_stat *stats);
 
 #endif
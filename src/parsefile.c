@@ -1,13 +1,11 @@
 #include "cc-common.h"
+#include "linetok.h"
 #include "parsefile.h"
 
-#include <fcntl.h>
-#include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
-#include <string.h>
-#include <sys/mman.h>
+#include <time.h>
 #include <sys/stat.h>
-#include <unistd.h>
 
 pf_context *pf_new(void)
 {
@@ -19,6 +17,13 @@ pf_context *pf_new(void)
         ctx->filter_cb = pf_filter_all;
         ctx->sample_cb = NULL;
         ctx->pulse_cb = pf_default_pulse_cb;
+        ctx->batch_cb = NULL;
+        ctx->batch = NULL;
+        ctx->user_data = NULL;
+        ctx->start_ts = 0;
+        ctx->end_ts = 0;
+        ctx->sensors = ~0U;
+        ctx->need_temp = 1;
         ptr = ctx->prev_pulses;
         end = ptr + MAX_SENSOR;
         while (ptr < end) {
@@ -44,14 +49,45 @@ mf_status pf_filter_all(pf_context * ctx, time_t ts)
     return MF_SUCCESS;
 }
 
+/*
+ * Filters for samples in the range start_ts <= ts < end_ts when reading a
+ * file forwards or backwards, stopping once past the far end of the range.
+ */
+
+mf_status pf_filter_range_forw(pf_context * ctx, time_t ts)
+{
+    if (ts < ctx->start_ts)
+        return MF_IGNORE;
+    if (ts >= ctx->end_ts)
+        return MF_STOP;
+    return MF_SUCCESS;
+}
+
+mf_status pf_filter_range_back(pf_context * ctx, time_t ts)
+{
+    if (ts < ctx->start_ts)
+        return MF_STOP;
+    if (ts >= ctx->end_ts)
+        return MF_IGNORE;
+    return MF_SUCCESS;
+}
+
+#ifdef FIXED_POINT
+#define pulse_watts(count, secs, ipu) \
+    ((long long) (count) * 3600000 * WATTS_SCALE / ((long long) (secs) * (ipu)))
+#else
+#define pulse_watts(count, secs, ipu) \
+    ((double) (count) * 3600000 / ((secs) * (ipu)))
+#endif
+
 mf_status pf_default_pulse_cb(pf_context * ctx, pf_sample * smp)
 {
     mf_status status = MF_SUCCESS;
     int sens_num, ipu;
     prev_pulse_t *prev;
     time_t ts_diff;
-    long count_old, count_diff;
-    double watts;
+    long count, count_old, count_diff;
+    cc_real watts;
 
     sens_num = smp->sensor;
     if (sens_num >= 0 && sens_num < MAX_SENSOR) {
@@ -59,90 +95,134 @@ mf_status pf_default_pulse_cb(pf_context * ctx, pf_sample * smp)
         if ((ipu = smp->data.pulse.ipu) == 0)
             ipu = prev->ipu;
         prev->ipu = ipu;
+        count = smp->data.pulse.count;  /* shares space with the watts */
         if ((count_old = prev->count) >= 0) {
             ts_diff = prev->timestamp - smp->timestamp;
             if (ts_diff < 0)
                 ts_diff = -ts_diff;
-            count_diff = count_old - smp->data.pulse.count;
+            count_diff = count_old - count;
             if (count_diff < 0)
                 count_diff = -count_diff;
-            watts = (double) count_diff *3600000 / (ts_diff * ipu);
-            if (watts >= 0 && watts <= 10000) {
-                smp->data.watts = watts;
-                status = ctx->sample_cb(ctx, smp);
+            if (ts_diff > 0 && ipu > 0) {
+                watts = pulse_watts(count_diff, ts_diff, ipu);
+                if (watts >= 0 && watts <= 10000 * WATTS_SCALE) {
+                    smp->data.watts = watts;
+                    status = pf_deliver(ctx, smp);
+                }
             }
         }
         prev->timestamp = smp->timestamp;
-        prev->count = smp->data.pulse.count;
+        prev->count = count;
     }
     return status;
 }
 
-static mf_status sensor_search(pf_context * ctx, char *tail, time_t ts_secs)
+#define READING_FIELDS (LT_BIT(LT_WATTS) | LT_BIT(LT_IMP) | LT_BIT(LT_IPU))
+#define PULSE_FIELDS   (LT_BIT(LT_IMP) | LT_BIT(LT_IPU))
+
+/*
+ * The sensor number is looked for before anything else is decoded so
+ * lines for sensors that are not wanted cost only the tag scan.  The
+ * temperature comes before the sensor in the line so it is picked up
+ * afterwards from the part already scanned.
+ */
+
+mf_status pf_parse_line(void *user_data, const void *file_data, size_t file_size)
 {
+    pf_context *ctx = user_data;
     mf_status status = MF_SUCCESS;
-    char *ptr, *end;
+    const char *ptr = file_data;
+    const char *end = ptr + file_size;
+    const char *sens_end;
+    unsigned want;
+    lt_line ln;
     pf_sample smp;
 
-    if ((ptr = strstr(tail, "<tmpr>"))) {
-        smp.temp = strtod(ptr + 6, &end);
-        ptr = end;
-        if (*ptr == '<') {
-            if ((ptr = strstr(ptr, "<sensor>"))) {
-                smp.sensor = strtoul(ptr + 8, &end, 10);
-                ptr = end;
-                if (*ptr == '<') {
-                    smp.timestamp = ts_secs;
-                    if ((ptr = strstr(ptr, "<watts>"))) {
-                        smp.data.watts = strtod(ptr + 7, &end);
-                        if (*end == '<')
-                            status = ctx->sample_cb(ctx, &smp);
+    if (file_size > 135) {
+        lt_init(&ln);
+        ptr = lt_scan(&ln, LT_BIT(LT_TSTAMP), ptr, end);
+        if (ln.found & LT_BIT(LT_TSTAMP)) {
+            if ((status = ctx->filter_cb(ctx, ln.secs)) == MF_SUCCESS) {
+                sens_end = lt_scan(&ln, LT_BIT(LT_SENSOR), ptr, end);
+                if ((ln.found & LT_BIT(LT_SENSOR)) && (unsigned) ln.sensor < MAX_SENSOR && (ctx->sensors & (1U << ln.sensor))) {
+                    want = READING_FIELDS;
+                    if (ctx->need_temp) {
+                        lt_scan(&ln, LT_BIT(LT_TMPR), ptr, sens_end);
+                        want |= LT_BIT(LT_TMPR);
                     }
-                    else if ((ptr = strstr(end, "<imp>"))) {
-                        smp.data.pulse.count = strtoul(ptr + 5, &end, 10);
-                        if (*end == '<') {
-                            if ((ptr = strstr(end, "<ipu>"))) {
-                                smp.data.pulse.ipu = strtoul(ptr + 5, NULL, 10);
-                                status = ctx->pulse_cb(ctx, &smp);
-                            }
+                    lt_scan(&ln, want, sens_end, end);
+                    if (!ctx->need_temp || (ln.found & LT_BIT(LT_TMPR))) {
+                        smp.timestamp = ln.secs;
+                        smp.usecs = ln.usecs;
+                        smp.temp = ctx->need_temp ? ln.temp : 0;
+                        smp.sensor = ln.sensor;
+                        if (ln.found & LT_BIT(LT_WATTS)) {
+                            smp.data.watts = ln.watts;
+                            status = pf_deliver(ctx, &smp);
+                        }
+                        else if ((ln.found & PULSE_FIELDS) == PULSE_FIELDS) {
+                            smp.data.pulse.count = ln.count;
+                            smp.data.pulse.ipu = ln.ipu;
+                            status = ctx->pulse_cb(ctx, &smp);
                         }
                     }
                 }
             }
+            else if (status == MF_IGNORE)
+                status = MF_SUCCESS;
         }
     }
     return status;
 }
 
-static mf_status tstamp_search(pf_context * ctx, char *line)
+mf_status pf_parse_lines(void *user_data, const tf_span * spans, unsigned count)
 {
     mf_status status = MF_SUCCESS;
-    time_t ts_secs;
-    char *ptr, *end, ch;
-
-    if ((ptr = strstr(line, "<host-tstamp>"))) {
-        ts_secs = strtoul(ptr + 13, &end, 10);
-        if ((ch = *end) == '<' || ch == '.') {
-            if ((status = ctx->filter_cb(ctx, ts_secs)) == MF_SUCCESS)
-                status = sensor_search(ctx, end, ts_secs);
-            else if (status == MF_IGNORE)
-                status = MF_SUCCESS;
-        }
-    }
+    const tf_span *end;
+
+    for (end = spans + count; status == MF_SUCCESS && spans < end; spans++)
+        status = pf_parse_line(user_data, spans->ptr, spans->len);
     return status;
 }
 
-mf_status pf_parse_line(void *user_data, const void *file_data, size_t file_size)
+long long pf_line_time(const char *line, size_t len)
 {
+    lt_line ln;
+
+    lt_init(&ln);
+    lt_scan(&ln, LT_BIT(LT_TSTAMP), line, line + len);
+    if (ln.found & LT_BIT(LT_TSTAMP))
+        return ln.secs;
+    return -1;
+}
 
+mf_status pf_flush(pf_context * ctx)
+{
     mf_status status = MF_SUCCESS;
-    char *copy;
+    pf_batch *batch;
 
-    if (file_size > 135) {
-        copy = alloca(file_size + 1);
-        memcpy(copy, file_data, file_size);
-        copy[file_size] = '\0';
-        status = tstamp_search((pf_context *) user_data, copy);
+    if ((batch = ctx->batch) && batch->count > 0) {
+        status = ctx->batch_cb(ctx, batch);
+        batch->count = 0;
     }
     return status;
 }
+
+mf_status pf_parse_day(pf_context * ctx, time_t day, int whole)
+{
+    struct stat stb;
+    struct tm tm;
+    char file[30];
+
+    gmtime_r(&day, &tm);
+    strftime(file, sizeof file, xml_file, &tm);
+    if (stat(file, &stb)) {
+        if (errno == ENOENT)
+            return MF_SUCCESS;
+        log_syserr("unable to stat '%s'", file);
+        return MF_FAIL;
+    }
+    if (whole)
+        return pf_parse_file_using(ctx, file, MF_MAP_SEQ);
+    return pf_parse_range(ctx, file);
+}
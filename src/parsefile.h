@@ -14,18 +14,36 @@ typedef struct _pf_pulse {
 
 typedef struct _pf_sample {
     time_t timestamp;
-    double temp;
+    unsigned usecs;
+    cc_real temp;
     int sensor;
     union {
-        double watts;
+        cc_real watts;
         pf_pulse pulse;
     } data;
 } pf_sample;
 
+/*
+ * A batch holds power samples, including those converted from pulse
+ * counts, as parallel arrays so a consumer can work through a whole
+ * batch in one loop rather than take a call per sample.
+ */
+
+#define PF_BATCH_SIZE 4096
+
+typedef struct _pf_batch {
+    unsigned count;
+    time_t timestamp[PF_BATCH_SIZE];
+    int sensor[PF_BATCH_SIZE];
+    cc_real temp[PF_BATCH_SIZE];
+    cc_real watts[PF_BATCH_SIZE];
+} pf_batch;
+
 typedef struct _pf_context pf_context;
 
 typedef mf_status(*pf_filter_cb) (pf_context * ctx, time_t ts);
 typedef mf_status(*pf_sample_cb) (pf_context * ctx, pf_sample * smp);
+typedef mf_status(*pf_batch_cb) (pf_context * ctx, pf_batch * batch);
 
 typedef struct _prev_pulse {
     time_t timestamp;
@@ -38,7 +56,13 @@ struct _pf_context {
     pf_filter_cb filter_cb;
     pf_sample_cb sample_cb;
     pf_sample_cb pulse_cb;
+    pf_batch_cb batch_cb;
+    pf_batch *batch;            /* if set, samples go to batch_cb, not sample_cb */
     void *user_data;
+    time_t start_ts;
+    time_t end_ts;
+    unsigned sensors;           /* bitmask of sensors to deliver */
+    int need_temp;              /* zero to leave temperature undecoded */
     prev_pulse_t prev_pulses[MAX_SENSOR];
 };
 
@@ -46,9 +70,52 @@ extern pf_context *pf_new(void);
 extern void pf_free(pf_context * ctx);
 
 extern mf_status pf_filter_all(pf_context * ctx, time_t ts);
+extern mf_status pf_filter_range_forw(pf_context * ctx, time_t ts);
+extern mf_status pf_filter_range_back(pf_context * ctx, time_t ts);
 extern mf_status pf_default_pulse_cb(pf_context * ctx, pf_sample * smp);
 extern mf_status pf_parse_line(void *user_data, const void *file_data, size_t file_size);
+extern mf_status pf_parse_lines(void *user_data, const tf_span * spans, unsigned count);
+extern long long pf_line_time(const char *line, size_t len);
+extern mf_status pf_flush(pf_context * ctx);
+
+/*
+ * Deliver a power sample, either straight to the sample callback or by
+ * adding it to the batch, which is passed on when full.  A consumer of
+ * batches must call pf_flush when the parse is done for the last one.
+ */
+
+static inline mf_status pf_deliver(pf_context * ctx, pf_sample * smp)
+{
+    pf_batch *batch;
+    unsigned n;
+
+    if ((batch = ctx->batch) == NULL)
+        return ctx->sample_cb(ctx, smp);
+    n = batch->count++;
+    batch->timestamp[n] = smp->timestamp;
+    batch->sensor[n] = smp->sensor;
+    batch->temp[n] = smp->temp;
+    batch->watts[n] = smp->data.watts;
+    if (batch->count < PF_BATCH_SIZE)
+        return MF_SUCCESS;
+    return pf_flush(ctx);
+}
 
 #define pf_parse_file(ctx, file) \
-    tf_parse_file(file, ctx, ctx->file_cb, pf_parse_line)
+    tf_parse_spans(file, ctx, ctx->file_cb, pf_parse_lines)
+#define pf_parse_file_using(ctx, file, strategy) \
+    tf_parse_spans_using(file, strategy, ctx, ctx->file_cb, pf_parse_lines)
+#define pf_parse_range(ctx, file) \
+    tf_parse_range(file, ctx, pf_line_time, ctx->start_ts, ctx->end_ts, pf_parse_lines)
+#define pf_sample_range(ctx, file, stride, sampling) \
+    tf_sample_range(file, ctx, pf_line_time, ctx->start_ts, ctx->end_ts, stride, sampling, pf_parse_lines)
+
+/*
+ * Parse the day file of the UTC day starting at day, a day with no file
+ * having no samples, either all of it in order or, unless whole, just the
+ * part from the start time to the end time.
+ */
+
+extern mf_status pf_parse_day(pf_context * ctx, time_t day, int whole);
+
 #endif
@@ -0,0 +1,118 @@
+/*
+ * pf-bench
+ *
+ * Measures the line parser by running archive files through it with a
+ * sample callback that only counts, reporting lines and samples per second.
+ * With -B the samples are delivered in batches instead and -s chooses the
+ * I/O strategy, whose statistics are reported afterwards.
+ */
+
+#include "cc-common.h"
+#include "parsefile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+const char prog_name[] = "pf-bench";
+
+typedef struct {
+    pf_context *pf;
+    unsigned long lines;
+    unsigned long samples;
+} bench_t;
+
+static mf_status sample_cb(pf_context * pf, pf_sample * smp)
+{
+    bench_t *b = pf->user_data;
+    b->samples++;
+    return MF_SUCCESS;
+}
+
+static void print_io_stats(FILE *fp)
+{
+    mf_stat io[MF_NSTRATEGY];
+    int i;
+
+    mf_get_stats(io);
+    for (i = 0; i < MF_NSTRATEGY; i++)
+        if (io[i].files > 0)
+            fprintf(fp, "%-12s %6lu files %12llu bytes %10.3f ms\n", mf_strategy_names[i], io[i].files, io[i].bytes, io[i].nsecs / 1e6);
+}
+
+static mf_status batch_cb(pf_context * pf, pf_batch * batch)
+{
+    bench_t *b = pf->user_data;
+    b->samples += batch->count;
+    return MF_SUCCESS;
+}
+
+static mf_status span_cb(void *user_data, const tf_span * spans, unsigned count)
+{
+    bench_t *b = user_data;
+    b->lines += count;
+    return pf_parse_lines(b->pf, spans, count);
+}
+
+int main(int argc, char **argv)
+{
+    int status = 0, repeat = 1, c, i, j;
+    bench_t b;
+    mf_strategy strategy = MF_MAP_SEQ;
+    pf_batch *batch = NULL;
+    struct timespec start, end;
+    double secs;
+
+    while ((c = getopt(argc, argv, "Bn:s:")) != EOF) {
+        switch (c) {
+            case 'B':
+                if ((batch = malloc(sizeof(pf_batch))) == NULL) {
+                    log_syserr("unable to allocate sample batch");
+                    return 2;
+                }
+                batch->count = 0;
+                break;
+            case 'n':
+                repeat = atoi(optarg);
+                break;
+            case 's':
+                for (strategy = 0; strategy < MF_PREFETCH; strategy++)
+                    if (strcmp(optarg, mf_strategy_names[strategy]) == 0)
+                        break;
+                if (strategy == MF_PREFETCH) {
+                    fprintf(stderr, "pf-bench: unknown strategy '%s'\n", optarg);
+                    status = 1;
+                }
+                break;
+            default:
+                status = 1;
+        }
+    }
+    if (status || optind >= argc) {
+        fputs("Usage: pf-bench [ -B ] [ -n repeat ] [ -s strategy ] <xml-file> ...\n", stderr);
+        return 1;
+    }
+    if ((b.pf = pf_new())) {
+        b.pf->sample_cb = sample_cb;
+        b.pf->batch_cb = batch_cb;
+        b.pf->batch = batch;
+        b.pf->user_data = &b;
+        b.lines = b.samples = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < repeat; i++)
+            for (j = optind; j < argc; j++)
+                if (tf_parse_spans_using(argv[j], strategy, &b, tf_parse_cb_forward, span_cb) == MF_FAIL)
+                    status = 2;
+        pf_flush(b.pf);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%lu lines, %lu samples in %.3fs: %.0f lines/s\n", b.lines, b.samples, secs, b.lines / secs);
+        print_io_stats(stdout);
+        pf_free(b.pf);
+    }
+    else
+        status = 2;
+    return status;
+}
@@ -37,85 +37,44 @@ void log_db_err(PGconn *conn, const char *msg, ...)
     }
 }
 
-static const char *find_tok(const char *pat, const char *str, const char *end)
+static int set_value(sample_t *smp, int index, lt_span *span)
 {
-    const char *pat_ptr, *str_ptr;
-    int ch;
+    char *dst = smp->ptr.data_ptr;
 
-    while (str < end) {
-        str_ptr = str;
-        pat_ptr = pat;
-        ch = *pat_ptr++;
-        while (str_ptr < end && ch == *str_ptr) {
-            ch = *pat_ptr++;
-            str_ptr++;
-        }
-        if (!ch)
-            return str_ptr;
-        str++;
-    }
-    return NULL;
+    if (dst + span->len >= smp->data + MAX_DATA)
+        return 0;
+    memcpy(dst, span->ptr, span->len);
+    dst[span->len] = '\0';
+    smp->values[index] = dst;
+    smp->lengths[index] = span->len;
+    smp->ptr.data_ptr = dst + span->len + 1;
+    return 1;
 }
 
-const char *parse_int(sample_t *smp, int index, const char *pat, const char *str, const char *end)
-{
-    const char *src_ptr;
-    char *dst_start, *dst_ptr, *dst_max;
-    int ch;
-    size_t len;
+#define PG_COMMON (LT_BIT(LT_TMPR) | LT_BIT(LT_SENSOR) | LT_BIT(LT_ID))
+#define PG_FIELDS (PG_COMMON | LT_BIT(LT_WATTS) | LT_BIT(LT_IMP))
 
-    if ((src_ptr = find_tok(pat, str, end))) {
-        dst_ptr = dst_start = smp->ptr.data_ptr;
-        dst_max = smp->data + MAX_DATA;
-        while (src_ptr < end && dst_ptr < dst_max) {
-            ch = *src_ptr++;
-            if (ch >= '0' && ch <= '9')
-                *dst_ptr++ = ch;
-            else if (ch == '<') {
-                len = dst_ptr - dst_start;
-                if (len > 0) {
-                    *dst_ptr++ = '\0';
-                    smp->values[index] = dst_start;
-                    smp->lengths[index] = len;
-                    smp->ptr.data_ptr = dst_ptr;
-                    return src_ptr;
-                }
-            }
-            else
-                break;
-        }
-    }
-    return NULL;
-}
+/*
+ * Carry on tokenising a line from ptr and fill in the text parameters of
+ * an insert from the fields, returning the name of the prepared statement
+ * to use or NULL if the line does not hold a reading.
+ */
 
-const char *parse_real(sample_t *smp, int index, const char *pat, const char *str, const char *end)
+const char *pg_parse_line(sample_t *smp, lt_line *ln, const char *ptr, const char *end)
 {
-    const char *src_ptr;
-    char *dst_start, *dst_ptr, *dst_max;
-    int ch;
-    size_t len;
-
-    if ((src_ptr = find_tok(pat, str, end))) {
-        dst_ptr = dst_start = smp->ptr.data_ptr;
-        dst_max = smp->data + MAX_DATA;
-        while (src_ptr < end && dst_ptr < dst_max) {
-            ch = *src_ptr++;
-            if ((ch >= '0' && ch <= '9') || ch == '.')
-                *dst_ptr++ = ch;
-            else if (ch == '<') {
-                len = dst_ptr - dst_start;
-                if (len > 0) {
-                    *dst_ptr++ = '\0';
-                    smp->values[index] = dst_start;
-                    smp->lengths[index] = len;
-                    smp->ptr.data_ptr = dst_ptr;
-                    return src_ptr;
-                }
+    lt_scan(ln, PG_FIELDS, ptr, end);
+    smp->ptr.data_ptr = smp->data;
+    if ((ln->found & PG_COMMON) == PG_COMMON) {
+        if (set_value(smp, 3, &ln->text[LT_TMPR]) && set_value(smp, 1, &ln->text[LT_SENSOR]) && set_value(smp, 2, &ln->text[LT_ID])) {
+            if (ln->found & LT_BIT(LT_WATTS)) {
+                if (set_value(smp, 4, &ln->text[LT_WATTS]))
+                    return "power";
+            }
+            else if (ln->found & LT_BIT(LT_IMP)) {
+                if (set_value(smp, 4, &ln->text[LT_IMP]))
+                    return "pulse";
             }
-            else
-                break;
         }
     }
     return NULL;
 }
-
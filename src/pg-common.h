@@ -1,6 +1,8 @@
 #ifndef CC_PG_COMMON
 #define CC_PG_COMMON
 
+#include "linetok.h"
+
 #include <time.h>
 #include <libpq-fe.h>
 
@@ -26,7 +28,6 @@ extern const char power_sql[];
 extern const char pulse_sql[];
 
 extern void log_db_err(PGconn *conn, const char *msg, ...);
-extern const char *parse_int(sample_t *smp, int index, const char *pat, const char *str, const char *end);
-extern const char *parse_real(sample_t *smp, int index, const char *pat, const char *str, const char *end);
+extern const char *pg_parse_line(sample_t *smp, lt_line *ln, const char *ptr, const char *end);
 
 #endif
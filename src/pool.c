@@ -0,0 +1,33 @@
+#include "cc-common.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+int pool_size(int threads, unsigned ntasks)
+{
+    if (threads <= 0 && (threads = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+        threads = 1;
+    if (threads > POOL_MAX_THREADS)
+        threads = POOL_MAX_THREADS;
+    if ((unsigned) threads > ntasks)
+        threads = ntasks;
+    return threads;
+}
+
+int pool_run(void *(*run)(void *), void *workers, size_t size, int nworkers)
+{
+    pthread_t threads[POOL_MAX_THREADS];
+    int started, i;
+
+    for (started = 0; started < nworkers && started < POOL_MAX_THREADS; started++) {
+        if ((errno = pthread_create(threads + started, NULL, run, (char *) workers + started * size))) {
+            log_syserr("unable to start worker thread");
+            break;
+        }
+    }
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    return started;
+}
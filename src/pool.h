@@ -0,0 +1,38 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * A pool of threads works through a queue of tasks, each thread taking
+ * the next one not yet started until none are left.  Each thread runs on
+ * a worker of its own, set up beforehand by the caller, so it can keep
+ * what it makes apart from the others until they are all done.
+ */
+
+#define POOL_MAX_THREADS 8
+
+typedef struct {
+    unsigned count;
+    unsigned next;              /* the next task to take */
+} pool_queue;
+
+/* the index of a task to do, count or more once all are taken */
+#define pool_take(queue) __sync_fetch_and_add(&(queue)->next, 1)
+
+/*
+ * The number of threads for the tasks given the number wanted, or zero
+ * for one per CPU, up to POOL_MAX_THREADS and no more than the tasks.
+ */
+
+extern int pool_size(int threads, unsigned ntasks);
+
+/*
+ * Run each of the workers, which are size bytes apart, in a thread of
+ * its own and wait for them all, returning how many were run, which is
+ * fewer than asked if a thread could not be started.
+ */
+
+extern int pool_run(void *(*run)(void *), void *workers, size_t size, int nworkers);
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * rollup
+ *
+ * Rollups are kept in the directory cc-rollup under the data directory
+ * in files of RU_CHUNK records each, named for the resolution and the
+ * chunk number counted from the epoch, so a file of minutes holds one
+ * UTC day.  A day is rolled up from its day file, and the end of the day
+ * before so pulse sensors have a reading to work from, into minutes and
+ * those are added up into the hour and day records.  The file logger
+ * rolls up each day once it is over and xml2rollup rolls up the archive.
+ */
+
+#include "cc-common.h"
+#include "parsefile.h"
+#include "rollup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define RU_CHUNK     1440
+#define RU_MAGIC     0x5055524b
+#define RU_VERSION   2
+#define RU_LEAD_SECS 300
+
+const char rollup_dir[] = "cc-rollup";
+const time_t ru_resolutions[RU_LEVELS] = { 60, 3600, SECS_IN_DAY };
+
+typedef union {
+    struct {
+        unsigned magic;
+        unsigned version;
+        unsigned rec_size;
+        unsigned watts_scale;
+        unsigned temp_scale;
+        long res;
+        long chunk;
+    } h;
+    char pad[64];
+} ru_header;
+
+struct _ru_reader {
+    time_t res;
+    long chunk;
+    int fd;
+};
+
+static int chunk_open(time_t res, long chunk, int create)
+{
+    ru_header hdr;
+    ssize_t nbytes;
+    char file[PATH_MAX];
+    int fd;
+
+    snprintf(file, sizeof file, "%s/%ld-%ld", rollup_dir, (long) res, chunk);
+    if ((fd = open(file, create ? O_RDWR | O_CREAT : O_RDONLY, 0664)) < 0) {
+        if (errno != ENOENT || create)
+            log_syserr("unable to open rollup file '%s'", file);
+        return -1;
+    }
+    if ((nbytes = pread(fd, &hdr, sizeof hdr, 0)) == 0 && create) {
+        memset(&hdr, 0, sizeof hdr);
+        hdr.h.magic = RU_MAGIC;
+        hdr.h.version = RU_VERSION;
+        hdr.h.rec_size = sizeof(ru_record);
+        hdr.h.watts_scale = WATTS_SCALE;
+        hdr.h.temp_scale = TEMP_SCALE;
+        hdr.h.res = res;
+        hdr.h.chunk = chunk;
+        if (pwrite(fd, &hdr, sizeof hdr, 0) == sizeof hdr && ftruncate(fd, sizeof hdr + RU_CHUNK * sizeof(ru_record)) == 0)
+            return fd;
+        log_syserr("unable to initialise rollup file '%s'", file);
+    }
+    else if (nbytes < 0)
+        log_syserr("unable to read rollup file '%s'", file);
+    else if (nbytes == sizeof hdr && hdr.h.magic == RU_MAGIC && hdr.h.version == RU_VERSION && hdr.h.rec_size == sizeof(ru_record)
+             && hdr.h.watts_scale == WATTS_SCALE && hdr.h.temp_scale == TEMP_SCALE && hdr.h.res == res && hdr.h.chunk == chunk)
+        return fd;
+    else if (nbytes > 0)
+        log_msg("rollup file '%s' is from a different build", file);
+    close(fd);
+    return -1;
+}
+
+static int chunk_write(time_t res, time_t ts, unsigned count, const ru_record * recs)
+{
+    long index = ts / res;
+    int fd, status = -1;
+    size_t nbytes = count * sizeof(ru_record);
+
+    if ((fd = chunk_open(res, index / RU_CHUNK, 1)) >= 0) {
+        if (flock(fd, LOCK_EX) == 0) {
+            if (pwrite(fd, recs, nbytes, sizeof(ru_header) + (index % RU_CHUNK) * sizeof(ru_record)) == (ssize_t) nbytes)
+                status = 0;
+            else
+                log_syserr("unable to write rollup records");
+            flock(fd, LOCK_UN);
+        }
+        else
+            log_syserr("unable to lock rollup file");
+        close(fd);
+    }
+    return status;
+}
+
+ru_reader *ru_open(time_t res)
+{
+    ru_reader *rr;
+
+    if ((rr = malloc(sizeof(ru_reader)))) {
+        rr->res = res;
+        rr->chunk = -1;
+        rr->fd = -1;
+    }
+    else
+        log_syserr("unable to allocate rollup reader");
+    return rr;
+}
+
+void ru_close(ru_reader * rr)
+{
+    if (rr->fd >= 0)
+        close(rr->fd);
+    free(rr);
+}
+
+/*
+ * Read the count records from the one starting at ts, which must be a
+ * multiple of the resolution.  Those with no file are returned not done.
+ */
+
+int ru_read(ru_reader * rr, time_t ts, unsigned count, ru_record * recs)
+{
+    long index = ts / rr->res;
+    unsigned n;
+    size_t nbytes;
+
+    while (count > 0) {
+        if ((n = RU_CHUNK - index % RU_CHUNK) > count)
+            n = count;
+        if (index / RU_CHUNK != rr->chunk) {
+            if (rr->fd >= 0)
+                close(rr->fd);
+            rr->chunk = index / RU_CHUNK;
+            rr->fd = chunk_open(rr->res, rr->chunk, 0);
+        }
+        nbytes = n * sizeof(ru_record);
+        if (rr->fd < 0)
+            memset(recs, 0, nbytes);
+        else {
+            flock(rr->fd, LOCK_SH);
+            if (pread(rr->fd, recs, nbytes, sizeof(ru_header) + (index % RU_CHUNK) * sizeof(ru_record)) != (ssize_t) nbytes) {
+                log_syserr("unable to read rollup records");
+                flock(rr->fd, LOCK_UN);
+                return -1;
+            }
+            flock(rr->fd, LOCK_UN);
+        }
+        recs += n;
+        index += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static inline void add_value(ru_value * val, cc_real x)
+{
+    if (val->count++ == 0)
+        val->min = val->max = x;
+    else if (x < val->min)
+        val->min = x;
+    else if (x > val->max)
+        val->max = x;
+    val->sum += x;
+}
+
+static void merge_value(ru_value * dst, const ru_value * src)
+{
+    if (src->count > 0) {
+        if (dst->count == 0) {
+            dst->min = src->min;
+            dst->max = src->max;
+        }
+        else {
+            if (src->min < dst->min)
+                dst->min = src->min;
+            if (src->max > dst->max)
+                dst->max = src->max;
+        }
+        dst->sum += src->sum;
+        dst->count += src->count;
+    }
+}
+
+static void merge_records(ru_record * dst, const ru_record * src, unsigned count)
+{
+    int sens_num;
+
+    memset(dst, 0, sizeof(ru_record));
+    for (; count > 0; count--, src++) {
+        for (sens_num = 0; sens_num < RECV_SENSORS; sens_num++)
+            merge_value(dst->sensors + sens_num, src->sensors + sens_num);
+        merge_value(&dst->temp, &src->temp);
+        dst->beyond |= src->beyond;
+    }
+    dst->done = 1;
+}
+
+typedef struct {
+    time_t day;
+    ru_record mins[MINS_IN_DAY];
+    ru_record hours[24];
+    ru_record whole;
+} ru_day;
+
+static mf_status build_cb(pf_context * pf, pf_batch * batch)
+{
+    ru_day *rd = pf->user_data;
+    ru_record *rec;
+    time_t ts;
+    unsigned i;
+    int sens_num;
+
+    for (i = 0; i < batch->count; i++) {
+        ts = batch->timestamp[i];
+        if (ts >= rd->day && ts < rd->day + SECS_IN_DAY) {
+            rec = rd->mins + (ts - rd->day) / 60;
+            sens_num = batch->sensor[i];
+            if (sens_num >= 0 && sens_num < RECV_SENSORS)
+                add_value(rec->sensors + sens_num, batch->watts[i]);
+            else if (sens_num >= 0 && sens_num < MAX_SENSOR)
+                rec->beyond |= 1U << sens_num;
+            add_value(&rec->temp, batch->temp[i]);
+        }
+    }
+    return MF_SUCCESS;
+}
+
+/*
+ * Roll up a day from its day file, writing its minute, hour and day
+ * records.  A day with no file is rolled up as having no samples.
+ */
+
+int ru_build_day(time_t day)
+{
+    int status = -1, i;
+    ru_day *rd;
+    pf_context *pf;
+    pf_batch *batch;
+
+    day -= day % SECS_IN_DAY;
+    if ((rd = calloc(1, sizeof(ru_day)))) {
+        rd->day = day;
+        if ((batch = malloc(sizeof(pf_batch)))) {
+            if ((pf = pf_new())) {
+                batch->count = 0;
+                pf->batch = batch;
+                pf->batch_cb = build_cb;
+                pf->user_data = rd;
+                pf->file_cb = tf_parse_cb_forward;
+                pf->filter_cb = pf_filter_range_forw;
+                pf->start_ts = day - RU_LEAD_SECS;
+                pf->end_ts = day + SECS_IN_DAY;
+                pf->sensors = ~0U;
+                pf->need_temp = 1;
+                if (pf_parse_day(pf, day - SECS_IN_DAY, 0) == MF_SUCCESS && pf_parse_day(pf, day, 1) == MF_SUCCESS && pf_flush(pf) == MF_SUCCESS) {
+                    for (i = 0; i < MINS_IN_DAY; i++)
+                        rd->mins[i].done = 1;
+                    for (i = 0; i < 24; i++)
+                        merge_records(rd->hours + i, rd->mins + i * 60, 60);
+                    merge_records(&rd->whole, rd->hours, 24);
+                    if (chunk_write(60, day, MINS_IN_DAY, rd->mins) == 0 && chunk_write(3600, day, 24, rd->hours) == 0 && chunk_write(SECS_IN_DAY, day, 1, &rd->whole) == 0)
+                        status = 0;
+                }
+                pf_free(pf);
+            }
+            free(batch);
+        }
+        else
+            log_syserr("unable to allocate space for sample batch");
+        free(rd);
+    }
+    else
+        log_syserr("unable to allocate space for rollup");
+    return status;
+}
+
+/*
+ * Roll up the day given once it is over, unless it already has been, as
+ * it has when the logger is started again later that day.  Days
+ * missed, such as when the logger was not running at the change of day,
+ * are left to xml2rollup.  Nothing is done unless xml2rollup has made the
+ * rollup directory.
+ */
+
+int ru_update_day(time_t day)
+{
+    struct stat stb;
+    ru_reader *rr;
+    ru_record rec;
+    int done = 0;
+
+    if (stat(rollup_dir, &stb))
+        return errno == ENOENT ? 0 : -1;
+    day -= day % SECS_IN_DAY;
+    if ((rr = ru_open(SECS_IN_DAY))) {
+        done = ru_read(rr, day, 1, &rec) == 0 && rec.done;
+        ru_close(rr);
+    }
+    return done ? 0 : ru_build_day(day);
+}
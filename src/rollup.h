@@ -0,0 +1,52 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "cc-defs.h"
+
+#include <time.h>
+
+/*
+ * Rollups hold, for each minute, hour and day, the number of samples and
+ * their sum, minimum and maximum for each sensor and for the temperature
+ * so a long stretch of history can be drawn from a few records rather
+ * than from every sample.  A record is marked done once its period has
+ * been rolled up, so one that is done but empty had no samples.  Sensors
+ * beyond those of a receiver are not kept, only noted as seen, so the
+ * history of them is read from the samples.
+ */
+
+#ifdef FIXED_POINT
+typedef long long ru_sum;
+#else
+typedef double ru_sum;
+#endif
+
+typedef struct {
+    ru_sum sum;
+    cc_real min;
+    cc_real max;
+    unsigned count;
+} ru_value;
+
+typedef struct {
+    ru_value sensors[RECV_SENSORS];
+    ru_value temp;
+    unsigned beyond;            /* bitmask of sensors seen but not kept */
+    unsigned done;
+} ru_record;
+
+#define RU_LEVELS 3
+
+extern const time_t ru_resolutions[RU_LEVELS];
+extern const char rollup_dir[];
+
+typedef struct _ru_reader ru_reader;
+
+extern ru_reader *ru_open(time_t res);
+extern void ru_close(ru_reader * rr);
+extern int ru_read(ru_reader * rr, time_t ts, unsigned count, ru_record * recs);
+
+extern int ru_build_day(time_t day);
+extern int ru_update_day(time_t day);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * sketch
+ *
+ * Quantile sketches of power.  Samples are binned on tenths of a watt so
+ * builds with and without FIXED_POINT put the same sample in the same bin.
+ */
+
+#include "sketch.h"
+
+#ifdef FIXED_POINT
+#define sk_key(w) ((long) (w) * 10 / WATTS_SCALE)
+#else
+#define sk_key(w) ((long) ((w) * 10 + 0.5))
+#endif
+
+static int sk_bin(long key)
+{
+    int shift;
+
+    if (key <= 0)
+        return 0;
+    if (key < SK_EXACT)
+        return key;
+    if (key >= 1L << SK_MAX_BITS)
+        return SK_BINS - 1;
+    shift = (int) (sizeof(long) * 8 - 1) - __builtin_clzl(key) - SK_SUB_BITS;
+    return SK_EXACT + (shift - 1) * SK_SUB + (int) (key >> shift) - SK_SUB;
+}
+
+/*
+ * The bounds of a bin in tenths of a watt, the high one being the first
+ * value above the bin.
+ */
+
+static long bin_low(int bin)
+{
+    int shift;
+
+    if (bin < SK_EXACT)
+        return bin;
+    shift = (bin - SK_EXACT) / SK_SUB + 1;
+    return (long) (SK_SUB + (bin - SK_EXACT) % SK_SUB) << shift;
+}
+
+static long bin_high(int bin)
+{
+    if (bin == 0)
+        return 0;
+    if (bin == SK_BINS - 1)
+        return 1L << SK_MAX_BITS;
+    return bin_low(bin + 1);
+}
+
+void sk_add(sketch *sk, cc_real watts)
+{
+    sk->bins[sk_bin(sk_key(watts))]++;
+    sk->count++;
+}
+
+void sk_merge(sketch *dst, const sketch *src)
+{
+    int i;
+
+    if (src->count > 0) {
+        for (i = 0; i < SK_BINS; i++)
+            dst->bins[i] += src->bins[i];
+        dst->count += src->count;
+    }
+}
+
+/*
+ * The sample q of the way through in order, as the middle of its bin, or
+ * -1 with no samples.
+ */
+
+double sk_quantile(const sketch *sk, double q)
+{
+    unsigned rank, seen = 0;
+    int i;
+
+    if (sk->count == 0)
+        return -1;
+    if (q <= 0)
+        rank = 0;
+    else if (q >= 1)
+        rank = sk->count - 1;
+    else
+        rank = q * (sk->count - 1);
+    for (i = 0; i < SK_BINS - 1 && (seen += sk->bins[i]) <= rank; i++);
+    if (bin_high(i) <= bin_low(i) + 1)
+        return bin_low(i) / 10.0;
+    return (bin_low(i) + bin_high(i) - 1) / 20.0;
+}
+
+double sk_bin_low(int bin)
+{
+    return bin_low(bin) / 10.0;
+}
+
+double sk_bin_high(int bin)
+{
+    return bin_high(bin) / 10.0;
+}
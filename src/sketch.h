@@ -0,0 +1,33 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include "cc-defs.h"
+
+/*
+ * A quantile sketch counts the power samples in bins whose width grows
+ * with the power, the first SK_EXACT tenths of a watt exactly and above
+ * that SK_SUB bins to each doubling, so any quantile taken from it is
+ * within about 3% of the true one.  It takes the same memory however many
+ * samples it has seen, and two are merged exactly by adding their bins,
+ * so the order samples are added or sketches merged in makes no
+ * difference.  Power at or below zero goes in bin 0.
+ */
+
+#define SK_SUB_BITS 4
+#define SK_SUB      (1 << SK_SUB_BITS)
+#define SK_EXACT    (2 * SK_SUB)
+#define SK_MAX_BITS 24          /* above 1.6MW goes in the last bin */
+#define SK_BINS     (SK_EXACT + (SK_MAX_BITS - SK_SUB_BITS - 1) * SK_SUB)
+
+typedef struct {
+    unsigned count;
+    unsigned bins[SK_BINS];
+} sketch;
+
+extern void sk_add(sketch *sk, cc_real watts);
+extern void sk_merge(sketch *dst, const sketch *src);
+extern double sk_quantile(const sketch *sk, double q);
+extern double sk_bin_low(int bin);
+extern double sk_bin_high(int bin);
+
+#endif
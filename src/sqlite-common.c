@@ -0,0 +1,61 @@
+/*
+ * sqlite-common
+ *
+ * Schema and statements shared by the programs that write to or read
+ * from the SQLite database.  Both tables are keyed on time so they are
+ * stored in time order and range queries are index scans.  The key keeps
+ * the microseconds of the time stamp, so readings a sensor sends within
+ * the same second are all kept while a file imported twice still adds
+ * each reading once.  A database made before the usecs column was added
+ * has to be built again.
+ */
+
+#include "cc-defs.h"
+#include "cc-common.h"
+#include "sqlite-common.h"
+
+#include <stdio.h>
+
+const char sqlite_db_file[] = DEFAULT_DIR "/cc.db";
+
+const char sqlite_schema[] =
+    "CREATE TABLE IF NOT EXISTS samples ("
+    "    time_stamp  INTEGER NOT NULL,"
+    "    usecs       INTEGER NOT NULL,"
+    "    temperature REAL,"
+    "    sensor      INTEGER NOT NULL,"
+    "    watts       REAL,"
+    "    PRIMARY KEY (time_stamp, usecs, sensor)"
+    ") WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS pulses ("
+    "    time_stamp  INTEGER NOT NULL,"
+    "    usecs       INTEGER NOT NULL,"
+    "    temperature REAL,"
+    "    sensor      INTEGER NOT NULL,"
+    "    count       INTEGER,"
+    "    ipu         INTEGER,"
+    "    PRIMARY KEY (time_stamp, usecs, sensor)"
+    ") WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS import_ledger ("
+    "    path        TEXT PRIMARY KEY,"
+    "    size        INTEGER,"
+    "    mtime       INTEGER,"
+    "    byte_offset INTEGER,"
+    "    last_stamp  INTEGER"
+    ");";
+
+const char sqlite_sample_sql[] =
+    "INSERT OR IGNORE INTO samples (time_stamp, temperature, sensor, watts, usecs) VALUES (?, ?, ?, ?, ?)";
+const char sqlite_pulse_sql[] =
+    "INSERT OR IGNORE INTO pulses (time_stamp, temperature, sensor, count, ipu, usecs) VALUES (?, ?, ?, ?, ?, ?)";
+
+void log_sqlite_err(sqlite3 *db, const char *msg, ...)
+{
+    va_list ap;
+    char buf[200];
+
+    va_start(ap, msg);
+    vsnprintf(buf, sizeof buf, msg, ap);
+    va_end(ap);
+    log_msg("%s: %s (%d)", buf, sqlite3_errmsg(db), sqlite3_errcode(db));
+}
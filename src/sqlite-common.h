@@ -0,0 +1,13 @@
+#ifndef CC_SQLITE_COMMON
+#define CC_SQLITE_COMMON
+
+#include <sqlite3.h>
+
+extern const char sqlite_db_file[];
+extern const char sqlite_schema[];
+extern const char sqlite_sample_sql[];
+extern const char sqlite_pulse_sql[];
+
+extern void log_sqlite_err(sqlite3 *db, const char *msg, ...);
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * sqlite-logger
+ *
+ * A live sink that writes samples to a SQLite database, for machines where
+ * running PostgreSQL is too heavy.  The read thread only parses the line
+ * and queues it; a writer thread owns the database and inserts in batched
+ * transactions, committing every BATCH_ROWS rows or BATCH_MSECS since the
+ * transaction began, whichever comes first.  The database is in WAL mode
+ * with automatic checkpoints off, and the writer thread checkpoints every
+ * CHECKPOINT_SECS so the read thread never waits on one.  The queue is a
+ * ring of QUEUE_SAMPLES allocated up front; should the writer fall that
+ * far behind, say on a busy database or a slow SD card, new samples are
+ * dropped rather than let the daemon grow without limit.
+ */
+
+#include "cc-common.h"
+#include "linetok.h"
+#include "sqlite-common.h"
+#include "sqlite-logger.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BATCH_ROWS      256
+#define BATCH_MSECS     5000
+#define CHECKPOINT_SECS 300
+#define QUEUE_SAMPLES   4096
+
+typedef struct {
+    time_t timestamp;
+    unsigned usecs;
+    double temp;
+    int sensor;
+    int is_pulse;
+    double watts;
+    long count;
+    int ipu;
+} sl_sample;
+
+struct _sqlite_logger_t {
+    sqlite3 *db;
+    sqlite3_stmt *sample_stmt;
+    sqlite3_stmt *pulse_stmt;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wait_data;
+    unsigned first;             /* the oldest sample queued */
+    unsigned count;             /* samples queued, including those being written */
+    unsigned long dropped;      /* samples dropped since the queue filled */
+    int done;
+    sl_sample queue[QUEUE_SAMPLES];
+};
+
+static const char pragma_sql[] =
+    "PRAGMA journal_mode=WAL;"
+    "PRAGMA synchronous=NORMAL;"
+    "PRAGMA wal_autocheckpoint=0;";
+
+static int db_exec(sqlite3 *db, const char *sql)
+{
+    int rc;
+
+    if ((rc = sqlite3_exec(db, sql, NULL, NULL, NULL)) != SQLITE_OK)
+        log_sqlite_err(db, "unable to execute '%s'", sql);
+    return rc;
+}
+
+static int db_setup(sqlite_logger_t *sl, const char *db_file)
+{
+    int rc;
+
+    if ((rc = sqlite3_open(db_file, &sl->db)) == SQLITE_OK) {
+        sqlite3_busy_timeout(sl->db, BATCH_MSECS);
+        if ((rc = sqlite3_exec(sl->db, pragma_sql, NULL, NULL, NULL)) == SQLITE_OK) {
+            if ((rc = sqlite3_exec(sl->db, sqlite_schema, NULL, NULL, NULL)) == SQLITE_OK) {
+                if ((rc = sqlite3_prepare_v2(sl->db, sqlite_sample_sql, -1, &sl->sample_stmt, NULL)) == SQLITE_OK) {
+                    if ((rc = sqlite3_prepare_v2(sl->db, sqlite_pulse_sql, -1, &sl->pulse_stmt, NULL)) == SQLITE_OK) {
+                        log_msg("sqlite database '%s' ready", db_file);
+                        return rc;
+                    }
+                    else
+                        log_sqlite_err(sl->db, "unable to prepare pulse insert statement");
+                    sqlite3_finalize(sl->sample_stmt);
+                }
+                else
+                    log_sqlite_err(sl->db, "unable to prepare sample insert statement");
+            }
+            else
+                log_sqlite_err(sl->db, "unable to create tables");
+        }
+        else
+            log_sqlite_err(sl->db, "unable to set database options");
+    }
+    else
+        log_sqlite_err(sl->db, "unable to open sqlite database '%s'", db_file);
+    sqlite3_close(sl->db);
+    return rc;
+}
+
+static void db_insert(sqlite_logger_t *sl, sl_sample *smp)
+{
+    sqlite3_stmt *stmt;
+
+    if (smp->is_pulse) {
+        stmt = sl->pulse_stmt;
+        sqlite3_bind_int64(stmt, 4, smp->count);
+        sqlite3_bind_int(stmt, 5, smp->ipu);
+        sqlite3_bind_int(stmt, 6, smp->usecs);
+    }
+    else {
+        stmt = sl->sample_stmt;
+        sqlite3_bind_double(stmt, 4, smp->watts);
+        sqlite3_bind_int(stmt, 5, smp->usecs);
+    }
+    sqlite3_bind_int64(stmt, 1, smp->timestamp);
+    sqlite3_bind_double(stmt, 2, smp->temp);
+    sqlite3_bind_int(stmt, 3, smp->sensor);
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        log_sqlite_err(sl->db, "unable to insert %s", smp->is_pulse ? "pulse" : "sample");
+    sqlite3_reset(stmt);
+}
+
+static inline long msecs_since(struct timespec *then, struct timespec *now)
+{
+    return (now->tv_sec - then->tv_sec) * 1000 + (now->tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static void *db_thread(void *ptr)
+{
+    sqlite_logger_t *sl = ptr;
+    struct timespec txn_start, last_ckpt, now, deadline;
+    unsigned first, count, i;
+    int rows = 0, done = 0, in_txn = 0;
+
+    clock_gettime(CLOCK_REALTIME, &last_ckpt);
+    while (!done) {
+        pthread_mutex_lock(&sl->lock);
+        while (sl->count == 0 && !sl->done) {
+            if (in_txn) {
+                deadline = txn_start;
+                deadline.tv_sec += BATCH_MSECS / 1000;
+                deadline.tv_nsec += (BATCH_MSECS % 1000) * 1000000;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_nsec -= 1000000000;
+                    deadline.tv_sec++;
+                }
+                if (pthread_cond_timedwait(&sl->wait_data, &sl->lock, &deadline) == ETIMEDOUT)
+                    break;
+            }
+            else
+                pthread_cond_wait(&sl->wait_data, &sl->lock);
+        }
+        first = sl->first;
+        count = sl->count;
+        done = sl->done;
+        pthread_mutex_unlock(&sl->lock);
+
+        /* the samples taken stay counted as queued until written, so the read thread leaves them be */
+        for (i = 0; i < count; i++) {
+            if (!in_txn) {
+                if (db_exec(sl->db, "BEGIN") == SQLITE_OK) {
+                    clock_gettime(CLOCK_REALTIME, &txn_start);
+                    in_txn = 1;
+                }
+            }
+            db_insert(sl, sl->queue + (first + i) % QUEUE_SAMPLES);
+            rows++;
+        }
+        if (count) {
+            pthread_mutex_lock(&sl->lock);
+            sl->first = (first + count) % QUEUE_SAMPLES;
+            sl->count -= count;
+            pthread_mutex_unlock(&sl->lock);
+        }
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (in_txn && (done || rows >= BATCH_ROWS || msecs_since(&txn_start, &now) >= BATCH_MSECS)) {
+            db_exec(sl->db, "COMMIT");
+            in_txn = 0;
+            rows = 0;
+        }
+        if (!in_txn && (done || now.tv_sec - last_ckpt.tv_sec >= CHECKPOINT_SECS)) {
+            if (sqlite3_wal_checkpoint_v2(sl->db, NULL, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL) != SQLITE_OK)
+                log_sqlite_err(sl->db, "checkpoint failed");
+            last_ckpt = now;
+        }
+    }
+    return NULL;
+}
+
+static void enqueue(sqlite_logger_t *sl, sl_sample *smp)
+{
+    unsigned long dropped = 0;
+    int full;
+
+    pthread_mutex_lock(&sl->lock);
+    if (!(full = sl->count == QUEUE_SAMPLES)) {
+        sl->queue[(sl->first + sl->count++) % QUEUE_SAMPLES] = *smp;
+        dropped = sl->dropped;
+        sl->dropped = 0;
+        pthread_cond_signal(&sl->wait_data);
+    }
+    else if (sl->dropped++ == 0)
+        dropped = 1;
+    pthread_mutex_unlock(&sl->lock);
+
+    if (full) {
+        if (dropped)
+            log_msg("sqlite queue is full, dropping samples until the writer catches up");
+    }
+    else if (dropped)
+        log_msg("sqlite writer caught up, %lu samples were dropped", dropped);
+}
+
+#define SAMPLE_FIELDS (LT_BIT(LT_TMPR) | LT_BIT(LT_SENSOR) | LT_BIT(LT_WATTS) | LT_BIT(LT_IMP) | LT_BIT(LT_IPU))
+#define PULSE_FIELDS  (LT_BIT(LT_IMP) | LT_BIT(LT_IPU))
+
+extern void sqlite_logger_line(sqlite_logger_t *sl, struct timespec *when, const char *line, const char *end)
+{
+    sl_sample smp;
+    lt_line ln;
+
+    lt_init(&ln);
+    lt_scan(&ln, SAMPLE_FIELDS, line, end);
+    if ((ln.found & LT_BIT(LT_TMPR)) && (ln.found & LT_BIT(LT_SENSOR))) {
+        if ((ln.found & LT_BIT(LT_WATTS)) || (ln.found & PULSE_FIELDS) == PULSE_FIELDS) {
+            smp.timestamp = when->tv_sec;
+            smp.usecs = when->tv_nsec / 1000;
+            smp.temp = temp_to_double(ln.temp);
+            smp.sensor = ln.sensor;
+            if (ln.found & LT_BIT(LT_WATTS)) {
+                smp.is_pulse = 0;
+                smp.watts = watts_to_double(ln.watts);
+            }
+            else {
+                smp.is_pulse = 1;
+                smp.count = ln.count;
+                smp.ipu = ln.ipu;
+            }
+            enqueue(sl, &smp);
+        }
+    }
+}
+
+extern sqlite_logger_t *sqlite_logger_new(const char *db_file)
+{
+    sqlite_logger_t *sl;
+    int res;
+
+    if ((sl = malloc(sizeof(sqlite_logger_t)))) {
+        if (db_setup(sl, db_file) == SQLITE_OK) {
+            sl->first = 0;
+            sl->count = 0;
+            sl->dropped = 0;
+            sl->done = 0;
+            if ((res = pthread_mutex_init(&sl->lock, NULL)) == 0)
+                if ((res = pthread_cond_init(&sl->wait_data, NULL)) == 0)
+                    if ((res = pthread_create(&sl->thread, NULL, db_thread, sl)) == 0)
+                        return sl;
+            log_msg("unable to create sqlite thread - %s", strerror(res));
+            sqlite3_finalize(sl->pulse_stmt);
+            sqlite3_finalize(sl->sample_stmt);
+            sqlite3_close(sl->db);
+        }
+        free(sl);
+    }
+    else
+        log_syserr("unable to allocate sqlite-logger");
+    return NULL;
+}
+
+extern void sqlite_logger_free(sqlite_logger_t *sl)
+{
+    pthread_mutex_lock(&sl->lock);
+    sl->done = 1;
+    pthread_cond_signal(&sl->wait_data);
+    pthread_mutex_unlock(&sl->lock);
+    pthread_join(sl->thread, NULL);
+    pthread_cond_destroy(&sl->wait_data);
+    pthread_mutex_destroy(&sl->lock);
+    sqlite3_finalize(sl->pulse_stmt);
+    sqlite3_finalize(sl->sample_stmt);
+    sqlite3_close(sl->db);
+    free(sl);
+}
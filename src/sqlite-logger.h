@@ -0,0 +1,12 @@
+#ifndef CC_SQLITE_LOGGER
+#define CC_SQLITE_LOGGER
+
+#include <sys/time.h>
+
+typedef struct _sqlite_logger_t sqlite_logger_t;
+
+extern sqlite_logger_t *sqlite_logger_new(const char *db_file);
+extern void sqlite_logger_free(sqlite_logger_t *logger);
+extern void sqlite_logger_line(sqlite_logger_t *sqlite_logger, struct timespec *when, const char *line, const char *end);
+
+#endif
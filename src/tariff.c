@@ -0,0 +1,463 @@
+/*
+ * tariff
+ *
+ * Costs the history with a time of use tariff.  Each day file is read by
+ * one of a pool of threads, along with the last minutes of the day before
+ * so pulse sensors have a reading to work from and the minute rule of the
+ * energy index has a mean to hold, into the sum and count of each
+ * sensor's samples in each minute.  The minutes are then worked out as
+ * the energy index does and each one's energy put in its tariff band in
+ * the bill for its month, the bills of the days being added up in order
+ * once all have been read.
+ */
+
+#include "cc-common.h"
+#include "energy.h"
+#include "parsefile.h"
+#include "pool.h"
+#include "tariff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define TARIFF_SENSORS     ((1U << SENSOR_CLAMP) | (1U << SENSOR_SOLAR) | (1U << SENSOR_IMPORT))
+#define COST_MINS          (EN_HOLD + MINS_IN_DAY)
+
+static const char *const day_names[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+static const char *const month_names[] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
+
+static int name_index(const char *const *names, int count, const char *str, size_t len)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (strlen(names[i]) == len && strncasecmp(names[i], str, len) == 0)
+            return i;
+    return -1;
+}
+
+/*
+ * A list of names and ranges of them, such as mon-fri,sun, as a bit for
+ * each name included.
+ */
+
+static int parse_set(const char *const *names, int count, const char *str, unsigned *set)
+{
+    size_t len, first;
+    int from, to;
+
+    for (*set = 0; *str; str += len + (str[len] == ',')) {
+        len = strcspn(str, ",");
+        first = strcspn(str, "-");
+        if (first > len)
+            first = len;
+        if ((from = name_index(names, count, str, first)) < 0)
+            return -1;
+        to = from;
+        if (first < len && (to = name_index(names, count, str + first + 1, len - first - 1)) < 0)
+            return -1;
+        for (*set |= 1U << from; from != to; *set |= 1U << from)
+            from = (from + 1) % count;
+    }
+    return 0;
+}
+
+static int parse_times(const char *str, tariff_band * band)
+{
+    int h1, m1, h2, m2;
+    char c;
+
+    if (sscanf(str, "%d:%d-%d:%d%c", &h1, &m1, &h2, &m2, &c) != 4 || h1 < 0 || h1 > 24 || h2 < 0 || h2 > 24 || m1 < 0 || m1 > 59 || m2 < 0 || m2 > 59)
+        return -1;
+    band->from = (h1 * 60 + m1) % MINS_IN_DAY;
+    band->to = (h2 * 60 + m2) % MINS_IN_DAY;
+    return 0;
+}
+
+static int parse_band(tariff_band * band, char **save, const char *file, int line_num)
+{
+    char *word, *end;
+    unsigned set;
+
+    if ((word = strtok_r(NULL, " \t\n", save)) == NULL || strlen(word) >= sizeof(band->name)) {
+        log_msg("%s:%d: missing or overlong band name", file, line_num);
+        return -1;
+    }
+    strcpy(band->name, word);
+    if ((word = strtok_r(NULL, " \t\n", save)) == NULL || (band->rate = strtod(word, &end), *end)) {
+        log_msg("%s:%d: missing or bad rate", file, line_num);
+        return -1;
+    }
+    band->days = (1U << 7) - 1;
+    band->months = (1U << 12) - 1;
+    band->from = band->to = 0;
+    while ((word = strtok_r(NULL, " \t\n", save))) {
+        if (strchr(word, ':')) {
+            if (parse_times(word, band) == 0)
+                continue;
+        }
+        else if (parse_set(day_names, 7, word, &set) == 0) {
+            band->days = set;
+            continue;
+        }
+        else if (parse_set(month_names, 12, word, &set) == 0) {
+            band->months = set;
+            continue;
+        }
+        log_msg("%s:%d: '%s' is not days, months or times", file, line_num, word);
+        return -1;
+    }
+    return 0;
+}
+
+tariff *tariff_load(const char *file)
+{
+    tariff *tf;
+    tariff_band *band;
+    FILE *fp;
+    char line[200], *ptr, *word, *save;
+    int line_num = 0, status = 0;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        log_syserr("unable to open tariff '%s'", file);
+        return NULL;
+    }
+    if ((tf = malloc(sizeof(tariff)))) {
+        tf->standing = 0;
+        tf->nbands = 0;
+        while (status == 0 && fgets(line, sizeof line, fp)) {
+            line_num++;
+            if ((ptr = strchr(line, '#')))
+                *ptr = '\0';
+            if ((word = strtok_r(line, " \t\n", &save)) == NULL)
+                continue;
+            if (strcmp(word, "standing") == 0) {
+                if ((word = strtok_r(NULL, " \t\n", &save)) == NULL || (tf->standing = strtod(word, &ptr), *ptr)) {
+                    log_msg("%s:%d: missing or bad standing charge", file, line_num);
+                    status = -1;
+                }
+            }
+            else if (strcmp(word, "import") == 0 || strcmp(word, "export") == 0) {
+                if (tf->nbands == TARIFF_MAX_BANDS) {
+                    log_msg("%s:%d: more than %d bands", file, line_num, TARIFF_MAX_BANDS);
+                    status = -1;
+                }
+                else {
+                    band = tf->bands + tf->nbands;
+                    band->flow = *word == 'i' ? TARIFF_IMPORT : TARIFF_EXPORT;
+                    if ((status = parse_band(band, &save, file, line_num)) == 0)
+                        tf->nbands++;
+                }
+            }
+            else {
+                log_msg("%s:%d: unknown entry '%s'", file, line_num, word);
+                status = -1;
+            }
+        }
+        if (status) {
+            free(tf);
+            tf = NULL;
+        }
+    }
+    else
+        log_syserr("unable to allocate tariff");
+    fclose(fp);
+    return tf;
+}
+
+void tariff_free(tariff * tf)
+{
+    free(tf);
+}
+
+int tariff_find(const tariff * tf, tariff_flow flow, const struct tm *tm)
+{
+    const tariff_band *band;
+    int min = tm->tm_hour * 60 + tm->tm_min, i;
+
+    for (i = 0, band = tf->bands; i < tf->nbands; i++, band++) {
+        if (band->flow == flow && (band->days & (1U << tm->tm_wday)) && (band->months & (1U << tm->tm_mon))
+            && (band->from == band->to || (band->from < band->to ? min >= band->from && min < band->to : min >= band->from || min < band->to)))
+            return i;
+    }
+    return -1;
+}
+
+double tariff_total(const tariff * tf, const tariff_bill * bill)
+{
+    const tariff_band *band;
+    double total;
+    int i;
+
+    total = tf->standing * bill->days;
+    for (i = 0, band = tf->bands; i < tf->nbands; i++, band++)
+        total += band->flow == TARIFF_IMPORT ? bill->kwh[i] * band->rate : -bill->kwh[i] * band->rate;
+    return total;
+}
+
+int tariff_threads = 0;
+
+typedef struct {
+    double sum[RECV_SENSORS];
+    unsigned count[RECV_SENSORS];
+} cost_minute;
+
+typedef struct {
+    time_t day;
+    time_t start;               /* the part of the day billed */
+    time_t end;
+    mf_status status;
+    int nparts;
+    tariff_bill parts[2];       /* a UTC day is in at most two local months */
+} day_task;
+
+typedef struct {
+    const tariff *tf;
+    time_t start;
+    day_task *tasks;
+    pool_queue queue;
+} cost_job;
+
+typedef struct {
+    cost_job *job;
+    pf_context *pf;
+    pf_batch *batch;
+    time_t first;               /* the start of mins[0] */
+    cost_minute *mins;
+} cost_worker;
+
+static mf_status cost_cb(pf_context * pf, pf_batch * batch)
+{
+    cost_worker *w = pf->user_data;
+    cost_minute *min;
+    time_t ts;
+    unsigned i;
+    int sens_num;
+
+    for (i = 0; i < batch->count; i++) {
+        ts = batch->timestamp[i];
+        sens_num = batch->sensor[i];
+        if (ts >= w->first && ts < w->first + COST_MINS * 60 && sens_num >= 0 && sens_num < RECV_SENSORS) {
+            min = w->mins + (ts - w->first) / 60;
+            min->sum[sens_num] += watts_to_double(batch->watts[i]);
+            min->count[sens_num]++;
+        }
+    }
+    return MF_SUCCESS;
+}
+
+static tariff_bill *task_part(day_task * task, const struct tm *tm)
+{
+    tariff_bill *bill;
+
+    if (task->nparts > 0 && (bill = task->parts + task->nparts - 1)->year == tm->tm_year + 1900 && bill->month == tm->tm_mon)
+        return bill;
+    if (task->nparts < 2)
+        task->nparts++;
+    bill = task->parts + task->nparts - 1;
+    memset(bill, 0, sizeof(tariff_bill));
+    bill->year = tm->tm_year + 1900;
+    bill->month = tm->tm_mon;
+    return bill;
+}
+
+/*
+ * Each minute billed imports or exports by its grid power, as the
+ * history's total is worked out.  A day is charged for at its local
+ * midnight, or at the start of the range if that falls within it.  The
+ * local time is only looked up every quarter hour, as zones are all a
+ * whole number of quarter hours from UTC, so the minutes in between are
+ * in the same local hour.
+ */
+
+static void cost_day(const tariff * tf, cost_worker * w, day_task * task)
+{
+    tariff_bill *bill = NULL;
+    tariff_flow flow;
+    en_state st;
+    struct tm tm;
+    time_t ts;
+    double grid, kwh;
+    int m, band;
+
+    en_state_init(&st);
+    for (m = 0; m < COST_MINS; m++) {
+        en_add_minute(&st, w->mins[m].sum, w->mins[m].count);
+        ts = w->first + m * 60;
+        if (ts < task->start || ts >= task->end)
+            continue;
+        if (bill == NULL || ts % 900 == 0) {
+            localtime_r(&ts, &tm);
+            bill = task_part(task, &tm);
+        }
+        else
+            tm.tm_min++;
+        grid = grid_power(st.watts[SENSOR_IMPORT], st.watts[SENSOR_CLAMP]) / 60000;
+        if (grid > 0) {
+            flow = TARIFF_IMPORT;
+            kwh = grid;
+        }
+        else {
+            flow = TARIFF_EXPORT;
+            kwh = -grid;
+        }
+        if ((band = tariff_find(tf, flow, &tm)) >= 0)
+            bill->kwh[band] += kwh;
+        else
+            bill->unbanded[flow] += kwh;
+        if ((tm.tm_hour == 0 && tm.tm_min == 0) || ts == w->job->start)
+            bill->days++;
+    }
+}
+
+static void *cost_worker_run(void *arg)
+{
+    cost_worker *w = arg;
+    cost_job *job = w->job;
+    day_task *task;
+    prev_pulse_t *prev;
+    unsigned i;
+    int sens_num;
+
+    while ((i = pool_take(&job->queue)) < job->queue.count) {
+        task = job->tasks + i;
+        for (sens_num = 0; sens_num < RECV_SENSORS; sens_num++) {
+            prev = w->pf->prev_pulses + sens_num;
+            prev->timestamp = 0;
+            prev->count = -1;
+            prev->ipu = 0;
+        }
+        memset(w->mins, 0, COST_MINS * sizeof(cost_minute));
+        w->first = w->pf->start_ts = task->day - EN_HOLD * 60;
+        w->pf->end_ts = task->day + SECS_IN_DAY;
+        if ((task->status = pf_parse_day(w->pf, task->day - SECS_IN_DAY, 0)) == MF_SUCCESS
+            && (task->status = pf_parse_day(w->pf, task->day, 1)) == MF_SUCCESS && (task->status = pf_flush(w->pf)) == MF_SUCCESS)
+            cost_day(job->tf, w, task);
+    }
+    return NULL;
+}
+
+static int worker_init(cost_worker * w, cost_job * job)
+{
+    w->job = job;
+    if ((w->mins = malloc(COST_MINS * sizeof(cost_minute)))) {
+        if ((w->batch = malloc(sizeof(pf_batch)))) {
+            if ((w->pf = pf_new())) {
+                w->batch->count = 0;
+                w->pf->file_cb = tf_parse_cb_forward;
+                w->pf->filter_cb = pf_filter_range_forw;
+                w->pf->batch_cb = cost_cb;
+                w->pf->batch = w->batch;
+                w->pf->user_data = w;
+                w->pf->sensors = TARIFF_SENSORS;
+                w->pf->need_temp = 0;
+                return 0;
+            }
+            free(w->batch);
+        }
+        else
+            log_syserr("unable to allocate space for sample batch");
+        free(w->mins);
+    }
+    else
+        log_syserr("unable to allocate space for costing minutes");
+    return -1;
+}
+
+static void worker_free(cost_worker * w)
+{
+    pf_free(w->pf);
+    free(w->batch);
+    free(w->mins);
+}
+
+static void add_bill(tariff_bill * dst, const tariff_bill * src)
+{
+    int i;
+
+    dst->days += src->days;
+    for (i = 0; i < TARIFF_MAX_BANDS; i++)
+        dst->kwh[i] += src->kwh[i];
+    for (i = 0; i < TARIFF_FLOWS; i++)
+        dst->unbanded[i] += src->unbanded[i];
+}
+
+static int merge_bills(const day_task * tasks, int ntasks, tariff_bill ** bills, int *nbills)
+{
+    const day_task *task;
+    const tariff_bill *part;
+    tariff_bill *list = NULL, *bill;
+    int count = 0, size = 0;
+
+    for (task = tasks; task < tasks + ntasks; task++) {
+        for (part = task->parts; part < task->parts + task->nparts; part++) {
+            if (count > 0 && (bill = list + count - 1)->year == part->year && bill->month == part->month)
+                add_bill(bill, part);
+            else {
+                if (count == size) {
+                    size = size ? size * 2 : 12;
+                    if ((bill = realloc(list, size * sizeof(tariff_bill))) == NULL) {
+                        log_syserr("unable to allocate space for bills");
+                        free(list);
+                        return -1;
+                    }
+                    list = bill;
+                }
+                list[count++] = *part;
+            }
+        }
+    }
+    *bills = list;
+    *nbills = count;
+    return 0;
+}
+
+/*
+ * Cost the range, rounded out to whole minutes, setting a list of bills
+ * for the caller to free.
+ */
+
+int tariff_cost(const tariff * tf, time_t start, time_t end, tariff_bill ** bills, int *nbills)
+{
+    int status = -1, ntasks, nthreads, ready, run, i;
+    cost_worker workers[POOL_MAX_THREADS];
+    cost_job job;
+    day_task *task;
+    time_t day;
+
+    start -= start % 60;
+    end += (60 - end % 60) % 60;
+    ntasks = end > start ? (end - 1) / SECS_IN_DAY - start / SECS_IN_DAY + 1 : 0;
+    if ((job.tasks = calloc(ntasks ? ntasks : 1, sizeof(day_task))) == NULL) {
+        log_syserr("unable to allocate space for day list");
+        return -1;
+    }
+    for (i = 0, day = start - start % SECS_IN_DAY; i < ntasks; i++, day += SECS_IN_DAY) {
+        task = job.tasks + i;
+        task->day = day;
+        task->start = start > day ? start : day;
+        task->end = end < day + SECS_IN_DAY ? end : day + SECS_IN_DAY;
+    }
+    job.tf = tf;
+    job.start = start;
+    job.queue.count = ntasks;
+    job.queue.next = 0;
+    nthreads = pool_size(tariff_threads, ntasks);
+    for (ready = 0; ready < nthreads; ready++)
+        if (worker_init(workers + ready, &job))
+            break;
+    run = ready > 0 ? pool_run(cost_worker_run, workers, sizeof(cost_worker), ready) : 0;
+    for (i = 0; i < ready; i++)
+        worker_free(workers + i);
+    if (run > 0 || ntasks == 0) {
+        for (i = 0; i < ntasks && job.tasks[i].status == MF_SUCCESS; i++);
+        if (i < ntasks)
+            log_msg("unable to read the samples for day %ld", (long) job.tasks[i].day / SECS_IN_DAY);
+        else
+            status = merge_bills(job.tasks, ntasks, bills, nbills);
+    }
+    free(job.tasks);
+    return status;
+}
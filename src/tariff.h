@@ -0,0 +1,76 @@
+#ifndef TARIFF_H
+#define TARIFF_H
+
+#include "cc-defs.h"
+
+#include <time.h>
+
+/*
+ * A time of use tariff is read from a file of lines, each a standing
+ * charge a day or a band of the rate paid for energy imported or the rate
+ * paid back for energy exported, with the times it applies in local time:
+ *
+ *   standing 0.45
+ *   import peak 0.35 mon-fri 16:00-19:00
+ *   import night 0.09 00:30-04:30
+ *   import winter 0.28 nov-mar
+ *   import day 0.25
+ *   export all 0.15
+ *
+ * Each minute goes in the first band for its direction that it is in, a
+ * band with no days, months or times being in force all the time.  Days
+ * and months are lists of names and ranges, which may wrap, and times may
+ * run over midnight.  Anything after a # is a comment.
+ */
+
+#define TARIFF_MAX_BANDS 16
+
+typedef enum {
+    TARIFF_IMPORT,
+    TARIFF_EXPORT,
+    TARIFF_FLOWS
+} tariff_flow;
+
+typedef struct {
+    char name[20];
+    tariff_flow flow;
+    double rate;                /* for a kWh */
+    unsigned days;              /* a bit for each day, Sunday first */
+    unsigned months;            /* a bit for each month, January first */
+    int from;                   /* minutes into the day, equal for all day */
+    int to;
+} tariff_band;
+
+typedef struct {
+    double standing;            /* for a day */
+    int nbands;
+    tariff_band bands[TARIFF_MAX_BANDS];
+} tariff;
+
+extern tariff *tariff_load(const char *file);
+extern void tariff_free(tariff * tf);
+extern int tariff_find(const tariff * tf, tariff_flow flow, const struct tm *tm);
+
+/*
+ * Costing a range streams its samples once, the days in parallel, and
+ * adds the energy imported, going by the import meter, and exported,
+ * going by the clamp while nothing is imported, a minute at a time into
+ * a bill for each local calendar month.  Energy outside every band of its
+ * direction is kept apart, and the standing charge is for each local day
+ * begun in the range.
+ */
+
+typedef struct {
+    int year;
+    int month;                  /* from 0 */
+    int days;
+    double kwh[TARIFF_MAX_BANDS];
+    double unbanded[TARIFF_FLOWS];
+} tariff_bill;
+
+extern int tariff_threads;
+
+extern int tariff_cost(const tariff * tf, time_t start, time_t end, tariff_bill ** bills, int *nbills);
+extern double tariff_total(const tariff * tf, const tariff_bill * bill);
+
+#endif
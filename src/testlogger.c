@@ -11,7 +11,7 @@ int main(int argc, char **argv)
     unsigned char buffer[4096];
     ssize_t nbytes;
 
-    if ((l = logger_new())) {
+    if ((l = logger_new(NULL, NULL))) {
         while ((nbytes = read(0, buffer, sizeof buffer)) > 0)
             logger_data(l, buffer, nbytes);
         logger_free(l);
@@ -1,52 +1,455 @@
+#define _GNU_SOURCE
+#include "cc-common.h"
+#include "cc-defs.h"
 #include "textfile.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
 typedef struct {
     mf_callback line_cb;
+    tf_span_cb span_cb;
     void *user_data;
+    size_t *offset;
+    tf_key_cb key_cb;
+    long long key_from;
+    long long key_to;
+    unsigned stride;
+    tf_sampling *sampling;
 } textfile_t;
 
-mf_status tf_parse_cb_forward(void *user_data, const void *file_data, size_t file_size)
+static mf_status tf_deliver(textfile_t * tf, const tf_span * spans, unsigned count)
 {
+    mf_status status = MF_SUCCESS;
+    const tf_span *end;
 
+    if (tf->span_cb)
+        return tf->span_cb(tf->user_data, spans, count);
+    for (end = spans + count; status == MF_SUCCESS && spans < end; spans++)
+        status = tf->line_cb(tf->user_data, spans->ptr, spans->len);
+    return status;
+}
+
+mf_status tf_parse_cb_forward(void *user_data, const void *file_data, size_t file_size)
+{
     textfile_t *tf = (textfile_t *) user_data;
     mf_status status = MF_SUCCESS;
     const char *ptr = file_data;
     const char *end = ptr + file_size;
-    const char *line = ptr;
-
-    do {
-        while (ptr < end && *ptr++ != '\n');
-        status = tf->line_cb(tf->user_data, line, ptr - line - 1);
-        line = ptr;
-    } while (status == MF_SUCCESS && ptr < end);
+    const char *nl;
+    tf_span spans[TF_SPAN_BATCH];
+    unsigned n;
 
+    while (status == MF_SUCCESS && ptr < end) {
+        for (n = 0; n < TF_SPAN_BATCH && ptr < end; n++) {
+            if ((nl = memchr(ptr, '\n', end - ptr)) == NULL)
+                nl = end;
+            spans[n].ptr = ptr;
+            spans[n].len = nl - ptr;
+            ptr = nl + 1;
+        }
+        status = tf_deliver(tf, spans, n);
+    }
     return status;
 }
 
 mf_status tf_parse_cb_backward(void *user_data, const void *file_data, size_t file_size)
 {
-
     textfile_t *tf = (textfile_t *) user_data;
     mf_status status = MF_SUCCESS;
     const char *start = file_data;
-    const char *ptr = start + file_size;
-    const char *line = ptr;
-
-    do {
-        while (line > start && *--line != '\n');
-        status = tf->line_cb(tf->user_data, line + 1, ptr - line - 1);
-        ptr = line;
-    } while (status == MF_SUCCESS && ptr > start);
+    const char *end = start + file_size;
+    const char *nl, *line;
+    tf_span spans[TF_SPAN_BATCH];
+    unsigned n;
 
+    if (end > start && end[-1] == '\n')
+        end--;
+    while (status == MF_SUCCESS && end > start) {
+        for (n = 0; n < TF_SPAN_BATCH && end > start; n++) {
+            if ((nl = memrchr(start, '\n', end - start)))
+                line = nl + 1;
+            else
+                line = nl = start;
+            spans[n].ptr = line;
+            spans[n].len = end - line;
+            end = nl;
+        }
+        status = tf_deliver(tf, spans, n);
+    }
     return status;
 }
 
+static mf_status parse_file(const char *filename, mf_strategy strategy, void *user_data, mf_callback file_cb, mf_callback line_cb, tf_span_cb span_cb)
+{
+    textfile_t tf;
+
+    tf.line_cb = line_cb;
+    tf.span_cb = span_cb;
+    tf.user_data = user_data;
+    return mf_read_file(filename, strategy, &tf, file_cb);
+}
+
+/*
+ * Without a strategy given, a file read forwards is mapped for sequential
+ * access and one read backwards has readahead of the whole file started.
+ */
+
+static mf_strategy default_strategy(mf_callback file_cb)
+{
+    return file_cb == tf_parse_cb_backward ? MF_MAP_WILLNEED : MF_MAP_SEQ;
+}
+
+mf_status tf_parse_file_using(const char *filename, mf_strategy strategy, void *user_data, mf_callback file_cb, mf_callback line_cb)
+{
+    return parse_file(filename, strategy, user_data, file_cb, line_cb, NULL);
+}
+
 mf_status tf_parse_file(const char *filename, void *user_data, mf_callback file_cb, mf_callback line_cb)
 {
+    return parse_file(filename, default_strategy(file_cb), user_data, file_cb, line_cb, NULL);
+}
+
+mf_status tf_parse_spans_using(const char *filename, mf_strategy strategy, void *user_data, mf_callback file_cb, tf_span_cb span_cb)
+{
+    return parse_file(filename, strategy, user_data, file_cb, NULL, span_cb);
+}
+
+mf_status tf_parse_spans(const char *filename, void *user_data, mf_callback file_cb, tf_span_cb span_cb)
+{
+    return parse_file(filename, default_strategy(file_cb), user_data, file_cb, NULL, span_cb);
+}
+
+#define TF_SEEK_LINEAR 4096
+#define TF_SEEK_WINDOW (64 * 1024)
+
+static const char *next_line(const char *ptr, const char *end)
+{
+    const char *nl;
+
+    if ((nl = memchr(ptr, '\n', end - ptr)))
+        return nl + 1;
+    return end;
+}
+
+/*
+ * A probe that lands on a line without a key moves on to the next line
+ * with one, but no further than the window.  Once the bisection stops,
+ * however it stops, the scan for the target covers at most the window
+ * from the lower bound, and the upper bound is taken if the target is not
+ * found in it, so a damaged or disordered file costs a bounded amount of
+ * reading rather than a scan to its end.
+ */
+
+const char *tf_seek(const char *start, const char *end, tf_key_cb key_cb, long long target)
+{
+    const char *lo = start, *hi = end, *line, *limit;
+    long long key = -1, lo_key = -1, hi_key = -1;
+
+    while (hi - lo > TF_SEEK_LINEAR) {
+        limit = lo + (hi - lo) / 2 + TF_SEEK_WINDOW;
+        for (line = next_line(lo + (hi - lo) / 2, hi); line < hi && line < limit; line = next_line(line, hi))
+            if ((key = key_cb(line, next_line(line, hi) - line)) >= 0)
+                break;
+        if (line >= hi)
+            break;
+        if (line >= limit) {
+            log_msg("no key within %d bytes of offset %lu", TF_SEEK_WINDOW, (unsigned long) (line - start - TF_SEEK_WINDOW));
+            break;
+        }
+        if ((lo_key >= 0 && key < lo_key) || (hi_key >= 0 && key > hi_key)) {
+            log_msg("keys out of order at offset %lu", (unsigned long) (line - start));
+            break;
+        }
+        if (key < target) {
+            lo = line;
+            lo_key = key;
+        }
+        else {
+            hi = line;
+            hi_key = key;
+        }
+    }
+    limit = hi - lo > TF_SEEK_WINDOW ? lo + TF_SEEK_WINDOW : hi;
+    for (line = lo; line < limit; line = next_line(line, hi))
+        if (key_cb(line, next_line(line, hi) - line) >= target)
+            return line;
+    if (limit < hi)
+        log_msg("key %lld not found within %d bytes of offset %lu, going on from offset %lu", target, TF_SEEK_WINDOW,
+                (unsigned long) (lo - start), (unsigned long) (hi - start));
+    return hi;
+}
+
+static mf_status tf_parse_cb_range(void *user_data, const void *file_data, size_t file_size)
+{
+    textfile_t *tf = (textfile_t *) user_data;
+    const char *start = file_data;
+    const char *end = start + file_size;
 
+    start = tf_seek(start, end, tf->key_cb, tf->key_from);
+    end = tf_seek(start, end, tf->key_cb, tf->key_to);
+    if (start < end)
+        return tf_parse_cb_forward(tf, start, end - start);
+    return MF_SUCCESS;
+}
+
+/*
+ * The mapping is left to be paged in as touched so only the pages the
+ * bisection probes and those of the lines in range are read.
+ */
+
+mf_status tf_parse_range(const char *filename, void *user_data, tf_key_cb key_cb, long long from, long long to, tf_span_cb span_cb)
+{
+    textfile_t tf;
+
+    tf.line_cb = NULL;
+    tf.span_cb = span_cb;
+    tf.user_data = user_data;
+    tf.key_cb = key_cb;
+    tf.key_from = from;
+    tf.key_to = to;
+    return mf_read_file(filename, MF_MAP, &tf, tf_parse_cb_range);
+}
+
+#define TF_SAMPLE_PROBE 16
+
+/*
+ * The offsets are a step apart of stride times the mean length of the
+ * first lines in the range, each moved on to the start of the next line
+ * unless it is at one already, and past the line taken before it.
+ */
+
+static mf_status tf_parse_cb_sample(void *user_data, const void *file_data, size_t file_size)
+{
+    textfile_t *tf = (textfile_t *) user_data;
+    mf_status status = MF_SUCCESS;
+    const char *start = file_data;
+    const char *end = start + file_size;
+    const char *ptr, *line, *nl;
+    tf_span spans[TF_SPAN_BATCH];
+    size_t step, taken = 0;
+    unsigned n;
+
+    start = tf_seek(start, end, tf->key_cb, tf->key_from);
+    end = tf_seek(start, end, tf->key_cb, tf->key_to);
+    for (ptr = start, n = 0; n < TF_SAMPLE_PROBE && ptr < end; n++)
+        ptr = next_line(ptr, end);
+    if (n == 0)
+        return MF_SUCCESS;
+    step = (ptr - start) / n * tf->stride;
+    ptr = start;
+    line = start;
+    while (status == MF_SUCCESS && line < end) {
+        for (n = 0; n < TF_SPAN_BATCH && line < end; n++) {
+            if ((nl = memchr(line, '\n', end - line)) == NULL)
+                nl = end;
+            spans[n].ptr = line;
+            spans[n].len = nl - line;
+            taken += nl - line + 1;
+            if ((size_t) (end - ptr) <= step)
+                line = end;
+            else {
+                ptr += step;
+                line = next_line(ptr - 1, end);
+                if (line <= nl)
+                    line = nl + 1;
+            }
+        }
+        status = tf_deliver(tf, spans, n);
+    }
+    tf->sampling->range += end - start;
+    tf->sampling->taken += taken;
+    return status;
+}
+
+mf_status tf_sample_range(const char *filename, void *user_data, tf_key_cb key_cb, long long from, long long to, unsigned stride,
+                          tf_sampling * sampling, tf_span_cb span_cb)
+{
+    textfile_t tf;
+
+    tf.line_cb = NULL;
+    tf.span_cb = span_cb;
+    tf.user_data = user_data;
+    tf.key_cb = key_cb;
+    tf.key_from = from;
+    tf.key_to = to;
+    tf.stride = stride > 0 ? stride : 1;
+    tf.sampling = sampling;
+    return mf_read_file(filename, MF_MAP, &tf, tf_parse_cb_sample);
+}
+
+/*
+ * Parse only the complete lines that follow a byte offset, leaving the
+ * offset just after the last line the callback accepted.  A partial line
+ * at the end of a file that is still being written is left for next time.
+ */
+
+static mf_status tf_parse_cb_from(void *user_data, const void *file_data, size_t file_size)
+{
+    textfile_t *tf = (textfile_t *) user_data;
+    mf_status status = MF_SUCCESS;
+    const char *start = file_data;
+    const char *end = start + file_size;
+    const char *line = start + *tf->offset;
+    const char *nl;
+
+    while (status == MF_SUCCESS && line < end && (nl = memchr(line, '\n', end - line))) {
+        if ((status = tf->line_cb(tf->user_data, line, nl - line)) != MF_FAIL) {
+            line = nl + 1;
+            *tf->offset = line - start;
+        }
+    }
+    return status;
+}
+
+mf_status tf_parse_file_from(const char *filename, size_t *offset, void *user_data, mf_callback line_cb)
+{
     textfile_t tf;
 
     tf.line_cb = line_cb;
+    tf.span_cb = NULL;
     tf.user_data = user_data;
-    return mapfile(filename, &tf, file_cb);
+    tf.offset = offset;
+    return mapfile(filename, &tf, tf_parse_cb_from);
+}
+
+#define FOLLOW_MAX_WAIT 60
+
+static void day_file(char *file, size_t size, const char *name_fmt)
+{
+    time_t now;
+    struct tm tm;
+
+    time(&now);
+    gmtime_r(&now, &tm);
+    strftime(file, size, name_fmt, &tm);
+}
+
+/*
+ * Wait for something to change in the watched directory, or until the
+ * next midnight so the change of day is not missed when nothing is being
+ * written.  The events themselves are only a prompt to look at the file
+ * again so they are read and discarded.
+ */
+
+static int follow_wait(int ifd)
+{
+    struct pollfd pfd;
+    char buf[4096];
+    int timeout;
+
+    timeout = SECS_IN_DAY - time(NULL) % SECS_IN_DAY + 1;
+    if (timeout > FOLLOW_MAX_WAIT)
+        timeout = FOLLOW_MAX_WAIT;
+    pfd.fd = ifd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout * 1000) < 0) {
+        if (errno != EINTR) {
+            log_syserr("unable to wait for file changes");
+            return -1;
+        }
+    }
+    else if (pfd.revents & POLLIN) {
+        if (read(ifd, buf, sizeof buf) < 0 && errno != EAGAIN) {
+            log_syserr("unable to read file change events");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parse whatever complete lines have been added to a file since the
+ * offset, then tell the consumer it has caught up.
+ */
+
+static mf_status follow_read(const char *file, size_t *offset, void *user_data, tf_event_cb event_cb, mf_callback line_cb)
+{
+    mf_status status = MF_SUCCESS;
+    struct stat stb;
+
+    if (stat(file, &stb) == 0) {
+        if ((size_t) stb.st_size < *offset) {
+            log_msg("'%s' has been truncated, starting again", file);
+            *offset = 0;
+            status = event_cb(user_data, TF_RESET, file, offset, &stb);
+        }
+        if (status == MF_SUCCESS && (size_t) stb.st_size > *offset) {
+            if ((status = tf_parse_file_from(file, offset, user_data, line_cb)) == MF_SUCCESS)
+                status = event_cb(user_data, TF_IDLE, file, offset, &stb);
+        }
+    }
+    else {
+        log_syserr("unable to stat '%s'", file);
+        status = MF_FAIL;
+    }
+    return status;
+}
+
+mf_status tf_follow(const char *name_fmt, void *user_data, tf_event_cb event_cb, mf_callback line_cb)
+{
+    mf_status status = MF_SUCCESS;
+    char file[PATH_MAX], next[PATH_MAX], dir[PATH_MAX], *slash;
+    struct stat stb;
+    size_t offset;
+    int ifd;
+
+    day_file(file, sizeof file, name_fmt);
+    strcpy(dir, file);
+    if ((slash = strrchr(dir, '/')))
+        *slash = '\0';
+    else
+        strcpy(dir, ".");
+    if ((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+        if (inotify_add_watch(ifd, dir, IN_CREATE | IN_MODIFY | IN_MOVED_TO) >= 0) {
+            while (status == MF_SUCCESS) {
+                /* today's file may not have been started yet */
+                while (stat(file, &stb) != 0) {
+                    if (errno != ENOENT) {
+                        log_syserr("unable to stat '%s'", file);
+                        status = MF_FAIL;
+                    }
+                    else if (follow_wait(ifd))
+                        status = MF_FAIL;
+                    if (status != MF_SUCCESS)
+                        break;
+                    day_file(file, sizeof file, name_fmt);
+                }
+                if (status != MF_SUCCESS)
+                    break;
+                log_msg("following '%s'", file);
+                offset = 0;
+                if ((status = event_cb(user_data, TF_OPEN, file, &offset, &stb)) != MF_SUCCESS)
+                    break;
+                for (;;) {
+                    if ((status = follow_read(file, &offset, user_data, event_cb, line_cb)) != MF_SUCCESS)
+                        break;
+                    day_file(next, sizeof next, name_fmt);
+                    if (strcmp(next, file)) {
+                        /* pick up the last lines written before midnight */
+                        if ((status = follow_read(file, &offset, user_data, event_cb, line_cb)) == MF_SUCCESS)
+                            if (stat(file, &stb) == 0)
+                                status = event_cb(user_data, TF_CLOSE, file, &offset, &stb);
+                        strcpy(file, next);
+                        break;
+                    }
+                    if (follow_wait(ifd)) {
+                        status = MF_FAIL;
+                        break;
+                    }
+                }
+            }
+        }
+        else
+            log_syserr("unable to watch directory '%s'", dir);
+        close(ifd);
+    }
+    else
+        log_syserr("unable to initialise inotify");
+    return status == MF_STOP ? MF_SUCCESS : status;
 }
@@ -3,12 +3,91 @@
 
 #include "mapfile.h"
 
+#include <sys/stat.h>
+
+/*
+ * Lines are found a batch at a time and may be taken that way too, as
+ * spans of the file data in the order they were read, so when reading
+ * backwards the last line in the file comes first.  The scan stops as soon
+ * as a line or span callback returns anything but MF_SUCCESS.
+ */
+
+#define TF_SPAN_BATCH 256
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} tf_span;
+
+typedef mf_status(*tf_span_cb) (void *user_data, const tf_span *spans, unsigned count);
+
 extern mf_status tf_parse_cb_forward(void *user_data, const void *file_data, size_t file_size);
 
 extern mf_status tf_parse_cb_backward(void *user_data, const void *file_data, size_t file_size);
 
 extern mf_status tf_parse_file(const char *filename, void *user_data, mf_callback file_cb, mf_callback line_cb);
 
+extern mf_status tf_parse_file_using(const char *filename, mf_strategy strategy, void *user_data, mf_callback file_cb, mf_callback line_cb);
+
+extern mf_status tf_parse_spans(const char *filename, void *user_data, mf_callback file_cb, tf_span_cb span_cb);
+
+extern mf_status tf_parse_spans_using(const char *filename, mf_strategy strategy, void *user_data, mf_callback file_cb, tf_span_cb span_cb);
+
+/*
+ * Seeking in a file whose lines are in order of some key, such as a time
+ * stamp.  The key callback returns a line's key, or -1 if it has none.
+ * tf_seek finds the first line with a key at or after the target by
+ * bisection, finishing with a linear scan once the gap is small or the
+ * keys are found to be out of order.  The scan is bounded, so where the
+ * keys are out of order the result is only approximate, and a warning is
+ * logged.  tf_parse_range passes on only the
+ * lines from the first at or after one key to the last before another.
+ */
+
+typedef long long (*tf_key_cb) (const char *line, size_t len);
+
+extern const char *tf_seek(const char *start, const char *end, tf_key_cb key_cb, long long target);
+
+extern mf_status tf_parse_range(const char *filename, void *user_data, tf_key_cb key_cb, long long from, long long to, tf_span_cb span_cb);
+
+/*
+ * Sampling such a range for an approximate result: only about one line in
+ * stride is passed on, the first at or after each of a series of offsets
+ * evenly spread through the range.  The bytes in the range and in the
+ * lines passed on are added to the counts given so the share of the lines
+ * read can be estimated from them.
+ */
+
+typedef struct {
+    size_t range;
+    size_t taken;
+} tf_sampling;
+
+extern mf_status tf_sample_range(const char *filename, void *user_data, tf_key_cb key_cb, long long from, long long to, unsigned stride,
+                                 tf_sampling * sampling, tf_span_cb span_cb);
+
+extern mf_status tf_parse_file_from(const char *filename, size_t *offset, void *user_data, mf_callback line_cb);
+
+/*
+ * Following a day file: the event callback is told when a file is started,
+ * so it can set the offset to resume from, each time parsing has caught up
+ * with the end of the file, when the file has been truncated and is to be
+ * read again from the start, and when the day is over and the next day's
+ * file is to be followed instead.  Returning anything but MF_SUCCESS from
+ * the callback stops following.
+ */
+
+typedef enum {
+    TF_OPEN,
+    TF_IDLE,
+    TF_RESET,
+    TF_CLOSE
+} tf_event;
+
+typedef mf_status(*tf_event_cb) (void *user_data, tf_event event, const char *filename, size_t *offset, const struct stat *stb);
+
+extern mf_status tf_follow(const char *name_fmt, void *user_data, tf_event_cb event_cb, mf_callback line_cb);
+
 #define mf_parse_file_forward(filename, user_data, line_callback)	\
     tf_parse_file(filename, user_data, tf_parse_cb_forward, line_callback)
 
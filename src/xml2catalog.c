@@ -0,0 +1,95 @@
+/*
+ * xml2catalog
+ *
+ * Rebuilds the catalog of day files in the current directory from the
+ * files themselves or, given day file names, updates just their entries
+ * in the existing catalog, and those of any days missing between its end
+ * and them.  A catalog is only made by a rebuild, as one holding just
+ * some days would claim those before were empty.  Today's file is left
+ * out as it is still being written; the logger catalogues it once the
+ * day is over.
+ */
+
+#define _GNU_SOURCE
+#include "cc-common.h"
+#include "catalog.h"
+
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+const char prog_name[] = "xml2catalog";
+
+static int add_file(cat_catalog *cat, const char *file, time_t today)
+{
+    struct tm tm;
+    cat_day ent;
+    const char *end;
+    time_t day, ts;
+
+    memset(&tm, 0, sizeof tm);
+    if ((end = strptime(file, xml_file, &tm)) == NULL || *end) {
+        log_msg("'%s' is not a day file name", file);
+        return -1;
+    }
+    if ((day = timegm(&tm)) >= today) {
+        log_msg("'%s' is not yet complete, skipped", file);
+        return 0;
+    }
+    if (cat->count > 0) {
+        for (ts = cat->days[cat->count - 1].day + 86400; ts < day; ts += 86400) {
+            if (cat_scan_day(&ent, ts) == 0) {
+                if (cat_set(cat, &ent))
+                    return -1;
+            }
+            else if (errno != ENOENT)
+                return -1;
+        }
+    }
+    if (cat_scan_day(&ent, day)) {
+        if (errno == ENOENT)
+            log_msg("day file '%s' not found", file);
+        return -1;
+    }
+    return cat_set(cat, &ent);
+}
+
+int main(int argc, char **argv)
+{
+    int status = 0;
+    cat_catalog *cat;
+    glob_t gl;
+    size_t i;
+    time_t today;
+
+    time(&today);
+    today -= today % 86400;
+    if (argc > 1) {
+        if ((cat = cat_load()) == NULL) {
+            if (errno == ENOENT)
+                log_msg("there is no catalog to update, so run %s with no files to build one", prog_name);
+            return 1;
+        }
+        while (--argc)
+            if (add_file(cat, *++argv, today))
+                status = 2;
+    }
+    else if ((cat = cat_new())) {
+        if (glob("cc-[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9].xml", 0, NULL, &gl) == 0) {
+            for (i = 0; i < gl.gl_pathc; i++)
+                if (add_file(cat, gl.gl_pathv[i], today))
+                    status = 2;
+            globfree(&gl);
+        }
+    }
+    else
+        return 1;
+    if (cat_save(cat))
+        status = 3;
+    else
+        log_msg("catalog has %u days", cat->count);
+    cat_free(cat);
+    return status;
+}
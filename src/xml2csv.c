@@ -2,6 +2,7 @@
 #include "cc-common.h"
 #include "parsefile.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +10,79 @@
 
 const char prog_name[] = "xml2csv";
 
-static mf_status sample_cb(pf_context * ctx, pf_sample * smp)
+static mf_status batch_cb(pf_context * ctx, pf_batch * batch)
 {
     char tmstr[ISO_DATE_LEN];
     FILE *fp = ctx->user_data;
-    strftime(tmstr, sizeof tmstr, date_iso, gmtime(&smp->timestamp));
-    fprintf(fp, "%s,%g,%d,%g\n", tmstr, smp->temp, smp->sensor, smp->data.watts);
+    time_t last = -1;
+    unsigned i;
+
+    for (i = 0; i < batch->count; i++) {
+        if (batch->timestamp[i] != last) {
+            last = batch->timestamp[i];
+            strftime(tmstr, sizeof tmstr, date_iso, gmtime(&last));
+        }
+        fprintf(fp, "%s,%g,%d,%g\n", tmstr, temp_to_double(batch->temp[i]), batch->sensor[i], watts_to_double(batch->watts[i]));
+    }
+    return MF_SUCCESS;
+}
+
+static void csv_name(char *csv, const char *xml)
+{
+    const char *ext;
+    size_t len;
+
+    if ((ext = strrchr(xml, '.')) && strcmp(ext, ".xml") == 0)
+        len = ext - xml;
+    else
+        len = strlen(xml);
+    memcpy(csv, xml, len);
+    strcpy(csv + len, ".csv");
+}
+
+/*
+ * In follow mode each day's CSV file is written afresh from the start of
+ * the XML file and then appended to as the XML file grows.  If the XML
+ * file is truncated the CSV file is emptied too.
+ */
+
+static mf_status follow_cb(void *user_data, tf_event event, const char *file, size_t *offset, const struct stat *stb)
+{
+    pf_context *pf = user_data;
+    char csv[PATH_MAX];
+    FILE *fp;
+    mf_status status;
+
+    switch (event) {
+        case TF_OPEN:
+            if (strlen(file) + 5 > sizeof csv)
+                return MF_FAIL;
+            csv_name(csv, file);
+            if ((fp = fopen(csv, "w")) == NULL) {
+                log_syserr("unable to open file '%s' for writing", csv);
+                return MF_FAIL;
+            }
+            pf->user_data = fp;
+            break;
+        case TF_IDLE:
+            if (pf_flush(pf) == MF_FAIL)
+                return MF_FAIL;
+            fflush(pf->user_data);
+            break;
+        case TF_RESET:
+            pf->batch->count = 0;
+            fflush(pf->user_data);
+            if (ftruncate(fileno(pf->user_data), 0) || fseek(pf->user_data, 0, SEEK_SET)) {
+                log_syserr("unable to empty the CSV file for '%s'", file);
+                return MF_FAIL;
+            }
+            break;
+        case TF_CLOSE:
+            status = pf_flush(pf);
+            fclose(pf->user_data);
+            pf->user_data = NULL;
+            return status;
+    }
     return MF_SUCCESS;
 }
 
@@ -22,31 +90,38 @@ int main(int argc, char **argv)
 {
     int status = 0;
     pf_context *pf;
-    const char *arg, *ext;
-    size_t len;
+    pf_batch batch;
+    const char *arg;
     char *csv;
     FILE *fp;
 
     if ((pf = pf_new())) {
-        pf->sample_cb = sample_cb;
+        batch.count = 0;
+        pf->batch = &batch;
+        pf->batch_cb = batch_cb;
         while (--argc) {
             arg = *++argv;
             if (arg[0] == '-' && arg[1] == 'f')
                 pf->file_cb = tf_parse_cb_forward;
             else if (arg[0] == '-' && arg[1] == 'b')
                 pf->file_cb = tf_parse_cb_backward;
+            else if (arg[0] == '-' && arg[1] == 'F') {
+                if (tf_follow(xml_file, pf, follow_cb, pf_parse_line) == MF_FAIL)
+                    status = 3;
+                if (pf->user_data)
+                    fclose(pf->user_data);
+                pf->user_data = NULL;
+            }
             else {
-                if ((ext = strrchr(arg, '.')) && strcmp(ext, ".xml") == 0)
-                    len = ext - arg;
-                else
-                    len = strlen(arg);
-                csv = alloca(len + 4);
-                memcpy(csv, arg, len);
-                strcpy(csv + len, ".csv");
+                csv = alloca(strlen(arg) + 5);
+                csv_name(csv, arg);
                 if ((fp = fopen(csv, "w"))) {
                     pf->user_data = fp;
+                    /* flush even after a failure so the batch never runs into the next file */
                     if (pf_parse_file(pf, arg) == MF_FAIL)
                         status = 3;
+                    if (pf_flush(pf) == MF_FAIL)
+                        status = 3;
                     fclose(fp);
                 }
                 else {
@@ -1,183 +1,541 @@
 #include "cc-defs.h"
 #include "cc-common.h"
+#include "ledger.h"
 #include "pg-common.h"
+#include "textfile.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 const char prog_name[] = "xml2pg";
 
 #define BATCH_SIZE 100
+#define MAX_JOBS   64
 
-static void insert(PGconn *conn, sample_t *smp, sample_t *smp_last)
+static const char ledger_get_sql[] =
+    "SELECT size, mtime, byte_offset, extract(epoch FROM last_stamp) "
+    "FROM import_ledger WHERE path = $1";
+
+static const char ledger_put_sql[] =
+    "INSERT INTO import_ledger (path, size, mtime, byte_offset, last_stamp) "
+    "VALUES ($1, $2, $3, $4, to_timestamp($5::double precision)) "
+    "ON CONFLICT (path) DO UPDATE SET size = EXCLUDED.size, mtime = EXCLUDED.mtime, "
+    "byte_offset = EXCLUDED.byte_offset, last_stamp = EXCLUDED.last_stamp";
+
+typedef struct {
+    pthread_mutex_t lock;
+    const char *db;
+    char **files;
+    int nfiles;
+    int next;
+    int status;
+} work_queue_t;
+
+typedef struct {
+    PGconn *conn;
+    ledger_entry *ledger;
+    size_t offset;
+    time_t last_secs;
+    unsigned last_usecs;
+    int errors;
+    sample_t *smp;
+    sample_t samples[BATCH_SIZE];
+} import_t;
+
+static int ledger_get(PGconn *conn, ledger_entry *ent)
+{
+    PGresult *res;
+    const char *values[1];
+    char *end;
+    int status = -1, i;
+
+    values[0] = ent->path;
+    if ((res = PQexecPrepared(conn, "ledger_get", 1, values, NULL, NULL, 0))) {
+        if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+            if (PQntuples(res) > 0) {
+                ent->size = strtoll(PQgetvalue(res, 0, 0), NULL, 10);
+                ent->mtime = strtoll(PQgetvalue(res, 0, 1), NULL, 10);
+                ent->offset = strtoull(PQgetvalue(res, 0, 2), NULL, 10);
+                ent->last_secs = strtoul(PQgetvalue(res, 0, 3), &end, 10);
+                ent->last_usecs = 0;
+                if (*end == '.')
+                    end++;
+                for (i = 0; i < 6; i++) {
+                    ent->last_usecs *= 10;
+                    if (*end >= '0' && *end <= '9')
+                        ent->last_usecs += *end++ - '0';
+                }
+            }
+            status = 0;
+        }
+        else
+            log_db_err(conn, "unable to read import ledger for '%s'", ent->path);
+        PQclear(res);
+    }
+    else
+        log_syserr("out of memory reading import ledger");
+    return status;
+}
+
+static int ledger_put(import_t *imp)
+{
+    ledger_entry *ent = imp->ledger;
+    PGresult *res;
+    const char *values[5];
+    char size[24], mtime[24], offset[24], stamp[32];
+    int errors = 1;
+
+    snprintf(size, sizeof(size), "%lld", ent->size);
+    snprintf(mtime, sizeof(mtime), "%lld", (long long)ent->mtime);
+    snprintf(offset, sizeof(offset), "%llu", (unsigned long long)imp->offset);
+    snprintf(stamp, sizeof(stamp), "%lld.%06u", (long long)imp->last_secs, imp->last_usecs);
+    values[0] = ent->path;
+    values[1] = size;
+    values[2] = mtime;
+    values[3] = offset;
+    values[4] = stamp;
+    if ((res = PQexecPrepared(imp->conn, "ledger_put", 5, values, NULL, NULL, 0))) {
+        if (PQresultStatus(res) == PGRES_COMMAND_OK)
+            errors = 0;
+        else
+            log_db_err(imp->conn, "unable to update import ledger for '%s'", ent->path);
+        PQclear(res);
+    }
+    else
+        log_syserr("out of memory updating import ledger");
+    return errors;
+}
+
+/*
+ * Insert the batch of samples in a single transaction.  When importing
+ * from a file the ledger is updated in the same transaction so it never
+ * claims more of the file than has been committed.
+ */
+
+static int insert(import_t *imp)
 {
+    PGconn *conn = imp->conn;
+    sample_t *smp = imp->samples;
+    int errors = 0;
     PGresult *res = PQexec(conn, "BEGIN");
     if (res) {
         if (PQresultStatus(res) == PGRES_COMMAND_OK) {
             PQclear(res);
-            while (smp < smp_last) {
+            while (smp < imp->smp) {
                 char tstamp[TIME_STAMP_SIZE];
-                struct tm *tp = gmtime(&smp->when.tv_sec);
-                smp->lengths[0] = snprintf(tstamp, sizeof(tstamp), "%04d-%02d-%02d %02d:%02d:%02d.%06u", tp->tm_year + 1900, tp->tm_mon + 1, tp->tm_mday, tp->tm_hour, tp->tm_min, tp->tm_sec, (unsigned)smp->when.tv_nsec);
+                struct tm tm;
+                gmtime_r(&smp->when.tv_sec, &tm);
+                smp->lengths[0] = snprintf(tstamp, sizeof(tstamp), "%04d-%02d-%02d %02d:%02d:%02d.%06u", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned)smp->when.tv_nsec);
                 smp->values[0] = tstamp;
                 res = PQexecPrepared(conn, smp->ptr.stmt, NUM_COLS, smp->values, smp->lengths, NULL, 0);
                 if (res) {
-                    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+                    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
                         log_db_err(conn, "unable to execute %s insert statment", smp->ptr.stmt);
+                        errors++;
+                    }
                     PQclear(res);
                 }
-                else
+                else {
                     log_syserr("out of memory executing %s SQL", smp->ptr.stmt);
+                    errors++;
+                }
                 smp++;
             }
+            if (imp->ledger)
+                errors += ledger_put(imp);
             res = PQexec(conn, "COMMIT");
             if (res) {
-                if (PQresultStatus(res) != PGRES_COMMAND_OK)
+                if (PQresultStatus(res) != PGRES_COMMAND_OK) {
                     log_db_err(conn, "unable to commit transaction");
+                    errors++;
+                }
                 PQclear(res);
             }
-            else
+            else {
                 log_syserr("out of memory commiting transaction");
+                errors++;
+            }
         }
         else {
             log_db_err(conn, "unable to start transaction");
             PQclear(res);
+            errors++;
         }
     }
-    else
+    else {
         log_syserr("out of memory starting transaction");
+        errors++;
+    }
+    imp->smp = imp->samples;
+    imp->errors += errors;
+    return errors;
+}
+
+static mf_status import_line(void *user_data, const void *file_data, size_t file_size)
+{
+    import_t *imp = user_data;
+    const char *line = file_data;
+    const char *line_end = line + file_size;
+    const char *ptr, *stmt;
+    sample_t *smp = imp->smp;
+    time_t this_secs;
+    unsigned this_usecs;
+    lt_line ln;
+
+    imp->offset += file_size + 1;
+    lt_init(&ln);
+    ptr = lt_scan(&ln, LT_BIT(LT_TSTAMP), line, line_end);
+    if (ln.found & LT_BIT(LT_TSTAMP)) {
+        this_secs = ln.secs;
+        this_usecs = ln.usecs;
+        if (this_secs < imp->last_secs || (this_secs == imp->last_secs && this_usecs <= imp->last_usecs)) {
+            this_secs = imp->last_secs;
+            this_usecs = ++imp->last_usecs;
+        }
+        else {
+            imp->last_secs = this_secs;
+            imp->last_usecs = this_usecs;
+        }
+        if ((stmt = pg_parse_line(smp, &ln, ptr, line_end))) {
+            smp->when.tv_sec = this_secs;
+            smp->when.tv_nsec = this_usecs;
+            smp->ptr.stmt = stmt;
+            if (++imp->smp >= imp->samples + BATCH_SIZE) {
+                /* a failed batch ends a file so the ledger stays put */
+                if (insert(imp) && imp->ledger)
+                    return MF_FAIL;
+            }
+        }
+    }
+    return MF_SUCCESS;
 }
 
-static void xml2pg(PGconn *conn, FILE *in)
+static void import_init(import_t *imp, PGconn *conn, ledger_entry *ent)
+{
+    imp->conn = conn;
+    imp->ledger = ent;
+    imp->offset = 0;
+    imp->last_secs = 0;
+    imp->last_usecs = 0;
+    imp->errors = 0;
+    imp->smp = imp->samples;
+    if (ent) {
+        imp->offset = ent->offset;
+        imp->last_secs = ent->last_secs;
+        imp->last_usecs = ent->last_usecs;
+    }
+}
+
+static int xml2pg(PGconn *conn, FILE *in)
 {
     char line[MAX_LINE_LEN];
-    time_t this_secs, last_secs;
-    unsigned this_usecs, last_usecs;
-    sample_t samples[BATCH_SIZE], *smp = samples;
-    sample_t *smp_last = samples + BATCH_SIZE;
+    import_t imp;
+    size_t len;
 
-    last_secs = last_usecs = 0;
+    import_init(&imp, conn, NULL);
     while (fgets(line, sizeof(line), in)) {
-        smp->ptr.data_ptr = smp->data;
-        const char *line_end = strchr(line, '\n');
-        if (!line_end) {
+        len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n')
+            len--;
+        else
             log_msg("line too long");
-            line_end = line + strlen(line);
-        }
-        const char *ptr = parse_real(smp, 0, "<host-tstamp>", line, line_end);
-        if (ptr) {
-            char *tsend;
-            this_secs = strtoul(smp->values[0], &tsend, 10);
-            this_usecs = strtoul(tsend, NULL, 10);
-            if (this_secs < last_secs || (this_secs == last_secs && this_usecs <= last_usecs)) {
-                this_secs = last_secs;
-                this_usecs = ++last_usecs;
-            }
-            else {
-                last_secs = this_secs;
-                last_usecs = this_usecs;
+        import_line(&imp, line, len);
+    }
+    if (imp.smp > imp.samples)
+        insert(&imp);
+    return imp.errors;
+}
+
+/*
+ * Import the part of a file not already recorded in the ledger, returning
+ * zero on success or the exit status to report.  As the time stamp is the
+ * key of the rows, a file that has shrunk is refused rather than imported
+ * again over the rows it already has.
+ */
+
+static int import_file(PGconn *conn, const char *file)
+{
+    ledger_entry ent;
+    struct stat stb;
+    import_t imp;
+    size_t offset;
+    int resume;
+
+    if (ledger_init(&ent, file, &stb) == 0 && ledger_get(conn, &ent) == 0) {
+        if ((resume = ledger_resume(&ent, &stb, 0)) < 0)
+            return 4;
+        if (resume) {
+            fprintf(stderr, "%s from byte %lu\n", file, (unsigned long)ent.offset);
+            ledger_done(&ent, &stb);
+            import_init(&imp, conn, &ent);
+            offset = ent.offset;
+            if (tf_parse_file_from(file, &offset, &imp, import_line) == MF_FAIL) {
+                if (imp.errors == 0)
+                    return 3;
             }
-            if ((ptr = parse_real(smp, 3, "<tmpr>", ptr, line_end))) {
-                if ((ptr = parse_int(smp, 1, "<sensor>", ptr, line_end))) {
-                    if ((ptr = parse_int(smp, 2, "<id>", ptr, line_end))) {
-                        smp->when.tv_sec = this_secs;
-                        smp->when.tv_nsec = this_usecs;
-                        if (parse_real(smp, 4, "<watts>", ptr, line_end))
-                            (smp++)->ptr.stmt = "power";
-                        else if (parse_int(smp, 4, "<imp>", ptr, line_end))
-                            (smp++)->ptr.stmt = "pulse";
-                        if (smp >= smp_last) {
-                            insert(conn, samples, smp);
-                            smp = samples;
-                        }
-                    }
-                }
+            else if (imp.offset != ent.offset || imp.smp > imp.samples)
+                insert(&imp);
+            if (imp.errors) {
+                log_msg("%d errors importing '%s'", imp.errors, file);
+                return 4;
             }
         }
+        return 0;
     }
-    if (smp >= smp_last)
-        insert(conn, samples, smp);
+    return 3;
 }
 
-int main(int argc, char **argv)
+/*
+ * In follow mode whatever has been read is inserted, with the ledger
+ * update, each time the end of the file is reached rather than waiting
+ * for a full batch.  The offset reached is the one the follower passes
+ * in.  A file that is truncated is refused as one that has shrunk is
+ * by import_file.
+ */
+
+static mf_status follow_cb(void *user_data, tf_event event, const char *file, size_t *offset, const struct stat *stb)
 {
-    int status;
-    if (--argc == 0) {
-        fputs("Usage: xml2pg <db-conn> [ <xml-file> ...]\n", stderr);
-        status = 1;
+    import_t *imp = user_data;
+    ledger_entry *ent = imp->ledger;
+    struct stat cur;
+
+    if (event == TF_OPEN) {
+        if (ledger_init(ent, file, &cur) || ledger_get(imp->conn, ent))
+            return MF_FAIL;
+        if (ledger_resume(ent, &cur, 0) < 0)
+            return MF_FAIL;
+        import_init(imp, imp->conn, ent);
+        *offset = ent->offset;
+        return MF_SUCCESS;
     }
-    else {
-        const char *db = *++argv;
-        PGconn *conn = PQconnectdb(db);
-        if (PQstatus(conn) != CONNECTION_OK) {
-            log_db_err(conn, "unable to connect to database '%s'", db);
-            status = 2;
-        }
-        else {
-            PGresult *res;
-            if ((res = PQexec(conn, "SET TIME ZONE UTC"))) {
-                if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-                    PQclear(res);
-                    if ((res = PQprepare(conn, "power", power_sql, 0, NULL))) {
-                        if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-                            PQclear(res);
-                            if ((res = PQprepare(conn, "pulse", pulse_sql, 0, NULL))) {
-                                if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-                                    PQclear(res);
-                                    status = 0;
-                                    if (argc == 1)
-                                        xml2pg(conn, stdin);
-                                    else {
-                                        while (--argc) {
-                                            const char *file = *++argv;
-                                            FILE *in = fopen(file, "r");
-                                            if (in) {
-                                                fprintf(stderr, "%s\n", file);
-                                                xml2pg(conn, in);
-                                                fclose(in);
+    if (event == TF_RESET) {
+        log_msg("'%s' was truncated, so remove its rows and its ledger entry to import it again", file);
+        return MF_FAIL;
+    }
+    imp->offset = *offset;
+    ledger_done(ent, stb);
+    if (imp->offset != ent->offset || imp->smp > imp->samples) {
+        if (insert(imp))
+            return MF_FAIL;
+        ent->offset = imp->offset;
+    }
+    return MF_SUCCESS;
+}
+
+static int follow_files(PGconn *conn)
+{
+    import_t imp;
+    ledger_entry ent;
+
+    imp.conn = conn;
+    imp.ledger = &ent;
+    if (tf_follow(xml_file, &imp, follow_cb, import_line) == MF_FAIL)
+        return 4;
+    return 0;
+}
+
+static PGconn *db_connect(const char *db)
+{
+    PGconn *conn;
+    PGresult *res;
+
+    conn = PQconnectdb(db);
+    if (PQstatus(conn) == CONNECTION_OK) {
+        if ((res = PQexec(conn, "SET TIME ZONE UTC"))) {
+            if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                PQclear(res);
+                if ((res = PQprepare(conn, "power", power_sql, 0, NULL))) {
+                    if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                        PQclear(res);
+                        if ((res = PQprepare(conn, "pulse", pulse_sql, 0, NULL))) {
+                            if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                                PQclear(res);
+                                if ((res = PQprepare(conn, "ledger_get", ledger_get_sql, 0, NULL))) {
+                                    if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                                        PQclear(res);
+                                        if ((res = PQprepare(conn, "ledger_put", ledger_put_sql, 0, NULL))) {
+                                            if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+                                                PQclear(res);
+                                                return conn;
                                             }
                                             else {
-                                                log_syserr("unable to open '%s' for reading", file);
-                                                status = 3;
+                                                log_db_err(conn, "error preparing ledger update SQL");
+                                                PQclear(res);
                                             }
                                         }
+                                        else
+                                            log_syserr("out of memory preparing ledger update SQL");
+                                    }
+                                    else {
+                                        log_db_err(conn, "error preparing ledger query SQL");
+                                        PQclear(res);
                                     }
                                 }
-                                else {
-                                    log_db_err(conn, "error preparing pulse SQL");
-                                    PQclear(res);
-                                    status = 2;
-                                }
+                                else
+                                    log_syserr("out of memory preparing ledger query SQL");
                             }
                             else {
-                                log_syserr("out of memory preparing pulse SQL");
-                                status = 2;
+                                log_db_err(conn, "error preparing pulse SQL");
+                                PQclear(res);
                             }
                         }
-                        else {
-                            log_db_err(conn, "error preparing power SQL");
-                            PQclear(res);
-                            status = 2;
-                        }
+                        else
+                            log_syserr("out of memory preparing pulse SQL");
                     }
                     else {
-                        log_syserr("out of memory preparing power SQL");
-                        status = 2;
+                        log_db_err(conn, "error preparing power SQL");
+                        PQclear(res);
                     }
                 }
-                else {
-                    log_db_err(conn, "error setting timezone");
-                    PQclear(res);
-                    status = 2;
-                }
+                else
+                    log_syserr("out of memory preparing power SQL");
             }
             else {
-                log_syserr("out of memory preparing time zone SQL");
-                status = 2;
+                log_db_err(conn, "error setting timezone");
+                PQclear(res);
             }
         }
+        else
+            log_syserr("out of memory preparing time zone SQL");
+    }
+    else
+        log_db_err(conn, "unable to connect to database '%s'", db);
+    PQfinish(conn);
+    return NULL;
+}
+
+static void set_status(work_queue_t *wq, int status)
+{
+    pthread_mutex_lock(&wq->lock);
+    if (status > wq->status)
+        wq->status = status;
+    pthread_mutex_unlock(&wq->lock);
+}
+
+static const char *next_file(work_queue_t *wq)
+{
+    const char *file = NULL;
+
+    pthread_mutex_lock(&wq->lock);
+    if (wq->next < wq->nfiles)
+        file = wq->files[wq->next++];
+    pthread_mutex_unlock(&wq->lock);
+    return file;
+}
+
+/*
+ * Each worker has its own connection and prepared statements and takes
+ * files from the shared queue until it is empty.  A failure with one file
+ * is logged and recorded in the overall exit status but does not stop the
+ * worker moving on to the next.
+ */
+
+static void *worker(void *ptr)
+{
+    work_queue_t *wq = ptr;
+    PGconn *conn;
+    const char *file;
+    int status;
+
+    if ((conn = db_connect(wq->db))) {
+        while ((file = next_file(wq)))
+            if ((status = import_file(conn, file)))
+                set_status(wq, status);
+        PQfinish(conn);
+    }
+    else
+        set_status(wq, 2);
+    return NULL;
+}
+
+static int run_jobs(work_queue_t *wq, int jobs)
+{
+    pthread_t threads[MAX_JOBS];
+    int i, res;
+
+    if (jobs > wq->nfiles)
+        jobs = wq->nfiles;
+    for (i = 0; i < jobs; i++) {
+        if ((res = pthread_create(&threads[i], NULL, worker, wq))) {
+            log_msg("unable to create worker thread - %s", strerror(res));
+            break;
+        }
+    }
+    if (i == 0)
+        worker(wq);
+    while (i > 0)
+        pthread_join(threads[--i], NULL);
+    if (wq->next < wq->nfiles) {
+        log_msg("%d files not imported", wq->nfiles - wq->next);
+        set_status(wq, 2);
+    }
+    return wq->status;
+}
+
+int main(int argc, char **argv)
+{
+    int status = 0, jobs = 1, follow = 0, c, errors;
+    work_queue_t wq;
+    PGconn *conn;
+
+    while ((c = getopt(argc, argv, "Fj:")) != EOF) {
+        switch (c) {
+            case 'F':
+                follow = 1;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs < 1 || jobs > MAX_JOBS) {
+                    log_msg("number of jobs must be between 1 and %d", MAX_JOBS);
+                    status = 1;
+                }
+                break;
+            default:
+                status = 1;
+        }
+    }
+    if (status || optind >= argc || (follow && optind + 1 != argc)) {
+        fputs("Usage: xml2pg [ -j jobs ] <db-conn> [ <xml-file> ...]\n"
+              "       xml2pg -F <db-conn>\n", stderr);
+        status = 1;
+    }
+    else if (follow) {
+        if ((conn = db_connect(argv[optind]))) {
+            status = follow_files(conn);
+            PQfinish(conn);
+        }
+        else
+            status = 2;
+    }
+    else if (optind + 1 == argc) {
+        if ((conn = db_connect(argv[optind]))) {
+            if ((errors = xml2pg(conn, stdin))) {
+                log_msg("%d errors importing from stdin", errors);
+                status = 4;
+            }
+            PQfinish(conn);
+        }
+        else
+            status = 2;
+    }
+    else {
+        wq.db = argv[optind];
+        wq.files = argv + optind + 1;
+        wq.nfiles = argc - optind - 1;
+        wq.next = 0;
+        wq.status = 0;
+        if ((status = pthread_mutex_init(&wq.lock, NULL)) == 0) {
+            status = run_jobs(&wq, jobs);
+            pthread_mutex_destroy(&wq.lock);
+        }
+        else {
+            log_msg("unable to initialise work queue lock - %s", strerror(status));
+            status = 2;
+        }
     }
     return status;
 }
@@ -0,0 +1,84 @@
+/*
+ * xml2rollup
+ *
+ * Rolls up the day files in the current directory into minute, hour and
+ * day records or, given day file names, just those days, and indexes the
+ * energy used in each from its minutes.  Today's file is left out as it is
+ * still being written; the logger rolls it up once the day is over.  Days
+ * are rolled up again after their files have been filled in, so the
+ * history buckets cached for them are invalidated.
+ */
+
+#define _GNU_SOURCE
+#include "cc-common.h"
+#include "energy.h"
+#include "hist-cache.h"
+#include "rollup.h"
+
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+const char prog_name[] = "xml2rollup";
+
+static int add_file(const char *file, time_t today)
+{
+    struct tm tm;
+    const char *end;
+    time_t day;
+
+    memset(&tm, 0, sizeof tm);
+    if ((end = strptime(file, xml_file, &tm)) == NULL || *end) {
+        log_msg("'%s' is not a day file name", file);
+        return -1;
+    }
+    if ((day = timegm(&tm)) >= today) {
+        log_msg("'%s' is not yet complete, skipped", file);
+        return 0;
+    }
+    if (ru_build_day(day) || en_build_day(day))
+        return -1;
+    bc_invalidate(BC_DIR, HIST_XML_NAME, day, day + 86400);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int status = 0, days = 0;
+    glob_t gl;
+    size_t i;
+    time_t today;
+
+    time(&today);
+    today -= today % 86400;
+    if (mkdir(rollup_dir, 0775) && errno != EEXIST) {
+        log_syserr("unable to create rollup directory '%s'", rollup_dir);
+        return 1;
+    }
+    if (mkdir(energy_dir, 0775) && errno != EEXIST) {
+        log_syserr("unable to create energy directory '%s'", energy_dir);
+        return 1;
+    }
+    if (argc > 1) {
+        while (--argc) {
+            if (add_file(*++argv, today))
+                status = 2;
+            else
+                days++;
+        }
+    }
+    else if (glob("cc-[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9].xml", 0, NULL, &gl) == 0) {
+        for (i = 0; i < gl.gl_pathc; i++) {
+            if (add_file(gl.gl_pathv[i], today))
+                status = 2;
+            else
+                days++;
+        }
+        globfree(&gl);
+    }
+    log_msg("rolled up %d days", days);
+    return status;
+}
@@ -1,30 +1,57 @@
 #include "cc-common.h"
+#include "hist-cache.h"
+#include "ledger.h"
 #include "parsefile.h"
+#include "sqlite-common.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <sqlite3.h>
-
 typedef struct _sqlite_ud {
     sqlite3 *db;
     sqlite3_stmt *sample_stmt;
     sqlite3_stmt *pulse_stmt;
+    sqlite3_stmt *ledger_get;
+    sqlite3_stmt *ledger_put;
+    time_t last_ts;
+    time_t from_ts;             /* inserted since the last commit, */
+    time_t to_ts;               /* zero for nothing */
+    ledger_entry follow;
 } sqlite_ud_t;
 
 const char prog_name[] = "xml2sqlite";
-const char db_file[] = DEFAULT_DIR "/cc.db";
-const char sample_sql[] = "INSERT INTO samples VALUES (?, ?, ?, ?)";
-const char pulse_sql[] = "INSERT INTO pulses VALUES (?, ?, ?, ?, ?)";
+const char ledger_get_sql[] = "SELECT size, mtime, byte_offset, last_stamp FROM import_ledger WHERE path = ?";
+const char ledger_put_sql[] = "INSERT OR REPLACE INTO import_ledger VALUES (?, ?, ?, ?, ?)";
 const char begin_txn[] = "BEGIN TRANSACTION";
 const char commit_txn[] = "COMMIT TRANSACTION";
 const char rollback_txn[] = "ROLLBACK TRANSACTION";
 
 static void log_sqlite3_err(const char *msg, sqlite_ud_t *ud)
 {
-    log_msg("%s: %s (%d)", msg, sqlite3_errmsg(ud->db), sqlite3_errcode(ud->db));
+    log_sqlite_err(ud->db, "%s", msg);
+}
+
+/*
+ * The history cache may hold buckets made before samples were added to
+ * them, so once the samples are committed the buckets covering them are
+ * invalidated.
+ */
+
+static void inserted(sqlite_ud_t *ud, time_t ts)
+{
+    if (ud->to_ts == 0 || ts < ud->from_ts)
+        ud->from_ts = ts;
+    if (ts > ud->to_ts)
+        ud->to_ts = ts;
+}
+
+static void committed(sqlite_ud_t *ud)
+{
+    if (ud->to_ts)
+        bc_invalidate(DEFAULT_DIR "/" BC_DIR, HIST_SQLITE_NAME, ud->from_ts, ud->to_ts + 1);
+    ud->from_ts = ud->to_ts = 0;
 }
 
 static mf_status sample_cb(pf_context * ctx, pf_sample * smp)
@@ -34,13 +61,22 @@ static mf_status sample_cb(pf_context * ctx, pf_sample * smp)
     sqlite3_stmt *stmt = ud->sample_stmt;
     int rc;
     if ((rc = sqlite3_bind_int64(stmt, 1, smp->timestamp)) == SQLITE_OK) {
-        if ((rc = sqlite3_bind_double(stmt, 2, smp->temp)) == SQLITE_OK) {
+        if ((rc = sqlite3_bind_double(stmt, 2, temp_to_double(smp->temp))) == SQLITE_OK) {
             if ((rc = sqlite3_bind_int(stmt, 3, smp->sensor)) == SQLITE_OK) {
-                if ((rc = sqlite3_bind_double(stmt, 4, smp->data.watts)) == SQLITE_OK) {
-                    if ((rc = sqlite3_step(stmt)) == SQLITE_DONE)
-                        status = MF_SUCCESS;
+                if ((rc = sqlite3_bind_double(stmt, 4, watts_to_double(smp->data.watts))) == SQLITE_OK) {
+                    if ((rc = sqlite3_bind_int(stmt, 5, smp->usecs)) == SQLITE_OK) {
+                        if ((rc = sqlite3_step(stmt)) == SQLITE_DONE) {
+                            ud->last_ts = smp->timestamp;
+                            inserted(ud, smp->timestamp);
+                            status = MF_SUCCESS;
+                        }
+                        else {
+                            log_sqlite3_err("unable to prepare sample insert statement", ud);
+                            status = MF_FAIL;
+                        }
+                    }
                     else {
-                        log_sqlite3_err("unable to prepare sample insert statement", ud);
+                        log_sqlite3_err("unable to bind usecs to sample insert statement", ud);
                         status = MF_FAIL;
                     }
                 }
@@ -74,14 +110,23 @@ static mf_status pulse_cb(pf_context * ctx, pf_sample * smp)
     sqlite3_stmt *stmt = ud->pulse_stmt;
     int rc;
     if ((rc = sqlite3_bind_int64(stmt, 1, smp->timestamp)) == SQLITE_OK) {
-        if ((rc = sqlite3_bind_double(stmt, 2, smp->temp)) == SQLITE_OK) {
+        if ((rc = sqlite3_bind_double(stmt, 2, temp_to_double(smp->temp))) == SQLITE_OK) {
             if ((rc = sqlite3_bind_int(stmt, 3, smp->sensor)) == SQLITE_OK) {
                 if ((rc = sqlite3_bind_int64(stmt, 4, smp->data.pulse.count)) == SQLITE_OK) {
                     if ((rc = sqlite3_bind_int(stmt, 5, smp->data.pulse.ipu)) == SQLITE_OK) {
-                        if ((rc = sqlite3_step(stmt)) == SQLITE_DONE)
-                            status = MF_SUCCESS;
+                        if ((rc = sqlite3_bind_int(stmt, 6, smp->usecs)) == SQLITE_OK) {
+                            if ((rc = sqlite3_step(stmt)) == SQLITE_DONE) {
+                                ud->last_ts = smp->timestamp;
+                                inserted(ud, smp->timestamp);
+                                status = MF_SUCCESS;
+                            }
+                            else {
+                                log_sqlite3_err("unable to execute pulse insert statement", ud);
+                                status = MF_FAIL;
+                            }
+                        }
                         else {
-                            log_sqlite3_err("unable to execute pulse insert statement", ud);
+                            log_sqlite3_err("unable to bind usecs to pulse insert statement", ud);
                             status = MF_FAIL;
                         }
                     }
@@ -125,60 +170,221 @@ static int do_sql(sqlite3 *db, const char *sql, int len)
     return rc;
 }
 
+static int ledger_get(sqlite_ud_t *ud, ledger_entry *ent)
+{
+    sqlite3_stmt *stmt = ud->ledger_get;
+    int status = -1, rc;
+
+    if (sqlite3_bind_text(stmt, 1, ent->path, -1, SQLITE_STATIC) == SQLITE_OK) {
+        if ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            ent->size = sqlite3_column_int64(stmt, 0);
+            ent->mtime = sqlite3_column_int64(stmt, 1);
+            ent->offset = sqlite3_column_int64(stmt, 2);
+            ent->last_secs = sqlite3_column_int64(stmt, 3);
+            status = 0;
+        }
+        else if (rc == SQLITE_DONE)
+            status = 0;
+        else
+            log_sqlite3_err("unable to read import ledger", ud);
+    }
+    else
+        log_sqlite3_err("unable to bind path to ledger query", ud);
+    sqlite3_reset(stmt);
+    return status;
+}
+
+static int ledger_put(sqlite_ud_t *ud, ledger_entry *ent)
+{
+    sqlite3_stmt *stmt = ud->ledger_put;
+    int status = -1;
+
+    if (sqlite3_bind_text(stmt, 1, ent->path, -1, SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_bind_int64(stmt, 2, ent->size) == SQLITE_OK
+        && sqlite3_bind_int64(stmt, 3, ent->mtime) == SQLITE_OK
+        && sqlite3_bind_int64(stmt, 4, ent->offset) == SQLITE_OK
+        && sqlite3_bind_int64(stmt, 5, ud->last_ts) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_DONE)
+            status = 0;
+        else
+            log_sqlite3_err("unable to update import ledger", ud);
+    }
+    else
+        log_sqlite3_err("unable to bind values to ledger update", ud);
+    sqlite3_reset(stmt);
+    return status;
+}
+
+/*
+ * Import the part of the file after the offset recorded in the ledger.
+ * The ledger update happens inside the same transaction as the samples.
+ */
+
+static mf_status import_file(sqlite_ud_t *ud, pf_context *pf, const char *file)
+{
+    ledger_entry ent;
+    struct stat stb;
+    mf_status status = MF_FAIL;
+
+    if (ledger_init(&ent, file, &stb) == 0 && ledger_get(ud, &ent) == 0) {
+        status = MF_SUCCESS;
+        if (ledger_resume(&ent, &stb, 1)) {
+            ud->last_ts = ent.last_secs;
+            ledger_done(&ent, &stb);
+            if ((status = tf_parse_file_from(file, &ent.offset, pf, pf_parse_line)) != MF_FAIL)
+                if (ledger_put(ud, &ent))
+                    status = MF_FAIL;
+        }
+    }
+    return status;
+}
+
+/*
+ * In follow mode the samples read so far are committed, together with
+ * the ledger, each time the end of the file is reached, and a new
+ * transaction started for whatever comes next.
+ */
+
+static mf_status follow_cb(void *user_data, tf_event event, const char *file, size_t *offset, const struct stat *stb)
+{
+    pf_context *pf = user_data;
+    sqlite_ud_t *ud = pf->user_data;
+    ledger_entry *ent = &ud->follow;
+    struct stat cur;
+
+    if (event == TF_OPEN) {
+        if (ledger_init(ent, file, &cur) || ledger_get(ud, ent))
+            return MF_FAIL;
+        ledger_resume(ent, &cur, 1);
+        ud->last_ts = ent->last_secs;
+        *offset = ent->offset;
+        return MF_SUCCESS;
+    }
+    if (event == TF_RESET) {
+        ent->offset = 0;
+        ent->last_secs = 0;
+        ent->last_usecs = 0;
+        ud->last_ts = 0;
+        return MF_SUCCESS;
+    }
+    ent->offset = *offset;
+    ledger_done(ent, stb);
+    if (ledger_put(ud, ent) == 0) {
+        if (do_sql(ud->db, commit_txn, sizeof(commit_txn) - 1) == SQLITE_OK) {
+            committed(ud);
+            if (do_sql(ud->db, begin_txn, sizeof(begin_txn) - 1) == SQLITE_OK)
+                return MF_SUCCESS;
+            else
+                log_sqlite3_err("unable to start transaction", ud);
+        }
+        else
+            log_sqlite3_err("unable to commit transaction", ud);
+    }
+    return MF_FAIL;
+}
+
+static int prepare_schema(sqlite_ud_t *ud)
+{
+    int rc;
+
+    if ((rc = sqlite3_exec(ud->db, sqlite_schema, NULL, NULL, NULL)) == SQLITE_OK) {
+        if ((rc = sqlite3_prepare_v2(ud->db, ledger_get_sql, sizeof(ledger_get_sql) - 1, &ud->ledger_get, NULL)) == SQLITE_OK) {
+            if ((rc = sqlite3_prepare_v2(ud->db, ledger_put_sql, sizeof(ledger_put_sql) - 1, &ud->ledger_put, NULL)) == SQLITE_OK)
+                return rc;
+            else
+                log_sqlite3_err("unable to prepare ledger update statement", ud);
+            sqlite3_finalize(ud->ledger_get);
+        }
+        else
+            log_sqlite3_err("unable to prepare ledger query statement", ud);
+    }
+    else
+        log_sqlite3_err("unable to create tables", ud);
+    return rc;
+}
+
 int main(int argc, char **argv)
 {
-    int status = 0, rc;
+    int status = 0, rc, forward = 1;
     sqlite_ud_t ud;
     pf_context *pf;
     const char *arg;
+    mf_status mfs;
 
-    if ((rc = sqlite3_open(db_file, &ud.db)) == 0) {
-        if ((rc = sqlite3_prepare_v2(ud.db, sample_sql, sizeof(sample_sql) - 1, &ud.sample_stmt, NULL)) == SQLITE_OK) {
-            if ((rc = sqlite3_prepare_v2(ud.db, pulse_sql, sizeof(pulse_sql) - 1, &ud.pulse_stmt, NULL)) == SQLITE_OK) {
-                if ((rc = do_sql(ud.db, begin_txn, sizeof(begin_txn) - 1)) == SQLITE_OK) {
-                    if ((pf = pf_new())) {
-                        pf->sample_cb = sample_cb;
-                        pf->pulse_cb = pulse_cb;
-                        pf->user_data = &ud;
-                        while (--argc) {
-                            arg = *++argv;
-                            if (arg[0] == '-' && arg[1] == 'f')
-                                pf->file_cb = tf_parse_cb_forward;
-                            else if (arg[0] == '-' && arg[1] == 'b')
-                                pf->file_cb = tf_parse_cb_backward;
-                            else if (pf_parse_file(pf, arg) == MF_FAIL) {
-                                status = 4;
-                                break;
+    if ((rc = sqlite3_open(sqlite_db_file, &ud.db)) == 0) {
+        if ((rc = prepare_schema(&ud)) == SQLITE_OK) {
+            if ((rc = sqlite3_prepare_v2(ud.db, sqlite_sample_sql, -1, &ud.sample_stmt, NULL)) == SQLITE_OK) {
+                if ((rc = sqlite3_prepare_v2(ud.db, sqlite_pulse_sql, -1, &ud.pulse_stmt, NULL)) == SQLITE_OK) {
+                    if ((rc = do_sql(ud.db, begin_txn, sizeof(begin_txn) - 1)) == SQLITE_OK) {
+                        if ((pf = pf_new())) {
+                            pf->sample_cb = sample_cb;
+                            pf->pulse_cb = pulse_cb;
+                            pf->user_data = &ud;
+                            ud.from_ts = ud.to_ts = 0;
+                            while (--argc) {
+                                arg = *++argv;
+                                if (arg[0] == '-' && arg[1] == 'f') {
+                                    pf->file_cb = tf_parse_cb_forward;
+                                    forward = 1;
+                                }
+                                else if (arg[0] == '-' && arg[1] == 'b') {
+                                    pf->file_cb = tf_parse_cb_backward;
+                                    forward = 0;
+                                }
+                                else if (arg[0] == '-' && arg[1] == 'F') {
+                                    if (tf_follow(xml_file, pf, follow_cb, pf_parse_line) == MF_FAIL) {
+                                        status = 4;
+                                        break;
+                                    }
+                                }
+                                else {
+                                    /* the ledger only tracks forward imports */
+                                    if (forward)
+                                        mfs = import_file(&ud, pf, arg);
+                                    else
+                                        mfs = pf_parse_file(pf, arg);
+                                    if (mfs == MF_FAIL) {
+                                        status = 4;
+                                        break;
+                                    }
+                                }
                             }
+                            if (status == 0) {
+                                if ((rc = do_sql(ud.db, commit_txn, sizeof(commit_txn) - 1)) != 0)
+                                    log_sqlite3_err("unable to commit transaction", &ud);
+                                else
+                                    committed(&ud);
+                            }
+                            else {
+                                if ((rc = do_sql(ud.db, rollback_txn, sizeof(rollback_txn) - 1)) != 0)
+                                    log_sqlite3_err("unable to rollback transaction", &ud);
+                            }
+                            pf_free(pf);
                         }
-                        if (status == 0) {
-                            if ((rc = do_sql(ud.db, commit_txn, sizeof(commit_txn) - 1)) != 0)
-                                log_sqlite3_err("unable to commit transaction", &ud);
-                        }
-                        else {
-                            if ((rc = do_sql(ud.db, rollback_txn, sizeof(rollback_txn) - 1)) != 0)
-                                log_sqlite3_err("unable to rollback transaction", &ud);
-                        }
+                        else
+                            status = 3;
                     }
-                    else
-                        status = 3;
+                    else {
+                        log_sqlite3_err("unable to start transaction", &ud);
+                        status = 2;
+                    }
+                    sqlite3_finalize(ud.pulse_stmt);
                 }
                 else {
-                    log_sqlite3_err("unable to start transaction", &ud);
+                    log_sqlite3_err("unable to prepare pulse insert statement", &ud);
                     status = 2;
                 }
-                sqlite3_finalize(ud.pulse_stmt);
+                sqlite3_finalize(ud.sample_stmt);
             }
             else {
-                log_sqlite3_err("unable to prepare pulse insert statement", &ud);
+                log_sqlite3_err("unable to prepare sample insert statement", &ud);
                 status = 2;
             }
-            sqlite3_finalize(ud.sample_stmt);
+            sqlite3_finalize(ud.ledger_put);
+            sqlite3_finalize(ud.ledger_get);
         }
-        else {
-            log_sqlite3_err("unable to prepare sample insert statement", &ud);
+        else
             status = 2;
-        }
         sqlite3_close(ud.db);
     }
     else {